@@ -36,30 +36,37 @@
 #include "nocsim.h"
 #include <math.h>
 
+using namespace std;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
 
-GridRouter::GridRouter(uint16_t low, uint16_t high, xypos pos, bool random)
-	: NOCRouter(low, high, pos)
-	, m_randomRouting(random)
+GridRouter::GridRouter(
+	uint16_t low,
+	uint16_t high,
+	unsigned int x,
+	unsigned int y,
+	unsigned int width,
+	xypos pos,
+	RoutingAlgorithm routing)
+	: NOCRouter(low, high, high - low + 1 + 4, pos)
+	, m_childCount(GetSubnetSize())
+	, m_gridWidth(width)
+	, m_xpos(x)
+	, m_ypos(y)
+	, m_routing(routing)
 {
 	for(int i=0; i<4; i++)
 		m_neighbors[i] = NULL;
-	for(int i=0; i<16; i++)
-		m_children[i] = NULL;
-
-	for(int i=0; i<20; i++)
-	{
-		m_outboxBlocked[i] = false;
-		m_inboxValid[i] = false;
-		m_inboxForwardTime[i] = 0;
-		m_outboxClearTime[i] = 0;
-	}
-
-	m_rrcount = 0;
-
-	m_ypos = m_subnetLow >> 6;
-	m_xpos = (m_subnetLow >> 4) & 0x3;
+	m_children.resize(m_childCount, NULL);
+
+	//Each child gets its own port. Everything under another router goes the same way
+	for(unsigned int i=0; i<m_childCount; i++)
+		m_childRoutes.push_back(i);
+	m_routeBlockSize = m_childCount;
+	unsigned int nrouters = (g_hostCount + m_childCount - 1) / m_childCount;
+	for(unsigned int i=0; i<nrouters; i++)
+		m_routes.push_back(ComputeRoute(i * m_childCount));
 }
 
 GridRouter::~GridRouter()
@@ -75,12 +82,47 @@ void GridRouter::AddChild(SimNode* child)
 		return;
 	}
 
-	m_children[node->GetAddress() & 0xf] = child;
+	unsigned int port = node->GetAddress() - m_subnetLow;
+	m_children[port] = child;
+	ConnectPort(port, child);
 }
 
 void GridRouter::AddNeighbor(int direction, GridRouter* peer)
 {
 	m_neighbors[direction] = peer;
+	ConnectPort(m_childCount + direction, peer);
+}
+
+bool GridRouter::ParseRoutingAlgorithm(string s, RoutingAlgorithm& routing)
+{
+	if(s == "xy")
+		routing = ROUTE_XY;
+	else if(s == "random")
+		routing = ROUTE_RANDOM;
+	else if(s == "west-first")
+		routing = ROUTE_WEST_FIRST;
+	else if(s == "odd-even")
+		routing = ROUTE_ODD_EVEN;
+	else
+		return false;
+	return true;
+}
+
+const char* GridRouter::GetRoutingAlgorithmName(RoutingAlgorithm routing)
+{
+	switch(routing)
+	{
+		case ROUTE_XY:
+			return "X-Y";
+		case ROUTE_RANDOM:
+			return "pseudorandom";
+		case ROUTE_WEST_FIRST:
+			return "west-first";
+		case ROUTE_ODD_EVEN:
+			return "odd-even";
+		default:
+			return "invalid";
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -88,8 +130,9 @@ void GridRouter::AddNeighbor(int direction, GridRouter* peer)
 
 void GridRouter::ExpandBoundingBox(unsigned int& width, unsigned int& height)
 {
+	//Leave room for the node to grow when rendered with a high utilization
 	const unsigned int nodesize = 10;
-	const unsigned int radius = nodesize / 2;
+	const unsigned int radius = nodesize;
 	const unsigned int right = m_renderPosition.first + radius;
 	const unsigned int bottom = m_renderPosition.second + radius;
 
@@ -101,76 +144,96 @@ void GridRouter::ExpandBoundingBox(unsigned int& width, unsigned int& height)
 
 void GridRouter::RenderSVGNodes(FILE* fp)
 {
-	const unsigned int nodesize = 10;
-	const unsigned int radius = nodesize / 2;
-
-	fprintf(
-		fp,
-		"<circle cx=\"%u\" cy=\"%u\" r=\"%u\" stroke=\"green\" stroke-width=\"1\" fill=\"white\"/>\n",
-		m_renderPosition.first,
-		m_renderPosition.second,
-		radius);
+	RenderHeatNode(fp);
 }
 
 void GridRouter::RenderSVGLines(FILE* fp)
 {
-	for(int i=0; i<4; i++)
+	//Only draw the east and south links, our west/north neighbors draw the others
+	for(int i=1; i<=2; i++)
 	{
 		auto c = m_neighbors[i];
 		if(c == NULL)	//null neighbors are legal at edge of network
 			continue;
-		fprintf(fp,
-			"<line x1=\"%u\" y1=\"%u\" x2=\"%u\" y2=\"%u\" stroke=\"cyan\" stroke-width=\"1\" />\n",
-			c->m_renderPosition.first,
-			c->m_renderPosition.second,
-			m_renderPosition.first,
-			m_renderPosition.second);
+		RenderHeatLink(fp, c->m_renderPosition, m_childCount + i);
 	}
 
-	for(int i=0; i<16; i++)
+	for(unsigned int i=0; i<m_childCount; i++)
 	{
 		auto c = m_children[i];
 		if(c == NULL)
 			continue;
-		fprintf(fp,
-			"<line x1=\"%u\" y1=\"%u\" x2=\"%u\" y2=\"%u\" stroke=\"blue\" stroke-width=\"1\" />\n",
-			c->m_renderPosition.first,
-			c->m_renderPosition.second,
-			m_renderPosition.first,
-			m_renderPosition.second);
+		RenderHeatLink(fp, c->m_renderPosition, i);
 	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// Simulation
+// Statistics
 
-unsigned int GridRouter::GetPortNumber(SimNode* node)
+string GridRouter::GetName()
 {
-	auto router = dynamic_cast<GridRouter*>(node);
-	if(router)
-		return GetPortNumber(router->GetSubnetBase());
+	char name[32];
+	snprintf(name, sizeof(name), "%s(%u; %u)", GetNetworkPrefix(), m_xpos, m_ypos);
+	return name;
+}
 
-	auto host = dynamic_cast<NOCHost*>(node);
-	if(!host)
+void GridRouter::GetLinkStats(vector<LinkStats>& stats)
+{
+	static const char* directions[4] = {"north", "east", "south", "west"};
+
+	char name[32];
+	for(unsigned int i=0; i<m_childCount; i++)
+	{
+		if(m_children[i] == NULL)
+			continue;
+
+		LinkStats s;
+		FillLinkStats(s, i);
+		snprintf(name, sizeof(name), "child%u", i);
+		s.m_port = name;
+		snprintf(name, sizeof(name), "%04x", m_subnetLow + i);
+		s.m_peer = name;
+		stats.push_back(s);
+	}
+
+	for(unsigned int i=0; i<4; i++)
 	{
-		LogWarning("Node is not a router or host\n");
-		return 0;
+		if(m_neighbors[i] == NULL)
+			continue;
+
+		LinkStats s;
+		FillLinkStats(s, m_childCount + i);
+		s.m_port = directions[i];
+		s.m_peer = m_neighbors[i]->GetName();
+		stats.push_back(s);
 	}
-	return GetPortNumber(host->GetAddress());
 }
 
-unsigned int GridRouter::GetPortNumber(uint16_t addr)
-{
-	//In our subnet? Just use the low LSBs
-	if( (addr & 0xfff0) == m_subnetLow)
-		return (addr & 0x000f);
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Simulation
 
-	//Not in our subnet. Find the Manhattan vector between us and them
-	unsigned int target_ypos = addr >> 6;
-	unsigned int target_xpos = (addr >> 4) & 0x3;
+/**
+	@brief Figure out the deterministic route to an address (used to fill in the routing tables)
+ */
+unsigned int GridRouter::ComputeRoute(uint16_t addr)
+{
+	//In our subnet? Port number is the offset from our base address
+	if( (addr >= m_subnetLow) && (addr <= m_subnetHigh) )
+		return addr - m_subnetLow;
+
+	//Not in our subnet. Find the Manhattan vector between us and them.
+	unsigned int target_xpos;
+	unsigned int target_ypos;
+	GetRouterPosition(addr, target_xpos, target_ypos);
 	int dx = target_xpos - m_xpos;
 	int dy = target_ypos - m_ypos;
 
+	//Ports for each direction
+	const unsigned int north = m_childCount + 0;
+	const unsigned int east = m_childCount + 1;
+	const unsigned int south = m_childCount + 2;
+	const unsigned int west = m_childCount + 3;
+
 	/*
 	LogDebug("[%5u] GridRouter (%u, %u): routing to (%u, %u), vector (%d, %d)\n",
 		g_time,
@@ -181,23 +244,24 @@ unsigned int GridRouter::GetPortNumber(uint16_t addr)
 
 	//Easy case: if offset along one axis only, move in that direction
 	if( (dx > 0) && (dy == 0) )	//target is east of us
-		return 17;
+		return east;
 	if( (dx < 0) && (dy == 0) )	//target is west of us
-		return 19;
+		return west;
 	if( (dx == 0) && (dy > 0) )	//target is south of us
-		return 18;
+		return south;
 	if( (dx == 0) && (dy < 0) )	//target is north of us
-		return 16;
+		return north;
 
 	//Target is diagonal from us, we have to decide which axis to move on first
 
-	//If doing X-Y routing, move along the X axis and only do Y once they're due north/south from us
-	if(!m_randomRouting)
+	//If doing X-Y routing, move along the X axis and only do Y once they're due north/south from us.
+	//The adaptive algorithms use this as their preferred route too
+	if(m_routing != ROUTE_RANDOM)
 	{
 		if(dx > 0)				//target is north/southeast, move east
-			return 17;
+			return east;
 		else					//target is north/southwest, move west
-			return 19;
+			return west;
 	}
 
 	//Pseudorandom routing based on some hash of the addresses
@@ -208,117 +272,114 @@ unsigned int GridRouter::GetPortNumber(uint16_t addr)
 		if( (target_xpos + target_ypos + m_xpos + m_ypos) & 1 )
 		{
 			if(dx > 0)				//target is north/southeast, move east
-				return 17;
+				return east;
 			else					//target is north/southwest, move west
-				return 19;
+				return west;
 		}
 
 		//Otherwise, route along Y axis
 		else
 		{
 			if(dy > 0)				//target is southweast/west, move south
-				return 18;
+				return south;
 			else					//target is northeast/west, move north
-				return 16;
+				return north;
 		}
 	}
 }
 
-bool GridRouter::AcceptMessage(NOCPacket packet, SimNode* from)
+/**
+	@brief Get the node on the far end of a port
+ */
+SimNode* GridRouter::GetPortNode(unsigned int port)
 {
-	unsigned int srcport = GetPortNumber(from);
-
-	//If inbox is already full, reject it!
-	if(m_inboxValid[srcport])
-	{
-		LogError(
-			"[%5u] GridRouter (%u, %u): rejecting %d-word message from %04x to %04x (on port %d): bus fight!\n",
-			g_time, m_xpos, m_ypos, packet.m_size, packet.m_from, packet.m_to, srcport);
-		return false;
-	}
-
-	//We're good, accept it
-	//LogDebug("[%5u] GridRouter (%u, %u): accepting %d-word message from %04x to %04x (on port %d)\n",
-	//	g_time, m_xpos, m_ypos, packet.m_size, packet.m_from, packet.m_to, srcport);
-	m_inboxes[srcport] = packet;
-	m_inboxValid[srcport] = true;
-	m_inboxForwardTime[srcport] = g_time + 4;	//4 cycle forwarding latency assuming 32-bit bus width
-	return true;
+	if(port >= m_childCount)
+		return m_neighbors[port - m_childCount];
+	return m_children[port];
 }
 
-void GridRouter::Timestep()
-{
-	//Clear any outboxes that became available this clock
-	for(int i=0; i<20; i++)
-	{
-		if(m_outboxBlocked[i] && (m_outboxClearTime[i] < g_time) )
-			m_outboxBlocked[i] = false;
-	}
-
-	//Try forwarding from our round-robin winner first, they always have first priority
-	if(TryForwardFrom(m_rrcount))
-		m_rrcount = (m_rrcount + 1);
+/**
+	@brief Find the position of the router a given address is attached to.
 
-	//Try forwarding from every other port
-	for(int i=0; i<20; i++)
-	{
-		if(TryForwardFrom(i))
-			m_rrcount = (m_rrcount + 1) % 20;
-	}
+	Routers are numbered left to right, then top to bottom, with m_childCount addresses under each one
+ */
+void GridRouter::GetRouterPosition(uint16_t addr, unsigned int& x, unsigned int& y)
+{
+	unsigned int router = addr / m_childCount;
+	y = router / m_gridWidth;
+	x = router % m_gridWidth;
 }
 
 /**
-	@brief Try forwarding the message located in the specified port's inbox (if present)
+	@brief Get the legal minimal routes for a packet under our routing algorithm. The first one is our preference if
+	nothing is congested.
+
+	Both adaptive algorithms are turn models, so they're deadlock free without needing to restrict which VC a packet
+	goes on.
  */
-bool GridRouter::TryForwardFrom(unsigned int nport)
+void GridRouter::GetRouteCandidates(const NOCPacket& packet, vector<unsigned int>& ports)
 {
-	//If inbox is empty, nothing to do
-	if(!m_inboxValid[nport])
-		return false;
-
-	//If we're still receiving this packet, nothing to do
-	if(m_inboxForwardTime[nport] > g_time)
-		return false;
-
-	auto& packet = m_inboxes[nport];
+	//Deterministic routing, or local delivery: only one choice
+	uint16_t addr = packet.m_to;
+	if( (m_routing == ROUTE_XY) || (m_routing == ROUTE_RANDOM) || ( (addr >= m_subnetLow) && (addr <= m_subnetHigh) ) )
+	{
+		ports.push_back(GetPortNumber(addr));
+		return;
+	}
 
-	//Packet is forwardable. See where it goes.
-	unsigned int dstaddr = m_inboxes[nport].m_to;
-	unsigned int dstport = GetPortNumber(dstaddr);
+	unsigned int target_xpos;
+	unsigned int target_ypos;
+	GetRouterPosition(addr, target_xpos, target_ypos);
+	int dx = target_xpos - m_xpos;
+	int dy = target_ypos - m_ypos;
 
-	//If the destination port is currently occupied, we can't do anything this cycle
-	if(m_outboxBlocked[dstport])
-		return false;
+	const unsigned int east = m_childCount + 1;
+	const unsigned int west = m_childCount + 3;
+	const unsigned int vertical = (dy > 0) ? (m_childCount + 2) : (m_childCount + 0);
 
-	//If message is unforwardable, drop it
-	if( (dstport < 16) && (m_children[dstport] == NULL) )
+	//Straight line: only one minimal route
+	if( (dx == 0) || (dy == 0) )
 	{
-		LogDebug("[%5u] GridRouter (%u, %u): cannot forward message to %04x: child port is null!\n",
-			g_time, m_xpos, m_ypos, packet.m_to);
-		m_inboxValid[nport] = false;
-		return false;
+		ports.push_back(GetPortNumber(addr));
+		return;
 	}
-	else if((dstport >= 16) && (m_neighbors[dstport & 3] == NULL) )
+
+	if(m_routing == ROUTE_WEST_FIRST)
 	{
-		LogDebug("[%5u] GridRouter (%u, %u): cannot forward message to %04x: neighbor port %d (%d) is null!\n",
-			g_time, m_xpos, m_ypos, packet.m_to, dstport & 3, dstport);
-		m_inboxValid[nport] = false;
-		return false;
+		//Any westward hops have to come first
+		if(dx < 0)
+			ports.push_back(west);
+
+		//Then we're free to pick
+		else
+		{
+			ports.push_back(east);
+			ports.push_back(vertical);
+		}
 	}
 
-	//Forward the packet
-	//LogDebug("[%5u] GridRouter (%u, %u): forwarding %d-word message from %04x to %04x (out port %d)\n",
-	//	g_time, xpos, ypos, packet.m_size, packet.m_from, packet.m_to, dstport);
-	if(dstport >= 16)
-		m_neighbors[dstport & 3]->AcceptMessage(packet, this);
 	else
-		m_children[dstport]->AcceptMessage(packet, this);
+	{
+		unsigned int source_xpos;
+		unsigned int source_ypos;
+		GetRouterPosition(packet.m_from, source_xpos, source_ypos);
 
-	//Output port is busy for the next 4 clocks
-	m_outboxBlocked[dstport] = true;
-	m_outboxClearTime[dstport] = g_time + 4;
+		//Eastbound. Can only turn north/south from the east in an odd column (or in the source column, since we
+		//didn't come from the east). Don't go east into the target column if it's even, we couldn't turn there
+		if(dx > 0)
+		{
+			if( (dx != 1) || (target_xpos & 1) )
+				ports.push_back(east);
+			if( (m_xpos & 1) || (m_xpos == source_xpos) )
+				ports.push_back(vertical);
+		}
 
-	//Inbox is now available
-	m_inboxValid[nport] = false;
-	return true;
+		//Westbound. Can't turn from north/south to the west in an odd column, so only leave the column in an even one
+		else
+		{
+			ports.push_back(west);
+			if( (m_xpos & 1) == 0)
+				ports.push_back(vertical);
+		}
+	}
 }
@@ -38,17 +38,42 @@
 class GridRouter : public NOCRouter
 {
 public:
+
+	/**
+		@brief How packets pick a path through the grid
+	 */
+	enum RoutingAlgorithm
+	{
+		//Deterministic: all the way along X, then along Y
+		ROUTE_XY,
+
+		//Deterministic: X or Y first based on a hash of the current and target positions. Can deadlock
+		ROUTE_RANDOM,
+
+		//Adaptive: go west first if we have to, then any minimal route (no turns into the west)
+		ROUTE_WEST_FIRST,
+
+		//Adaptive: odd-even turn model (no east-north/east-south turns in even columns, and no
+		//north-west/south-west turns in odd columns)
+		ROUTE_ODD_EVEN
+	};
+
+	static bool ParseRoutingAlgorithm(std::string s, RoutingAlgorithm& routing);
+	static const char* GetRoutingAlgorithmName(RoutingAlgorithm routing);
+
 	GridRouter(
 		uint16_t low,
 		uint16_t high,
+		unsigned int x,
+		unsigned int y,
+		unsigned int width,
 		xypos pos,
-		bool random);
+		RoutingAlgorithm routing);
 	virtual ~GridRouter();
 
-	virtual bool AcceptMessage(NOCPacket packet, SimNode* from);
-	virtual void Timestep();
-
 	virtual void AddChild(SimNode* child);
+	virtual void GetLinkStats(std::vector<LinkStats>& stats);
+	virtual std::string GetName();
 
 	virtual void ExpandBoundingBox(unsigned int& width, unsigned int& height);
 	virtual void RenderSVGNodes(FILE* fp);
@@ -59,30 +84,25 @@ public:
 protected:
 	GridRouter* m_neighbors[4];	//0=north, 1=east, 2=south, 3=west
 
-	SimNode* m_children[16];
-
-	//We have a total of 20 peers... 15:0 are children, 19:16 are neighbors
-	unsigned int GetPortNumber(SimNode* node);
-	unsigned int GetPortNumber(uint16_t addr);
+	std::vector<SimNode*> m_children;
 
-	bool TryForwardFrom(unsigned int nport);
+	//Number of child ports (equal to our subnet size)
+	unsigned int m_childCount;
 
-	//Incoming messages (not yet forwarded)
-	NOCPacket m_inboxes[20];
-	bool m_inboxValid[20];
-	unsigned int m_inboxForwardTime[20];
+	//Width of the grid (in routers)
+	unsigned int m_gridWidth;
 
-	//Outgoing messages
-	bool m_outboxBlocked[20];
-	unsigned int m_outboxClearTime[20];
+	//The first m_childCount ports are children, the last 4 are neighbors
+	unsigned int ComputeRoute(uint16_t addr);
+	virtual SimNode* GetPortNode(unsigned int port);
+	virtual void GetRouteCandidates(const NOCPacket& packet, std::vector<unsigned int>& ports);
 
-	//Round-robin counter
-	unsigned int m_rrcount;
+	void GetRouterPosition(uint16_t addr, unsigned int& x, unsigned int& y);
 
 	unsigned int m_xpos;
 	unsigned int m_ypos;
 
-	bool m_randomRouting;
+	RoutingAlgorithm m_routing;
 };
 
 #endif
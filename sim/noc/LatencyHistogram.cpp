@@ -0,0 +1,214 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Log-bucketed latency histogram
+ */
+
+#include "nocsim.h"
+#include <math.h>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+LatencyHistogram::LatencyHistogram()
+{
+	Clear();
+}
+
+void LatencyHistogram::Clear()
+{
+	m_buckets.clear();
+	m_count = 0;
+	m_sum = 0;
+	m_min = 0xffffffff;
+	m_max = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Bucket math
+
+unsigned int LatencyHistogram::GetBucket(unsigned int value)
+{
+	if(value < m_subBucketCount)
+		return value;
+
+	//Keep the top m_subBucketBits bits of the value, and index by how far we shifted
+	unsigned int msb = 31 - __builtin_clz(value);
+	unsigned int shift = msb - (m_subBucketBits - 1);
+	return shift*m_subBucketHalf + (value >> shift);
+}
+
+unsigned int LatencyHistogram::GetBucketLow(unsigned int bucket)
+{
+	if(bucket < m_subBucketCount)
+		return bucket;
+
+	unsigned int shift = bucket/m_subBucketHalf - 1;
+	unsigned int sub = bucket - shift*m_subBucketHalf;
+	return sub << shift;
+}
+
+unsigned int LatencyHistogram::GetBucketHigh(unsigned int bucket)
+{
+	return GetBucketLow(bucket + 1) - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Data collection
+
+void LatencyHistogram::Record(unsigned int value)
+{
+	unsigned int bucket = GetBucket(value);
+	if(bucket >= m_buckets.size())
+		m_buckets.resize(bucket + 1, 0);
+	m_buckets[bucket] ++;
+
+	m_count ++;
+	m_sum += value;
+	if(m_min > value)
+		m_min = value;
+	if(m_max < value)
+		m_max = value;
+}
+
+/**
+	@brief Get the value below which the given percentage of samples fall.
+
+	Returns the upper bound of the bucket containing the percentile (clamped to the largest value seen), so the result
+	is never optimistic.
+ */
+unsigned int LatencyHistogram::GetPercentile(double pct) const
+{
+	if(m_count == 0)
+		return 0;
+
+	unsigned long target = ceil(m_count * pct / 100);
+	if(target == 0)
+		target = 1;
+
+	unsigned long total = 0;
+	for(unsigned int i=0; i<m_buckets.size(); i++)
+	{
+		total += m_buckets[i];
+		if(total >= target)
+			return min(GetBucketHigh(i), m_max);
+	}
+	return m_max;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Output
+
+void LatencyHistogram::PrintSummary(const char* name) const
+{
+	if(m_count == 0)
+		return;
+
+	LogDebug("%-25s: %5lu, latency min/avg/p50/p99/p99.9/max: %u / %.1f / %u / %u / %u / %u\n",
+		name,
+		m_count,
+		GetMin(),
+		GetMean(),
+		GetPercentile(50),
+		GetPercentile(99),
+		GetPercentile(99.9),
+		GetMax());
+}
+
+/**
+	@brief Write one CSV row of summary statistics
+ */
+void LatencyHistogram::WriteCSV(FILE* fp, const char* prefix, const char* name) const
+{
+	fprintf(fp, "%s%s,%lu,%u,%f,%u,%u,%u,%u\n",
+		prefix,
+		name,
+		m_count,
+		GetMin(),
+		GetMean(),
+		GetPercentile(50),
+		GetPercentile(99),
+		GetPercentile(99.9),
+		GetMax());
+}
+
+/**
+	@brief Write the summary statistics and nonempty buckets as a JSON object
+ */
+void LatencyHistogram::WriteJSON(FILE* fp, const char* name) const
+{
+	fprintf(fp,
+		"{\"name\": \"%s\", \"count\": %lu, \"min\": %u, \"mean\": %f, "
+		"\"p50\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u, \"buckets\": [",
+		name,
+		m_count,
+		GetMin(),
+		GetMean(),
+		GetPercentile(50),
+		GetPercentile(99),
+		GetPercentile(99.9),
+		GetMax());
+
+	bool first = true;
+	for(unsigned int i=0; i<m_buckets.size(); i++)
+	{
+		if(m_buckets[i] == 0)
+			continue;
+		fprintf(fp, "%s[%u, %u, %lu]", first ? "" : ", ", GetBucketLow(i), GetBucketHigh(i), m_buckets[i]);
+		first = false;
+	}
+
+	fprintf(fp, "]}");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpointing
+
+void LatencyHistogram::SaveState(SimSnapshot& snap) const
+{
+	snap.Write(m_buckets);
+	snap.Write(m_count);
+	snap.Write(m_sum);
+	snap.Write(m_min);
+	snap.Write(m_max);
+}
+
+void LatencyHistogram::LoadState(SimSnapshot& snap)
+{
+	snap.Read(m_buckets);
+	snap.Read(m_count);
+	snap.Read(m_sum);
+	snap.Read(m_min);
+	snap.Read(m_max);
+}
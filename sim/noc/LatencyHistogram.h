@@ -0,0 +1,98 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Log-bucketed latency histogram
+ */
+#ifndef LatencyHistogram_h
+#define LatencyHistogram_h
+
+/**
+	@brief An HDR-style latency histogram.
+
+	Values below 2^m_subBucketBits get one bucket each. Above that, each power of two is split into
+	2^(m_subBucketBits-1) linear sub-buckets, so any recorded value is off by at most ~6% from its bucket bounds no
+	matter how large it is. Storage grows on demand so small histograms (most src/dst pairs) stay small.
+ */
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void Record(unsigned int value);
+	void Clear();
+
+	unsigned long GetCount() const
+	{ return m_count; }
+
+	unsigned int GetMin() const
+	{ return m_count ? m_min : 0; }
+
+	unsigned int GetMax() const
+	{ return m_max; }
+
+	double GetMean() const
+	{ return m_count ? (double(m_sum) / m_count) : 0; }
+
+	unsigned int GetPercentile(double pct) const;
+
+	unsigned int GetBucketCount() const
+	{ return m_buckets.size(); }
+
+	unsigned long GetBucketValue(unsigned int bucket) const
+	{ return m_buckets[bucket]; }
+
+	static unsigned int GetBucketLow(unsigned int bucket);
+	static unsigned int GetBucketHigh(unsigned int bucket);
+
+	void PrintSummary(const char* name) const;
+	void WriteCSV(FILE* fp, const char* prefix, const char* name) const;
+	void WriteJSON(FILE* fp, const char* name) const;
+
+	void SaveState(SimSnapshot& snap) const;
+	void LoadState(SimSnapshot& snap);
+
+protected:
+	static unsigned int GetBucket(unsigned int value);
+
+	static const unsigned int m_subBucketBits = 5;
+	static const unsigned int m_subBucketCount = 1 << m_subBucketBits;
+	static const unsigned int m_subBucketHalf = m_subBucketCount / 2;
+
+	std::vector<unsigned long> m_buckets;
+
+	unsigned long m_count;
+	unsigned long m_sum;
+	unsigned int m_min;
+	unsigned int m_max;
+};
+
+#endif
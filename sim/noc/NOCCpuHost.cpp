@@ -40,11 +40,17 @@
 
 NOCCpuHost::NOCCpuHost(uint16_t addr, NOCRouter* parent, xypos pos)
 	: NOCHost(addr, parent, pos)
-	, m_state(STATE_WAIT_RAM)
-	, m_cyclesExecuting(0)
-	, m_cyclesWaiting(0)
+	, m_state(STATE_WAIT_IFETCH)
+	, m_mshrs(g_cpuMSHRs, NEVER)
+	, m_mshrsBusy(0)
+	, m_fetchTime(0)
+	, m_syscallTime(0)
 {
+	for(auto& c : m_cycles)
+		c = 0;
 
+	//We're clocked every cycle for stats collection, start at time zero
+	Wakeup(0);
 }
 
 NOCCpuHost::~NOCCpuHost()
@@ -60,67 +66,191 @@ NOCCpuHost::~NOCCpuHost()
 
 void NOCCpuHost::PrintStats()
 {
-	LogDebug("[CPU] Cycles spent:\n");
-	LogIndenter li;
-	LogDebug("Executing                : %5lu (%5.2f %%)\n", m_cyclesExecuting, (m_cyclesExecuting * 100.0f) / g_time);
-	LogDebug("Waiting for RAM          : %5lu (%5.2f %%)\n", m_cyclesWaiting, (m_cyclesWaiting * 100.0f) / g_time);
+	LogDebug("[CPU %04x] Cycles spent:\n", m_address);
+	{
+		LogIndenter li;
+		LogDebug("Executing                : %5lu (%5.2f %%)\n",
+			m_cycles[STATE_EXECUTING], (m_cycles[STATE_EXECUTING] * 100.0f) / g_time);
+		LogDebug("Waiting for I-fetch      : %5lu (%5.2f %%)\n",
+			m_cycles[STATE_WAIT_IFETCH], (m_cycles[STATE_WAIT_IFETCH] * 100.0f) / g_time);
+		LogDebug("Waiting for a free MSHR  : %5lu (%5.2f %%)\n",
+			m_cycles[STATE_WAIT_MSHR], (m_cycles[STATE_WAIT_MSHR] * 100.0f) / g_time);
+		LogDebug("Waiting for syscall      : %5lu (%5.2f %%)\n",
+			m_cycles[STATE_WAIT_SYSCALL], (m_cycles[STATE_WAIT_SYSCALL] * 100.0f) / g_time);
+	}
+
+	LogDebug("[CPU %04x] Round trips:\n", m_address);
+	{
+		LogIndenter li;
+		m_fetchLatency.PrintSummary("I-cache miss");
+		m_loadLatency.PrintSummary("D-cache miss");
+		m_syscallLatency.PrintSummary("Syscall");
+	}
 }
 
-bool NOCCpuHost::AcceptMessage(NOCPacket packet, SimNode* /*from*/)
+void NOCCpuHost::ProcessMessage(NOCPacket packet)
 {
 	//We got this message
-	//LogDebug("[%5u] NOCCpuHost %04x: accepting %d-word message from %04x\n",
+	//LogDebug("[%5u] NOCCpuHost %04x: processing %d-word message from %04x\n",
 	//	g_time, m_address, packet.m_size, packet.m_from);
 	packet.Processed();
+	if(packet.m_replayed || packet.m_synthetic)
+		return;
+
+	unsigned int req = packet.m_tag & ((1 << REQ_BITS) - 1);
+	unsigned int nmshr = packet.m_tag >> REQ_BITS;
 
-	//If we get a DMA data message and were waiting on RAM, then unblock
-	if( (m_state == STATE_WAIT_RAM) && (packet.m_type == NOCPacket::TYPE_DMA_RDATA) )
+	//Cache line for the I-cache: resume execution
+	if( (packet.m_type == NOCPacket::TYPE_DMA_RDATA) && (req == REQ_IFETCH) && (m_state == STATE_WAIT_IFETCH) )
 	{
 		//LogDebug("[%5u] Got cache line, unblocking CPU\n", g_time);
+		m_fetchLatency.Record(g_time - m_fetchTime);
 		m_state = STATE_EXECUTING;
 	}
 
-	return true;
+	//Cache line for the D-cache: free up the MSHR, and resume if we were waiting for one
+	else if( (packet.m_type == NOCPacket::TYPE_DMA_RDATA) && (req == REQ_LOAD) && (nmshr < m_mshrs.size()) &&
+		(m_mshrs[nmshr] != NEVER) )
+	{
+		m_loadLatency.Record(g_time - m_mshrs[nmshr]);
+		m_mshrs[nmshr] = NEVER;
+		m_mshrsBusy --;
+		if(m_state == STATE_WAIT_MSHR)
+			m_state = STATE_EXECUTING;
+	}
+
+	//Syscall returned
+	else if( (packet.m_type == NOCPacket::TYPE_RPC_RETURN) && (req == REQ_SYSCALL) &&
+		(m_state == STATE_WAIT_SYSCALL) )
+	{
+		m_syscallLatency.Record(g_time - m_syscallTime);
+		m_state = STATE_EXECUTING;
+	}
 }
 
-void NOCCpuHost::Timestep()
+/**
+	@brief Returns true with the given probability
+ */
+bool NOCCpuHost::Chance(double probability)
 {
-	//Stat collection
-	switch(m_state)
-	{
-		case STATE_WAIT_RAM:
-			m_cyclesWaiting ++;
-			break;
+	if(probability <= 0)
+		return false;
+	return (m_rng() % 1000000) < probability * 1000000;
+}
+
+/**
+	@brief Request a line for the I-cache
+ */
+void NOCCpuHost::SendFetch()
+{
+	NOCPacket message(m_address, g_ramAddr, 3, NOCPacket::TYPE_DMA_READ, 3 + m_lineSize);
+	message.m_tag = REQ_IFETCH;
+	SendPacket(message);
+	m_fetchTime = g_time;
+	m_state = STATE_WAIT_IFETCH;
+}
+
+/**
+	@brief Request a line for the D-cache, and stall if that was our last free MSHR
+ */
+void NOCCpuHost::SendLoad()
+{
+	unsigned int nmshr = 0;
+	while(m_mshrs[nmshr] != NEVER)
+		nmshr ++;
+
+	NOCPacket message(m_address, g_ramAddr, 3, NOCPacket::TYPE_DMA_READ, 3 + m_lineSize);
+	message.m_tag = (nmshr << REQ_BITS) | REQ_LOAD;
+	SendPacket(message);
+	m_mshrs[nmshr] = g_time;
+	m_mshrsBusy ++;
 
-		case STATE_EXECUTING:
-			m_cyclesExecuting ++;
+	if(m_mshrsBusy == m_mshrs.size())
+		m_state = STATE_WAIT_MSHR;
+}
+
+/**
+	@brief Make an RPC call to another host (anything but a NIC or CPU, since they don't answer calls)
+ */
+void NOCCpuHost::SendSyscall()
+{
+	uint16_t target = g_ramAddr;
+	for(int i=0; i<16; i++)
+	{
+		uint16_t addr = m_rng() % g_hostCount;
+		if( (addr != m_address) && (addr != g_nicAddr) && !IsCPUAddress(addr) )
+		{
+			target = addr;
 			break;
+		}
 	}
 
-	//At time 0: generate a DMA read request for our first cache line
+	NOCPacket message(m_address, target, 4, NOCPacket::TYPE_RPC_CALL, 4);
+	message.m_tag = REQ_SYSCALL;
+	SendPacket(message);
+	m_syscallTime = g_time;
+	m_state = STATE_WAIT_SYSCALL;
+}
+
+void NOCCpuHost::Timestep()
+{
+	ServiceLink();
+
+	//Stat collection
+	m_cycles[m_state] ++;
+
+	//At time 0: fetch our first cache line
 	if(g_time == 0)
 	{
 		//LogDebug("[%5u] Sending initial RAM read request\n", g_time);
-
-		NOCPacket message(m_address, RAM_ADDR, 3, NOCPacket::TYPE_DMA_READ, 3+32);
-		if(!m_parent->AcceptMessage(message, this))
-			LogWarning("Couldn't send initial message\n");
+		SendFetch();
 	}
 
 	//If executing, do stuff
-	if(m_state == STATE_EXECUTING)
+	else if(m_state == STATE_EXECUTING)
 	{
-		//For now: 1% L1 cache miss rate
-		if(0 == (rand() % 100) )
-		{
-			//LogDebug("[%5u] Cache miss, requesting new data\n", g_time);
-			NOCPacket message(m_address, RAM_ADDR, 3, NOCPacket::TYPE_DMA_READ, 3+32);
-			if(!m_parent->AcceptMessage(message, this))
-				LogWarning("Couldn't send RAM read message\n");
+		if(Chance(g_cpuIMissRate))
+			SendFetch();
+		else if(Chance(g_cpuDMissRate))
+			SendLoad();
+		else if(Chance(g_cpuSyscallRate))
+			SendSyscall();
+	}
 
-			m_state = STATE_WAIT_RAM;
-		}
+	Wakeup(g_time + 1);
+}
 
-		//TODO: talk to peripherals
-	}
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpointing
+
+void NOCCpuHost::SaveState(SimSnapshot& snap)
+{
+	NOCHost::SaveState(snap);
+	snap.Write(m_state);
+	snap.Write(m_cycles);
+	snap.Write(m_mshrs);
+	snap.Write(m_mshrsBusy);
+	snap.Write(m_fetchTime);
+	snap.Write(m_syscallTime);
+	m_fetchLatency.SaveState(snap);
+	m_loadLatency.SaveState(snap);
+	m_syscallLatency.SaveState(snap);
+}
+
+void NOCCpuHost::LoadState(SimSnapshot& snap)
+{
+	NOCHost::LoadState(snap);
+	snap.Read(m_state);
+	snap.Read(m_cycles);
+	snap.Read(m_mshrs);
+	snap.Read(m_mshrsBusy);
+	snap.Read(m_fetchTime);
+	snap.Read(m_syscallTime);
+	m_fetchLatency.LoadState(snap);
+	m_loadLatency.LoadState(snap);
+	m_syscallLatency.LoadState(snap);
+
+	//Snapshot with a different number of MSHRs?
+	if(m_mshrs.size() != g_cpuMSHRs)
+		snap.Fail();
 }
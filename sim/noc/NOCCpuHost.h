@@ -35,26 +35,77 @@
 #ifndef NOCCpuHost_h
 #define NOCCpuHost_h
 
+/**
+	@brief A CPU core with L1 caches, running a synthetic workload.
+
+	Each cycle the core fetches an instruction, which misses the I-cache with probability g_cpuIMissRate. An I-cache
+	miss stalls the pipeline until the line comes back from RAM. Otherwise the instruction executes, and may be a
+	load that misses the D-cache (g_cpuDMissRate) or a syscall (g_cpuSyscallRate).
+
+	D-cache misses don't block until g_cpuMSHRs of them are outstanding. Syscalls are RPC calls to another host,
+	and block until the return comes back.
+
+	Cache lines are m_lineSize words.
+ */
 class NOCCpuHost : public NOCHost
 {
 public:
 	NOCCpuHost(uint16_t addr, NOCRouter* parent, xypos pos);
 	virtual ~NOCCpuHost();
 
-	virtual bool AcceptMessage(NOCPacket packet, SimNode* from);
 	virtual void Timestep();
 
 	enum States
 	{
-		STATE_WAIT_RAM,
 		STATE_EXECUTING,
+		STATE_WAIT_IFETCH,
+		STATE_WAIT_MSHR,
+		STATE_WAIT_SYSCALL,
+
+		STATE_COUNT		//must be last
 	} m_state;
 
 	virtual void PrintStats();
 
+	virtual void SaveState(SimSnapshot& snap);
+	virtual void LoadState(SimSnapshot& snap);
+
+	//Size of a cache line, in words
+	static const unsigned int m_lineSize = 32;
+
 protected:
-	unsigned long m_cyclesExecuting;
-	unsigned long m_cyclesWaiting;
+	virtual void ProcessMessage(NOCPacket packet);
+
+	bool Chance(double probability);
+	void SendFetch();
+	void SendLoad();
+	void SendSyscall();
+
+	//What a request is for (low bits of the tag, the MSHR number is above)
+	enum Requests
+	{
+		REQ_IFETCH,
+		REQ_LOAD,
+		REQ_SYSCALL,
+
+		REQ_BITS = 2
+	};
+
+	//Cycles spent in each state
+	unsigned long m_cycles[STATE_COUNT];
+
+	//Time each D-cache miss was sent (NEVER if the MSHR is free)
+	std::vector<unsigned int> m_mshrs;
+	unsigned int m_mshrsBusy;
+
+	//Time the outstanding I-cache miss or syscall was sent
+	unsigned int m_fetchTime;
+	unsigned int m_syscallTime;
+
+	//Round trip times
+	LatencyHistogram m_fetchLatency;
+	LatencyHistogram m_loadLatency;
+	LatencyHistogram m_syscallLatency;
 };
 
 #endif
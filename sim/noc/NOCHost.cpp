@@ -35,21 +35,49 @@
 
 #include "nocsim.h"
 
+using namespace std;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
 
 NOCHost::NOCHost(uint16_t addr, NOCRouter* parent, xypos pos)
 	: SimNode(pos)
 	, m_address(addr)
-	, m_parent(parent)
+	, m_rng(addr + (g_seed << 16))
+	, m_nextInjection(0)
+	, m_packetsSent(0)
 {
-	m_parent->AddChild(this);
+	m_links.push_back(HostLink(parent));
+	parent->AddChild(this);
+
+	if(g_trafficGenerator)
+	{
+		m_nextInjection = g_trafficGenerator->GetInterarrivalTime(m_rng) - 1;
+		Wakeup(m_nextInjection);
+	}
 }
 
 NOCHost::~NOCHost()
 {
 }
 
+NOCHost::HostLink::HostLink(NOCRouter* router)
+	: m_router(router)
+	, m_linkFreeTime(0)
+	, m_credits(g_fifoDepth)
+	, m_creditsOutstanding(0)
+{
+}
+
+/**
+	@brief Connect our second port to a router on the DMA network (in dual-network mode)
+ */
+void NOCHost::ConnectDMANetwork(NOCRouter* router)
+{
+	m_links.push_back(HostLink(router));
+	router->AddChild(this);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Rendering
 
@@ -87,63 +115,239 @@ void NOCHost::RenderSVGLines(FILE* /*fp*/)
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Simulation
 
-bool NOCHost::AcceptMessage(NOCPacket packet, SimNode* /*from*/)
+/**
+	@brief Find which of our links goes to a node (m_links.size() if none do)
+ */
+unsigned int NOCHost::GetLinkNumber(SimNode* node)
+{
+	for(unsigned int i=0; i<m_links.size(); i++)
+	{
+		if(m_links[i].m_router == node)
+			return i;
+	}
+	return m_links.size();
+}
+
+/**
+	@brief Called when the head of a packet arrives. We don't act on it until the tail is in.
+
+	Anything that didn't come from one of our routers is a packet from the trace player, for us to send.
+ */
+bool NOCHost::AcceptMessage(NOCPacket packet, SimNode* from)
+{
+	unsigned int nlink = GetLinkNumber(from);
+	if(nlink == m_links.size())
+	{
+		SendPacket(packet);
+		return true;
+	}
+
+	//We always sink packets at line rate, so there's never any reason to hold on to the credits
+	unsigned int flits = packet.GetFlitCount();
+	unsigned int tail = g_time + flits - 1;
+	ReturnCredits(from, flits, tail, packet.m_vc);
+
+	if(tail <= g_time)
+		ProcessMessage(packet);
+	else
+	{
+		m_links[nlink].m_rxQueue.push_back(pair<unsigned int, NOCPacket>(tail, packet));
+		Wakeup(tail);
+	}
+	return true;
+}
+
+void NOCHost::AcceptCredits(SimNode* from, unsigned int credits, unsigned int tailTime, unsigned int /*vc*/)
+{
+	//We only ever send on VC 0, so there's no need to track credits per VC
+	HostLink& link = m_links[GetLinkNumber(from)];
+	link.m_credits += credits;
+	link.m_creditsOutstanding --;
+
+	//If our transfer was stalled, this is the credit return for it, and it's done
+	if( (link.m_linkFreeTime == NEVER) && (link.m_creditsOutstanding == 0) )
+		link.m_linkFreeTime = tailTime + 1;
+
+	if(!link.m_txQueue.empty())
+		Wakeup(link.m_linkFreeTime);
+}
+
+/**
+	@brief Send a packet to our router on the packet's network, or queue it if the link is busy or the router has no
+	room
+ */
+void NOCHost::SendPacket(NOCPacket packet)
+{
+	if(!NOCRouter::IsSendable(packet.GetFlitCount()))
+	{
+		LogError("[%5u] Host %04x: can't send %u-flit message to %04x, it will never fit in a router FIFO\n",
+			g_time, m_address, packet.GetFlitCount(), packet.m_to);
+		return;
+	}
+
+	packet.m_seq = m_packetsSent ++;
+
+	HostLink& link = m_links[packet.GetNetwork()];
+	if(!link.m_txQueue.empty() || !TrySend(link, packet))
+	{
+		link.m_txQueue.push_back(packet);
+
+		//We might not be in ServiceLink(), so make sure it runs once the link is free.
+		//If we're waiting on credits, AcceptCredits() will wake us
+		if(link.m_linkFreeTime != NEVER)
+			Wakeup(link.m_linkFreeTime);
+	}
+}
+
+/**
+	@brief Send a packet if the link is free and we have enough credits
+ */
+bool NOCHost::TrySend(HostLink& link, const NOCPacket& packet)
+{
+	if(g_time < link.m_linkFreeTime)
+		return false;
+
+	unsigned int flits = packet.GetFlitCount();
+	if(link.m_credits < (int)NOCRouter::GetCreditsNeeded(flits))
+		return false;
+
+	SendMessage(link.m_router, packet);
+	link.m_credits -= flits;
+	link.m_creditsOutstanding ++;
+
+	//Link is busy for one clock per flit, same as router outboxes. If the router didn't have room for the whole
+	//packet (wormhole only) we're stuck until it gives the credits back
+	if(link.m_credits >= 0)
+		link.m_linkFreeTime = g_time + flits;
+	else
+		link.m_linkFreeTime = NEVER;
+	return true;
+}
+
+/**
+	@brief Handle packets that finished arriving, and send the next queued packets if we can.
+
+	Must be called at the start of every Timestep().
+ */
+void NOCHost::ServiceLink()
 {
-	//LogDebug("[%5u] NOCHost %04x: accepting %d-word message from %04x\n",
+	//Handle everything that arrived first, since it might give us more to send
+	for(auto& link : m_links)
+	{
+		while(!link.m_rxQueue.empty() && (link.m_rxQueue.front().first <= g_time) )
+		{
+			auto packet = link.m_rxQueue.front().second;
+			link.m_rxQueue.pop_front();
+			ProcessMessage(packet);
+		}
+	}
+
+	for(auto& link : m_links)
+	{
+		if(!link.m_txQueue.empty() && TrySend(link, link.m_txQueue.front()))
+			link.m_txQueue.pop_front();
+
+		//If we're waiting on credits, AcceptCredits() will wake us
+		if(!link.m_txQueue.empty() && (link.m_linkFreeTime > g_time) && (link.m_linkFreeTime != NEVER) )
+			Wakeup(link.m_linkFreeTime);
+	}
+}
+
+void NOCHost::ProcessMessage(NOCPacket packet)
+{
+	//LogDebug("[%5u] NOCHost %04x: processing %d-word message from %04x\n",
 	//	g_time, m_address, packet.m_size, packet.m_from);
 	packet.Processed();
+	if(packet.m_replayed)
+		return;
+
+	SendReply(packet);
+}
 
+/**
+	@brief Send the reply to a request, if it needs one
+ */
+void NOCHost::SendReply(const NOCPacket& packet)
+{
+	NOCPacket reply;
 	switch(packet.m_type)
 	{
 		//Respond with a 4-word return
 		case NOCPacket::TYPE_RPC_CALL:
-			{
-				NOCPacket message(m_address, packet.m_from, 4, NOCPacket::TYPE_RPC_RETURN);
-				if(!m_parent->AcceptMessage(message, this))
-					LogWarning("Couldn't send reply to function call\n");
-			}
-			break;
-
-		//No action required
-		case NOCPacket::TYPE_RPC_RETURN:
-			break;
-
-		//No action required
-		case NOCPacket::TYPE_RPC_INTERRUPT:
+			reply = NOCPacket(m_address, packet.m_from, 4, NOCPacket::TYPE_RPC_RETURN);
 			break;
 
 		//Respond with a DMA read data
 		case NOCPacket::TYPE_DMA_READ:
-			{
-				NOCPacket message(m_address, packet.m_from, packet.m_replysize, NOCPacket::TYPE_DMA_RDATA);
-				if(!m_parent->AcceptMessage(message, this))
-					LogWarning("Couldn't send reply to DMA read\n");
-			}
-			break;
-
-		//No action required
-		case NOCPacket::TYPE_DMA_RDATA:
+			reply = NOCPacket(m_address, packet.m_from, packet.m_replysize, NOCPacket::TYPE_DMA_RDATA);
 			break;
 
 		//Respond with a DMA ack (headers only, no payload)
 		case NOCPacket::TYPE_DMA_WRITE:
-			{
-				NOCPacket message(m_address, packet.m_from, 3, NOCPacket::TYPE_DMA_ACK);
-				if(!m_parent->AcceptMessage(message, this))
-					LogWarning("Couldn't send reply to DMA write\n");
-			}
+			reply = NOCPacket(m_address, packet.m_from, 3, NOCPacket::TYPE_DMA_ACK);
 			break;
 
-		//No action required
-		case NOCPacket::TYPE_DMA_ACK:
-			break;
+		//No action required for anything else (returns, interrupts, read data and acks), silently discard
+		default:
+			return;
 	}
 
-	//silently discard
-	return true;
+	reply.m_tag = packet.m_tag;
+	SendPacket(reply);
 }
 
 void NOCHost::Timestep()
 {
-	//Nothing to do, we don't originate messages
+	ServiceLink();
+
+	//Only synthetic traffic originates from plain hosts
+	if(!g_trafficGenerator)
+		return;
+
+	//Generate new traffic
+	if(g_time >= m_nextInjection)
+	{
+		NOCPacket packet;
+		if(g_trafficGenerator->Generate(m_address, m_rng, packet))
+			SendPacket(packet);
+		m_nextInjection = g_time + g_trafficGenerator->GetInterarrivalTime(m_rng);
+	}
+
+	//Sleep until the next packet shows up
+	Wakeup(m_nextInjection);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpointing
+
+void NOCHost::SaveState(SimSnapshot& snap)
+{
+	SimNode::SaveState(snap);
+	snap.Write(m_rng);
+	snap.Write(m_nextInjection);
+	snap.Write(m_packetsSent);
+	for(auto& link : m_links)
+	{
+		snap.Write(link.m_txQueue);
+		snap.Write(link.m_rxQueue);
+		snap.Write(link.m_linkFreeTime);
+		snap.Write(link.m_credits);
+		snap.Write(link.m_creditsOutstanding);
+	}
+}
+
+void NOCHost::LoadState(SimSnapshot& snap)
+{
+	SimNode::LoadState(snap);
+	snap.Read(m_rng);
+	snap.Read(m_nextInjection);
+	snap.Read(m_packetsSent);
+	for(auto& link : m_links)
+	{
+		snap.Read(link.m_txQueue);
+		snap.Read(link.m_rxQueue);
+		snap.Read(link.m_linkFreeTime);
+		snap.Read(link.m_credits);
+		snap.Read(link.m_creditsOutstanding);
+	}
 }
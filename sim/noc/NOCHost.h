@@ -44,18 +44,74 @@ public:
 	virtual ~NOCHost();
 
 	virtual bool AcceptMessage(NOCPacket packet, SimNode* from);
+	virtual void AcceptCredits(SimNode* from, unsigned int credits, unsigned int tailTime, unsigned int vc);
 	virtual void Timestep();
 
 	uint16_t GetAddress()
 	{ return m_address; }
 
+	void ConnectDMANetwork(NOCRouter* router);
+
 	virtual void ExpandBoundingBox(unsigned int& width, unsigned int& height);
 	virtual void RenderSVGNodes(FILE* fp);
 	virtual void RenderSVGLines(FILE* fp);
 
+	virtual void SaveState(SimSnapshot& snap);
+	virtual void LoadState(SimSnapshot& snap);
+
 protected:
+
+	//Handle a message once the tail has arrived
+	virtual void ProcessMessage(NOCPacket packet);
+	void SendReply(const NOCPacket& packet);
+
+	void SendPacket(NOCPacket packet);
+	void ServiceLink();
+
 	uint16_t m_address;
-	NOCRouter* m_parent;
+
+	//Per-host random number generator, seeded from g_seed and our address
+	//(a shared rand() would make results depend on thread scheduling)
+	std::minstd_rand m_rng;
+
+	//Time at which the traffic generator gives us our next packet
+	unsigned int m_nextInjection;
+
+	//Number of packets we've sent (used to stamp NOCPacket::m_seq)
+	unsigned int m_packetsSent;
+
+	/**
+		@brief Our port on one of the networks (just the RPC network, unless we're simulating separate RPC and DMA
+		networks)
+	 */
+	class HostLink
+	{
+	public:
+		HostLink(NOCRouter* router);
+
+		NOCRouter* m_router;
+
+		//Packets waiting for the link to free up
+		std::deque<NOCPacket> m_txQueue;
+
+		//Packets whose head has arrived, and the time the tail arrives
+		std::deque< std::pair<unsigned int, NOCPacket> > m_rxQueue;
+
+		//Time at which the link is free for another packet (NEVER if the transfer is stalled)
+		unsigned int m_linkFreeTime;
+
+		//Flow control credits for the router's input FIFO
+		int m_credits;
+
+		//Number of packets sent that we haven't had credits back for
+		unsigned int m_creditsOutstanding;
+	};
+
+	//Indexed by NOCPacket::GetNetwork()
+	std::vector<HostLink> m_links;
+
+	unsigned int GetLinkNumber(SimNode* node);
+	bool TrySend(HostLink& link, const NOCPacket& packet);
 };
 
 #endif
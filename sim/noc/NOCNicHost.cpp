@@ -35,28 +35,35 @@
 
 #include "nocsim.h"
 
+using namespace std;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
 
 NOCNicHost::NOCNicHost(uint16_t addr, NOCRouter* parent, xypos pos)
 	: NOCHost(addr, parent, pos)
-	, m_rxstate(RX_STATE_IDLE)
+	, m_ring(g_nicRingSize)
 	, m_frameBuffers(0)
-	, m_cyclesIdle(0)
-	, m_cyclesWaitingForMalloc(0)
-	, m_cyclesWaitingForWrite(0)
-	, m_cyclesWaitingForChown(0)
-	, m_cyclesWaitingForSend(0)
+	, m_mallocsOutstanding(0)
 	, m_framesProcessed(0)
 	, m_framesDropped(0)
 	, m_framesTotal(0)
-	, m_pendingFrame(false)
-	, m_pendingFrameSize(0)
+	, m_peakInFlight(0)
 	, m_nextFrame(200)
 	, m_nextFrameSize(65)
-	, m_returnToIdle(0)
 {
+	for(auto& slot : m_ring)
+	{
+		slot.m_state = RX_STATE_IDLE;
+		slot.m_frameSize = 0;
+		slot.m_arrival = 0;
+		slot.m_returnToIdle = 0;
+	}
+	for(auto& c : m_cycles)
+		c = 0;
 
+	//We're clocked every cycle for stats collection, start at time zero
+	Wakeup(0);
 }
 
 NOCNicHost::~NOCNicHost()
@@ -70,21 +77,40 @@ NOCNicHost::~NOCNicHost()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Simulation
 
+/**
+	@brief Size of the DMA write that stores a frame to RAM, in words (header plus the frame rounded up to whole words)
+ */
+unsigned int NOCNicHost::GetWriteSize(unsigned int frameSize)
+{
+	return 3 + (frameSize + 3)/4;
+}
+
+/**
+	@brief Size of the largest DMA write we ever send, in words
+ */
+unsigned int NOCNicHost::GetMaxWriteSize()
+{
+	return GetWriteSize(m_maxFrameSize);
+}
+
 void NOCNicHost::PrintStats()
 {
-	LogDebug("[NIC] Cycles spent:\n");
+	//Percentages are of the total time for all slots
+	double total = double(g_time) * m_ring.size();
+
+	LogDebug("[NIC] Cycles spent (%zu-slot RX ring):\n", m_ring.size());
 	{
 		LogIndenter li;
 		LogDebug("Idle                     : %5lu (%5.2f %%)\n",
-			m_cyclesIdle, (m_cyclesIdle * 100.0f) / g_time);
+			m_cycles[RX_STATE_IDLE], (m_cycles[RX_STATE_IDLE] * 100.0f) / total);
 		LogDebug("Waiting for RPC malloc   : %5lu (%5.2f %%)\n",
-			m_cyclesWaitingForMalloc, (m_cyclesWaitingForMalloc * 100.0f) / g_time);
+			m_cycles[RX_STATE_WAIT_ALLOC], (m_cycles[RX_STATE_WAIT_ALLOC] * 100.0f) / total);
 		LogDebug("Waiting for DMA write    : %5lu (%5.2f %%)\n",
-			m_cyclesWaitingForWrite, (m_cyclesWaitingForWrite * 100.0f) / g_time);
+			m_cycles[RX_STATE_WAIT_WRITE], (m_cycles[RX_STATE_WAIT_WRITE] * 100.0f) / total);
 		LogDebug("Waiting for RPC chown    : %5lu (%5.2f %%)\n",
-			m_cyclesWaitingForChown, (m_cyclesWaitingForChown * 100.0f) / g_time);
+			m_cycles[RX_STATE_WAIT_CHOWN], (m_cycles[RX_STATE_WAIT_CHOWN] * 100.0f) / total);
 		LogDebug("Waiting for RPC IRQ send : %5lu (%5.2f %%)\n",
-			m_cyclesWaitingForSend, (m_cyclesWaitingForSend * 100.0f) / g_time);
+			m_cycles[RX_STATE_WAIT_SEND], (m_cycles[RX_STATE_WAIT_SEND] * 100.0f) / total);
 	}
 
 	LogDebug("[NIC] Frames:\n");
@@ -94,167 +120,203 @@ void NOCNicHost::PrintStats()
 			m_framesProcessed, (m_framesProcessed * 100.0f) / m_framesTotal);
 		LogDebug("Dropped                  : %5lu (%5.2f %%)\n",
 			m_framesDropped, (m_framesDropped * 100.0f) / m_framesTotal);
+		LogDebug("Peak in flight           : %5u (of %zu slots, %u buffers)\n",
+			m_peakInFlight, m_ring.size(), g_nicBuffers);
+		m_frameLatency.PrintSummary("Arrival to IRQ");
 	}
 }
 
-bool NOCNicHost::AcceptMessage(NOCPacket packet, SimNode* /*from*/)
+void NOCNicHost::ProcessMessage(NOCPacket packet)
 {
 	//We got this message
-	//LogDebug("[%5u] NOCNicHost %04x: accepting %d-word message from %04x\n",
+	//LogDebug("[%5u] NOCNicHost %04x: processing %d-word message from %04x\n",
 	//	g_time, m_address, packet.m_size, packet.m_from);
 	packet.Processed();
 
-	//State transitions based on incoming messages
-	switch(m_rxstate)
+	//Everything we care about is a reply from RAM to one of our requests
+	unsigned int req = packet.m_tag & ((1 << REQ_BITS) - 1);
+	unsigned int nslot = packet.m_tag >> REQ_BITS;
+	if( (packet.m_from != g_ramAddr) || (nslot >= m_ring.size()) )
+		return;
+	RxSlot& slot = m_ring[nslot];
+
+	//New frame buffer? Give it to the next frame in line
+	if( (packet.m_type == NOCPacket::TYPE_RPC_RETURN) && (req == REQ_MALLOC) && (m_mallocsOutstanding > 0) )
+	{
+		m_mallocsOutstanding --;
+		m_frameBuffers ++;
+		StartWrites();
+	}
+
+	//Write is complete, chown the buffer to the CPU
+	else if( (packet.m_type == NOCPacket::TYPE_DMA_ACK) && (req == REQ_WRITE) &&
+		(slot.m_state == RX_STATE_WAIT_WRITE) )
+	{
+		//LogDebug("[%5u] NOCNicHost: Write complete, chowning to CPU\n", g_time);
+		NOCPacket message(m_address, g_ramAddr, 4, NOCPacket::TYPE_RPC_CALL, 4);
+		message.m_tag = (nslot << REQ_BITS) | REQ_CHOWN;
+		SendPacket(message);
+		slot.m_state = RX_STATE_WAIT_CHOWN;
+	}
+
+	//Chown is complete, interrupt the CPU
+	else if( (packet.m_type == NOCPacket::TYPE_RPC_RETURN) && (req == REQ_CHOWN) &&
+		(slot.m_state == RX_STATE_WAIT_CHOWN) )
 	{
-		case RX_STATE_IDLE:
-			break;
-
-		case RX_STATE_WAIT_ALLOC:
-
-			//If we get a message from RAM, we have a new frame buffer
-			if( (packet.m_type == NOCPacket::TYPE_RPC_RETURN) && (packet.m_from == RAM_ADDR) )
-			{
-				m_frameBuffers ++;
-				m_rxstate = RX_STATE_IDLE;
-			}
-
-			break;
-
-		case RX_STATE_WAIT_WRITE:
-
-			//If we get a message from RAM, the write is complete.
-			//Chown it to the CPU.
-			if( (packet.m_type == NOCPacket::TYPE_DMA_ACK) && (packet.m_from == RAM_ADDR) )
-			{
-				//LogDebug("[%5u] NOCNicHost: Write complete, chowning to CPU\n", g_time);
-				NOCPacket message(m_address, RAM_ADDR, 4, NOCPacket::TYPE_RPC_CALL, 4);
-				if(!m_parent->AcceptMessage(message, this))
-					LogWarning("Couldn't send chown message\n");
-				m_rxstate = RX_STATE_WAIT_CHOWN;
-			}
-			else
-			{
-				LogWarning("[%5u] NOCNicHost: Don't know what to do with message of type %d from %d\n",
-					g_time, packet.m_type, packet.m_from);
-			}
-
-			break;
-
-		case RX_STATE_WAIT_CHOWN:
-
-			//If we get a message from RAM, the chown is complete.
-			//Send the packet to the CPU
-			//LogDebug("[%5u] NOCNicHost: chown complete, sending to CPU\n", g_time);
-			if( (packet.m_type == NOCPacket::TYPE_RPC_RETURN) && (packet.m_from == RAM_ADDR) )
-			{
-				NOCPacket message(m_address, RAM_ADDR, 4, NOCPacket::TYPE_RPC_CALL, 4);
-				if(!m_parent->AcceptMessage(message, this))
-					LogWarning("Couldn't send chown message\n");
-				m_rxstate = RX_STATE_WAIT_SEND;
-				m_returnToIdle = g_time + 4;
-				m_frameBuffers --;	//we just used a frame buffer
-			}
-
-			break;
-
-		case RX_STATE_WAIT_SEND:
-			break;
+		//LogDebug("[%5u] NOCNicHost: chown complete, sending to CPU\n", g_time);
+		NOCPacket message(m_address, g_cpuAddr, 4, NOCPacket::TYPE_RPC_INTERRUPT);
+		SendPacket(message);
+		slot.m_state = RX_STATE_WAIT_SEND;
+		slot.m_returnToIdle = g_time + 4;
 	}
 
-	return true;
+	else
+	{
+		LogWarning("[%5u] NOCNicHost: Don't know what to do with message of type %d from %d\n",
+			g_time, packet.m_type, packet.m_from);
+	}
 }
 
-void NOCNicHost::Timestep()
+/**
+	@brief Request frame buffers until we have (or are getting) as many as we're supposed to keep on hand
+ */
+void NOCNicHost::AllocateBuffers()
 {
-	//At time 0: generate an RPC request to allocate a page of RAM
-	if(g_time == 0)
+	while(m_frameBuffers + m_mallocsOutstanding < g_nicBuffers)
 	{
-		//LogDebug("[%5u] Sending initial malloc request\n", g_time);
+		//LogDebug("[%5u] NOCNicHost: Sending malloc request\n", g_time);
+		NOCPacket message(m_address, g_ramAddr, 4, NOCPacket::TYPE_RPC_CALL, 4);
+		message.m_tag = REQ_MALLOC;
+		SendPacket(message);
+		m_mallocsOutstanding ++;
+	}
+}
 
-		NOCPacket message(m_address, RAM_ADDR, 4, NOCPacket::TYPE_RPC_CALL, 4);
-		if(!m_parent->AcceptMessage(message, this))
-			LogWarning("Couldn't send initial message\n");
-		m_rxstate = RX_STATE_WAIT_ALLOC;
+/**
+	@brief Write frames that were waiting for a buffer to RAM, as long as we have buffers
+ */
+void NOCNicHost::StartWrites()
+{
+	while(!m_waitingForBuffer.empty() && (m_frameBuffers > 0) )
+	{
+		unsigned int nslot = m_waitingForBuffer.front();
+		m_waitingForBuffer.pop_front();
+		RxSlot& slot = m_ring[nslot];
+
+		//Send the write request to RAM (frame size is in bytes, DMA payload is in 32-bit words)
+		//LogDebug("[%5u] NOCNicHost: Writing packet to RAM\n", g_time);
+		NOCPacket message(m_address, g_ramAddr, GetWriteSize(slot.m_frameSize), NOCPacket::TYPE_DMA_WRITE, 3);
+		message.m_tag = (nslot << REQ_BITS) | REQ_WRITE;
+		SendPacket(message);
+		slot.m_state = RX_STATE_WAIT_WRITE;
+		m_frameBuffers --;
 	}
 
-	//If a new frame just arrived, deal with it.
+	AllocateBuffers();
+}
+
+void NOCNicHost::Timestep()
+{
+	ServiceLink();
+
+	//At time 0: fill up the buffer pool
+	if(g_time == 0)
+		AllocateBuffers();
+
+	//If a new frame just arrived, put it in a free ring slot
 	if(g_time == m_nextFrame)
 	{
 		m_framesTotal ++;
 
-		//If we already had a pending frame, this one gets dropped b/c we don't have a buffer to write it to :(
-		if(m_pendingFrame)
+		unsigned int nslot = 0;
+		while( (nslot < m_ring.size()) && (m_ring[nslot].m_state != RX_STATE_IDLE) )
+			nslot ++;
+
+		//If the ring is full, this one gets dropped b/c we have nowhere to put it :(
+		if(nslot == m_ring.size())
 		{
 			m_framesDropped ++;
-			LogWarning("[%5u] NOCNicHost: Dropping packet (no rx buffer)\n", g_time);
+			LogWarning("[%5u] NOCNicHost: Dropping packet (rx ring full)\n", g_time);
 		}
 
 		//Good to go, process this one
 		else
 		{
 			m_framesProcessed ++;
-			m_pendingFrame = true;
-			m_pendingFrameSize = m_nextFrameSize;
+			RxSlot& slot = m_ring[nslot];
+			slot.m_state = RX_STATE_WAIT_ALLOC;
+			slot.m_frameSize = m_nextFrameSize;
+			slot.m_arrival = g_time;
+			m_waitingForBuffer.push_back(nslot);
+			StartWrites();
 			//LogDebug("[%5u] NOCNicHost: Got a packet\n", g_time);
 		}
 
 		//Next frame is a random size between 64 and 1500 bytes
-		m_nextFrameSize = 64 + (rand() % 1436);
+		m_nextFrameSize = m_minFrameSize + (m_rng() % (m_maxFrameSize - m_minFrameSize + 1));
 
 		//We're simulating a 125 MHz system clock so 8 bits data per clock will arrive on the network.
 		//Add a random inter-frame gap between 8 and 128 bytes
-		m_nextFrame = g_time + m_nextFrameSize + 8 + (rand() % 120);
+		m_nextFrame = g_time + m_nextFrameSize + 8 + (m_rng() % 120);
 	}
 
-	//Main state machine
-	switch(m_rxstate)
+	//Update each slot's state
+	unsigned int inflight = 0;
+	for(auto& slot : m_ring)
 	{
-		case RX_STATE_IDLE:
-			m_cyclesIdle ++;
-
-			//If we have no frame buffers, request allocation of a new buffer
-			if(m_frameBuffers == 0)
-			{
-				//LogDebug("[%5u] NOCNicHost: No frame buffers, sending malloc request\n", g_time);
-				NOCPacket message(m_address, RAM_ADDR, 4, NOCPacket::TYPE_RPC_CALL, 4);
-				if(!m_parent->AcceptMessage(message, this))
-					LogWarning("Couldn't send initial message\n");
-				m_rxstate = RX_STATE_WAIT_ALLOC;
-			}
-
-			//If we have a pending frame, process it
-			else if(m_pendingFrame)
-			{
-				//Send the write request to RAM
-				//LogDebug("[%5u] NOCNicHost: Writing packet to RAM\n", g_time);
-				NOCPacket message(m_address, RAM_ADDR, 3 + m_pendingFrameSize, NOCPacket::TYPE_DMA_WRITE, 3);
-				if(!m_parent->AcceptMessage(message, this))
-					LogWarning("Couldn't send write-to-RAM message\n");
-				m_rxstate = RX_STATE_WAIT_WRITE;
-			}
-
-			break;
-
-		case RX_STATE_WAIT_ALLOC:
-			m_cyclesWaitingForMalloc ++;
-			break;
-
-		case RX_STATE_WAIT_WRITE:
-			m_cyclesWaitingForWrite ++;
-			break;
-
-		case RX_STATE_WAIT_CHOWN:
-			m_cyclesWaitingForChown ++;
-			break;
-
-		case RX_STATE_WAIT_SEND:
-			if(g_time >= m_returnToIdle)
-			{
-				m_pendingFrame = false;
-				m_rxstate = RX_STATE_IDLE;
-			}
-			m_cyclesWaitingForSend ++;
-			break;
+		m_cycles[slot.m_state] ++;
+
+		if( (slot.m_state == RX_STATE_WAIT_SEND) && (g_time >= slot.m_returnToIdle) )
+		{
+			m_frameLatency.Record(g_time - slot.m_arrival);
+			slot.m_state = RX_STATE_IDLE;
+		}
+
+		if(slot.m_state != RX_STATE_IDLE)
+			inflight ++;
 	}
+	m_peakInFlight = max(m_peakInFlight, inflight);
+
+	Wakeup(g_time + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpointing
+
+void NOCNicHost::SaveState(SimSnapshot& snap)
+{
+	NOCHost::SaveState(snap);
+	snap.Write(m_ring);
+	snap.Write(m_waitingForBuffer);
+	snap.Write(m_frameBuffers);
+	snap.Write(m_mallocsOutstanding);
+	snap.Write(m_cycles);
+	snap.Write(m_framesProcessed);
+	snap.Write(m_framesDropped);
+	snap.Write(m_framesTotal);
+	snap.Write(m_peakInFlight);
+	m_frameLatency.SaveState(snap);
+	snap.Write(m_nextFrame);
+	snap.Write(m_nextFrameSize);
+}
+
+void NOCNicHost::LoadState(SimSnapshot& snap)
+{
+	NOCHost::LoadState(snap);
+	snap.Read(m_ring);
+	snap.Read(m_waitingForBuffer);
+	snap.Read(m_frameBuffers);
+	snap.Read(m_mallocsOutstanding);
+	snap.Read(m_cycles);
+	snap.Read(m_framesProcessed);
+	snap.Read(m_framesDropped);
+	snap.Read(m_framesTotal);
+	snap.Read(m_peakInFlight);
+	m_frameLatency.LoadState(snap);
+	snap.Read(m_nextFrame);
+	snap.Read(m_nextFrameSize);
+
+	//Snapshot of a different ring size?
+	if(m_ring.size() != g_nicRingSize)
+		snap.Fail();
 }
@@ -35,53 +35,110 @@
 #ifndef NOCNicHost_h
 #define NOCNicHost_h
 
+/**
+	@brief The network interface.
+
+	Frames arrive from the wire into an RX ring of g_nicRingSize slots, and are dropped if the ring is full. Each
+	frame is written to a frame buffer in RAM (DMA write), handed over to the CPU (RPC chown) and the CPU is
+	interrupted. The slot is free again once the interrupt has gone out. Every slot works through this on its own, so
+	up to g_nicRingSize frames can be in flight at once.
+
+	Frame buffers are allocated (RPC malloc) ahead of time: we keep g_nicBuffers buffers either free or being
+	allocated.
+
+	Requests carry the ring slot in their tag, so replies can be matched up even if they come back out of order.
+ */
 class NOCNicHost : public NOCHost
 {
 public:
 	NOCNicHost(uint16_t addr, NOCRouter* parent, xypos pos);
 	virtual ~NOCNicHost();
 
-	virtual bool AcceptMessage(NOCPacket packet, SimNode* from);
 	virtual void Timestep();
 
 	virtual void PrintStats();
 
+	virtual void SaveState(SimSnapshot& snap);
+	virtual void LoadState(SimSnapshot& snap);
+
+	static unsigned int GetMaxWriteSize();
+
 	enum States
 	{
 		RX_STATE_IDLE,
 		RX_STATE_WAIT_ALLOC,
 		RX_STATE_WAIT_WRITE,
 		RX_STATE_WAIT_CHOWN,
-		RX_STATE_WAIT_SEND
-	} m_rxstate;
+		RX_STATE_WAIT_SEND,
+
+		RX_STATE_COUNT		//must be last
+	};
 
 protected:
-	int m_frameBuffers;
+	virtual void ProcessMessage(NOCPacket packet);
+
+	static unsigned int GetWriteSize(unsigned int frameSize);
 
-	unsigned long m_cyclesIdle;
-	unsigned long m_cyclesWaitingForMalloc;
-	unsigned long m_cyclesWaitingForWrite;
-	unsigned long m_cyclesWaitingForChown;
-	unsigned long m_cyclesWaitingForSend;
+	void AllocateBuffers();
+	void StartWrites();
+
+	//Range of frame sizes coming in off the wire, in bytes
+	static const unsigned int m_minFrameSize = 64;
+	static const unsigned int m_maxFrameSize = 1499;
+
+	//What a request is for (low bits of the tag, the ring slot is above)
+	enum Requests
+	{
+		REQ_MALLOC,
+		REQ_WRITE,
+		REQ_CHOWN,
+
+		REQ_BITS = 2
+	};
+
+	//One frame in the RX ring
+	class RxSlot
+	{
+	public:
+		States m_state;
+
+		//Size of the frame, in bytes
+		unsigned int m_frameSize;
+
+		//Time the frame arrived
+		unsigned int m_arrival;
+
+		//Time at which the slot is free again (in RX_STATE_WAIT_SEND)
+		unsigned int m_returnToIdle;
+	};
+
+	std::vector<RxSlot> m_ring;
+
+	//Slots waiting for a frame buffer, in order of arrival
+	std::deque<unsigned int> m_waitingForBuffer;
+
+	//Frame buffers allocated and not yet used, and malloc requests outstanding
+	unsigned int m_frameBuffers;
+	unsigned int m_mallocsOutstanding;
+
+	//Slot-cycles spent in each state
+	unsigned long m_cycles[RX_STATE_COUNT];
 
 	unsigned long m_framesProcessed;
 	unsigned long m_framesDropped;
 	unsigned long m_framesTotal;
 
-	//True if we have a frame ready to forward
-	bool m_pendingFrame;
+	//Most frames in flight at once
+	unsigned int m_peakInFlight;
 
-	//Size of the pending frame
-	unsigned int m_pendingFrameSize;
+	//Time from frame arrival to the CPU being interrupted
+	LatencyHistogram m_frameLatency;
 
 	//Time at which the next frame arrives
 	unsigned int m_nextFrame;
 
 	//Size of the next frame
 	unsigned int m_nextFrameSize;
-
-	//Time at which we return to idle
-	unsigned int m_returnToIdle;
 };
 
 #endif
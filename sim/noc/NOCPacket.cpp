@@ -35,10 +35,13 @@
 
 #include "nocsim.h"
 
-unsigned int NOCPacket::m_minLatency = 0xffffffff;
-unsigned int NOCPacket::m_maxLatency = 0;
-unsigned int NOCPacket::m_totalPackets = 0;
-unsigned long NOCPacket::m_totalLatency = 0;
+using namespace std;
+
+LatencyHistogram NOCPacket::m_latency;
+LatencyHistogram NOCPacket::m_typeLatency[TYPE_COUNT];
+bool NOCPacket::m_pairStatsEnabled = false;
+map< pair<uint16_t, uint16_t>, LatencyHistogram > NOCPacket::m_pairLatency;
+mutex NOCPacket::m_statsMutex;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
@@ -49,35 +52,211 @@ NOCPacket::NOCPacket(uint16_t f, uint16_t t, unsigned int s, msgType type, unsig
 	, m_size(s)
 	, m_replysize(replysize)
 	, m_type(type)
+	, m_tag(0)
 	, m_timeSent(g_time)
+	, m_seq(0)
+	, m_synthetic(false)
+	, m_replayed(false)
+	, m_vc(0)
 {
 }
 
-NOCPacket::~NOCPacket()
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Simulation
+
+/**
+	@brief The network the packet travels on: 0 for the RPC network, or 1 for the DMA network in dual-network mode
+ */
+unsigned int NOCPacket::GetNetwork() const
 {
+	return (g_dualNetwork && IsDMA()) ? 1 : 0;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// Simulation
+/**
+	@brief Width, in bits, of the links on the packet's network
+ */
+unsigned int NOCPacket::GetLinkWidth() const
+{
+	return (g_dualNetwork && IsDMA()) ? g_dmaLinkWidth : g_linkWidth;
+}
+
+/**
+	@brief Number of flits it takes to send the packet over a link
+ */
+unsigned int NOCPacket::GetFlitCount() const
+{
+	unsigned int width = GetLinkWidth();
+	return max(1u, (m_size*32 + width - 1) / width);
+}
+
+/**
+	@brief Number of flits it takes to send the first (routing header) word of a packet
+ */
+unsigned int NOCPacket::GetHeaderFlitCount() const
+{
+	unsigned int width = GetLinkWidth();
+	return (32 + width - 1) / width;
+}
 
 void NOCPacket::Processed()
 {
+	lock_guard<mutex> lock(m_statsMutex);
+
 	unsigned int latency = g_time - m_timeSent;
-	if(m_minLatency > latency)
-		m_minLatency = latency;
-	if(m_maxLatency < latency)
-		m_maxLatency = latency;
-	m_totalPackets ++;
-	m_totalLatency += latency;
+	m_latency.Record(latency);
+	m_typeLatency[m_type].Record(latency);
+	if(m_pairStatsEnabled)
+		m_pairLatency[pair<uint16_t, uint16_t>(m_from, m_to)].Record(latency);
+
+	if(m_synthetic && g_trafficGenerator)
+		g_trafficGenerator->PacketDelivered(*this, latency);
+	if(m_replayed && g_tracePlayer)
+		g_tracePlayer->PacketDelivered(*this, latency);
+	if(g_traceWriter)
+		g_traceWriter->Record(*this);
+}
+
+const char* NOCPacket::GetTypeName(msgType type)
+{
+	switch(type)
+	{
+		case TYPE_RPC_CALL:
+			return "RPC call";
+		case TYPE_RPC_RETURN:
+			return "RPC return";
+		case TYPE_RPC_INTERRUPT:
+			return "RPC interrupt";
+		case TYPE_DMA_READ:
+			return "DMA read";
+		case TYPE_DMA_RDATA:
+			return "DMA read data";
+		case TYPE_DMA_WRITE:
+			return "DMA write";
+		case TYPE_DMA_ACK:
+			return "DMA ack";
+		default:
+			return "invalid";
+	}
+}
+
+void NOCPacket::ResetStats()
+{
+	m_latency.Clear();
+	for(auto& h : m_typeLatency)
+		h.Clear();
+	m_pairLatency.clear();
 }
 
 void NOCPacket::PrintStats()
 {
-	if(m_totalPackets == 0)
+	if(m_latency.GetCount() == 0)
 		return;
 
 	LogDebug("[NOC] Packets:\n");
 	LogIndenter li;
-	LogDebug("Sent                     : %5u\n", m_totalPackets);
-	LogDebug("Latency (min/avg/max)    : %5u / %5lu / %5u\n", m_minLatency, m_totalLatency/m_totalPackets, m_maxLatency);
+	LogDebug("Sent                     : %5lu\n", m_latency.GetCount());
+	LogDebug("Latency (min/avg/max)    : %5u / %5.1f / %5u\n",
+		m_latency.GetMin(), m_latency.GetMean(), m_latency.GetMax());
+	LogDebug("Latency (p50/p99/p99.9)  : %5u / %5u / %5u\n",
+		m_latency.GetPercentile(50), m_latency.GetPercentile(99), m_latency.GetPercentile(99.9));
+
+	LogDebug("By message type:\n");
+	LogIndenter li2;
+	for(int i=0; i<TYPE_COUNT; i++)
+		m_typeLatency[i].PrintSummary(GetTypeName(static_cast<msgType>(i)));
+}
+
+/**
+	@brief Write latency statistics (one row per group) to a CSV file.
+
+	Group names are "all", "type:NAME", or "pair:SRC:DST" (hex addresses).
+ */
+void NOCPacket::WriteStatsCSV(FILE* fp, unsigned int run)
+{
+	if(run == 0)
+		fprintf(fp, "run,group,count,min,mean,p50,p99,p999,max\n");
+
+	char prefix[32];
+	snprintf(prefix, sizeof(prefix), "%u,", run);
+
+	m_latency.WriteCSV(fp, prefix, "all");
+	for(int i=0; i<TYPE_COUNT; i++)
+	{
+		if(m_typeLatency[i].GetCount() == 0)
+			continue;
+		string name = string("type:") + GetTypeName(static_cast<msgType>(i));
+		m_typeLatency[i].WriteCSV(fp, prefix, name.c_str());
+	}
+	for(auto& it : m_pairLatency)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "pair:%04x:%04x", it.first.first, it.first.second);
+		it.second.WriteCSV(fp, prefix, name);
+	}
+}
+
+/**
+	@brief Write latency statistics, including histogram buckets, as a JSON object
+ */
+void NOCPacket::WriteStatsJSON(FILE* fp, unsigned int run)
+{
+	fprintf(fp, "{\"run\": %u,\n\"all\": ", run);
+	m_latency.WriteJSON(fp, "all");
+
+	fprintf(fp, ",\n\"types\": [");
+	bool first = true;
+	for(int i=0; i<TYPE_COUNT; i++)
+	{
+		if(m_typeLatency[i].GetCount() == 0)
+			continue;
+		fprintf(fp, "%s\n", first ? "" : ",");
+		m_typeLatency[i].WriteJSON(fp, GetTypeName(static_cast<msgType>(i)));
+		first = false;
+	}
+
+	fprintf(fp, "],\n\"pairs\": [");
+	first = true;
+	for(auto& it : m_pairLatency)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%04x:%04x", it.first.first, it.first.second);
+		fprintf(fp, "%s\n", first ? "" : ",");
+		it.second.WriteJSON(fp, name);
+		first = false;
+	}
+	fprintf(fp, "]}");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpointing
+
+void NOCPacket::SaveStats(SimSnapshot& snap)
+{
+	m_latency.SaveState(snap);
+	for(auto& h : m_typeLatency)
+		h.SaveState(snap);
+
+	snap.Write<uint64_t>(m_pairLatency.size());
+	for(auto& it : m_pairLatency)
+	{
+		snap.Write(it.first);
+		it.second.SaveState(snap);
+	}
+}
+
+void NOCPacket::LoadStats(SimSnapshot& snap)
+{
+	m_latency.LoadState(snap);
+	for(auto& h : m_typeLatency)
+		h.LoadState(snap);
+
+	m_pairLatency.clear();
+	uint64_t npairs = 0;
+	snap.Read(npairs);
+	for(uint64_t i=0; (i < npairs) && snap.IsOK(); i++)
+	{
+		pair<uint16_t, uint16_t> key;
+		snap.Read(key);
+		m_pairLatency[key].LoadState(snap);
+	}
 }
@@ -47,16 +47,19 @@ public:
 		TYPE_DMA_READ,
 		TYPE_DMA_RDATA,
 		TYPE_DMA_WRITE,
-		TYPE_DMA_ACK
+		TYPE_DMA_ACK,
+
+		TYPE_COUNT		//must be last
 	};
 
+	static const char* GetTypeName(msgType type);
+
 	NOCPacket(
 		uint16_t f = 0,
 		uint16_t t = 0,
 		unsigned int s = 0,
 		msgType type = TYPE_RPC_CALL,
 		unsigned int replysize = 4);
-	virtual ~NOCPacket();
 
 	uint16_t m_from;
 	uint16_t m_to;
@@ -65,18 +68,61 @@ public:
 
 	msgType m_type;
 
+	//Transaction tag, chosen by the sender of a request and copied into the reply (so a host with several requests
+	//outstanding can tell which one the reply is for)
+	unsigned int m_tag;
+
 	unsigned int m_timeSent;
 
+	//Position in the sending host's output order (packets sent in the same cycle keep their order in a trace)
+	unsigned int m_seq;
+
+	//True if the packet was created by the traffic generator
+	bool m_synthetic;
+
+	//True if the packet came from a trace. Its reply (if any) is in the trace too, so the destination doesn't send one
+	bool m_replayed;
+
+	//Virtual channel the packet is using on the link it's currently crossing
+	unsigned int m_vc;
+
 	//Indicate that this message has been received and handled by the final destination
 	void Processed();
 
+	bool IsDMA() const
+	{ return (m_type >= TYPE_DMA_READ) && (m_type <= TYPE_DMA_ACK); }
+
+	unsigned int GetNetwork() const;
+	unsigned int GetLinkWidth() const;
+	unsigned int GetFlitCount() const;
+	unsigned int GetHeaderFlitCount() const;
+
 	static void PrintStats();
+	static void ResetStats();
+
+	static void EnablePairStats()
+	{ m_pairStatsEnabled = true; }
+
+	static void WriteStatsCSV(FILE* fp, unsigned int run);
+	static void WriteStatsJSON(FILE* fp, unsigned int run);
+
+	static void SaveStats(SimSnapshot& snap);
+	static void LoadStats(SimSnapshot& snap);
 
 protected:
-	static unsigned int m_minLatency;
-	static unsigned int m_maxLatency;
-	static unsigned int m_totalPackets;
-	static unsigned long m_totalLatency;
+
+	//Processed() is called from Timestep(), which may be running on several threads
+	static std::mutex m_statsMutex;
+
+	//Latency of all packets
+	static LatencyHistogram m_latency;
+
+	//Latency by message type
+	static LatencyHistogram m_typeLatency[TYPE_COUNT];
+
+	//Latency by source/destination pair (only if enabled, since it can get big)
+	static bool m_pairStatsEnabled;
+	static std::map< std::pair<uint16_t, uint16_t>, LatencyHistogram > m_pairLatency;
 };
 
 #endif
@@ -34,14 +34,21 @@
  */
 
 #include "nocsim.h"
+#include <math.h>
+
+using namespace std;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
 
 NOCRamHost::NOCRamHost(uint16_t addr, NOCRouter* parent, xypos pos)
 	: NOCHost(addr, parent, pos)
+	, m_memoryFreeTime(0)
+	, m_requests(0)
+	, m_wordsTransferred(0)
+	, m_busyCycles(0)
+	, m_peakPending(0)
 {
-
 }
 
 NOCRamHost::~NOCRamHost()
@@ -54,3 +61,98 @@ NOCRamHost::~NOCRamHost()
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Simulation
+
+void NOCRamHost::PrintStats()
+{
+	if(m_requests == 0)
+		return;
+
+	LogDebug("[RAM] Requests:\n");
+	LogIndenter li;
+	LogDebug("Served                   : %5lu (%lu data words)\n", m_requests, m_wordsTransferred);
+	LogDebug("Memory busy              : %5lu (%5.2f %%)\n", m_busyCycles, (m_busyCycles * 100.0f) / g_time);
+	LogDebug("Peak in progress         : %5zu\n", m_peakPending);
+	m_serviceTime.PrintSummary("Service time");
+}
+
+/**
+	@brief Schedule a request for service
+ */
+void NOCRamHost::ProcessMessage(NOCPacket packet)
+{
+	packet.Processed();
+	if(packet.m_replayed)
+		return;
+
+	//Number of words the memory has to move (everything after the three header words)
+	unsigned int words = 0;
+	if(packet.m_type == NOCPacket::TYPE_DMA_WRITE)
+		words = (packet.m_size > 3) ? packet.m_size - 3 : 0;
+	else if(packet.m_type == NOCPacket::TYPE_DMA_READ)
+		words = (packet.m_replysize > 3) ? packet.m_replysize - 3 : 0;
+	else if(packet.m_type != NOCPacket::TYPE_RPC_CALL)
+		return;
+
+	unsigned int start = max(g_time, m_memoryFreeTime);
+	unsigned int transfer = 0;
+	if(g_ramBandwidth > 0)
+		transfer = ceil(words / g_ramBandwidth);
+	m_memoryFreeTime = start + transfer;
+	m_busyCycles += transfer;
+	unsigned int done = m_memoryFreeTime + g_ramLatency;
+
+	m_requests ++;
+	m_wordsTransferred += words;
+	m_serviceTime.Record(done - g_time);
+
+	//Nothing in the way? Reply right now
+	if(m_pending.empty() && (done <= g_time) )
+	{
+		SendReply(packet);
+		return;
+	}
+
+	m_pending.push_back(pair<unsigned int, NOCPacket>(done, packet));
+	m_peakPending = max(m_peakPending, m_pending.size());
+	Wakeup(done);
+}
+
+void NOCRamHost::Timestep()
+{
+	NOCHost::Timestep();
+
+	while(!m_pending.empty() && (m_pending.front().first <= g_time) )
+	{
+		SendReply(m_pending.front().second);
+		m_pending.pop_front();
+	}
+	if(!m_pending.empty())
+		Wakeup(m_pending.front().first);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpointing
+
+void NOCRamHost::SaveState(SimSnapshot& snap)
+{
+	NOCHost::SaveState(snap);
+	snap.Write(m_pending);
+	snap.Write(m_memoryFreeTime);
+	snap.Write(m_requests);
+	snap.Write(m_wordsTransferred);
+	snap.Write(m_busyCycles);
+	snap.Write(m_peakPending);
+	m_serviceTime.SaveState(snap);
+}
+
+void NOCRamHost::LoadState(SimSnapshot& snap)
+{
+	NOCHost::LoadState(snap);
+	snap.Read(m_pending);
+	snap.Read(m_memoryFreeTime);
+	snap.Read(m_requests);
+	snap.Read(m_wordsTransferred);
+	snap.Read(m_busyCycles);
+	snap.Read(m_peakPending);
+	m_serviceTime.LoadState(snap);
+}
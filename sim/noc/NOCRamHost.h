@@ -35,11 +35,43 @@
 #ifndef NOCRamHost_h
 #define NOCRamHost_h
 
+/**
+	@brief The RAM controller.
+
+	Requests are served in order of arrival. The memory transfers the data (payload of DMA writes, or read data) at
+	g_ramBandwidth words per cycle, one request at a time, and the reply goes out g_ramLatency cycles after the
+	transfer finishes. Requests are pipelined, so several can be in the latency stage at once.
+
+	With both set to zero (the default) requests are served instantly.
+ */
 class NOCRamHost : public NOCHost
 {
 public:
 	NOCRamHost(uint16_t addr, NOCRouter* parent, xypos pos);
 	virtual ~NOCRamHost();
+
+	virtual void Timestep();
+
+	virtual void PrintStats();
+
+	virtual void SaveState(SimSnapshot& snap);
+	virtual void LoadState(SimSnapshot& snap);
+
+protected:
+	virtual void ProcessMessage(NOCPacket packet);
+
+	//Requests being served, and the time the reply goes out (in time order)
+	std::deque< std::pair<unsigned int, NOCPacket> > m_pending;
+
+	//Time at which the memory finishes the last transfer we've scheduled
+	unsigned int m_memoryFreeTime;
+
+	//Statistics
+	unsigned long m_requests;
+	unsigned long m_wordsTransferred;
+	unsigned long m_busyCycles;
+	size_t m_peakPending;
+	LatencyHistogram m_serviceTime;
 };
 
 #endif
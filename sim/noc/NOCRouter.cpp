@@ -34,17 +34,860 @@
  */
 
 #include "nocsim.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
 
-NOCRouter::NOCRouter(uint16_t low, uint16_t high, xypos pos)
+NOCRouter::NOCRouter(uint16_t low, uint16_t high, unsigned int nports, xypos pos)
 	: SimNode(pos)
+	, m_portCount(nports)
+	, m_vcCount(g_vcCount)
+	, m_freePacket(NEVER)
+	, m_fifoHead(nports * g_vcCount, NEVER)
+	, m_fifoTail(nports * g_vcCount, NEVER)
+	, m_fifoWaiting(nports * g_vcCount, NEVER)
+	, m_fifoPrev(nports * g_vcCount, NEVER)
+	, m_inputFreeTime(nports, 0)
+	, m_outboxFreeTime(nports, 0)
+	, m_vcFreeTime(nports * g_vcCount, 0)
+	, m_credits(nports * g_vcCount, g_fifoDepth)
+	, m_creditsOutstanding(nports * g_vcCount, 0)
+	, m_creditWaitStart(nports, NEVER)
+	, m_stalledInput(nports * g_vcCount, NEVER)
+	, m_stallStart(nports * g_vcCount, 0)
+	, m_inputPointer(nports, 0)
+	, m_outputPointer(nports, 0)
+	, m_requestPort(nports, NEVER)
+	, m_requestChannel(nports, 0)
+	, m_requestVC(nports, 0)
+	, m_txBusyCycles(nports, 0)
+	, m_rxBusyCycles(nports, 0)
+	, m_inboxCycles(nports, 0)
+	, m_creditStallCycles(nports, 0)
+	, m_blockedCycles(nports, 0)
 	, m_subnetLow(low)
 	, m_subnetHigh(high)
+	, m_network(0)
+	, m_portNodes(nports, NULL)
+	, m_childBlockSize(1)
+	, m_routeBlockSize(1)
 {
 }
 
 NOCRouter::~NOCRouter()
 {
 }
+
+bool NOCRouter::ParseSwitchingMode(string s, SwitchingMode& mode)
+{
+	if(s == "saf")
+		mode = SWITCH_STORE_AND_FORWARD;
+	else if(s == "vct")
+		mode = SWITCH_VIRTUAL_CUT_THROUGH;
+	else if(s == "wormhole")
+		mode = SWITCH_WORMHOLE;
+	else
+		return false;
+	return true;
+}
+
+const char* NOCRouter::GetSwitchingModeName(SwitchingMode mode)
+{
+	switch(mode)
+	{
+		case SWITCH_STORE_AND_FORWARD:
+			return "store-and-forward";
+		case SWITCH_VIRTUAL_CUT_THROUGH:
+			return "virtual cut-through";
+		case SWITCH_WORMHOLE:
+			return "wormhole";
+		default:
+			return "invalid";
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Routing
+
+/**
+	@brief Record which port a neighboring node is attached to
+ */
+void NOCRouter::ConnectPort(unsigned int port, SimNode* node)
+{
+	m_portNodes[port] = node;
+}
+
+/**
+	@brief See which port a neighboring node is attached to
+ */
+unsigned int NOCRouter::GetPortNumber(SimNode* node)
+{
+	//Links to other routers are numbered last in every topology, and carry most of the traffic, so start there
+	for(unsigned int i=m_portCount; i>0; i--)
+	{
+		if(m_portNodes[i-1] == node)
+			return i-1;
+	}
+
+	LogError("Router %s: node is not connected to any port\n", GetName().c_str());
+	return 0;
+}
+
+/**
+	@brief Replace the routing table entry for the block of addresses containing addr
+
+	@param addr		Destination address
+	@param port		New output port
+	@param oldPort	Set to the previous output port
+
+	@return False if the port or address is out of range
+ */
+bool NOCRouter::SetRoute(uint16_t addr, unsigned int port, unsigned int& oldPort)
+{
+	if(port >= m_portCount)
+		return false;
+
+	unsigned int* entry = NULL;
+	if( (addr >= m_subnetLow) && (addr <= m_subnetHigh) )
+		entry = &m_childRoutes[(addr - m_subnetLow) / m_childBlockSize];
+	else
+	{
+		unsigned int block = addr / m_routeBlockSize;
+		if(block >= m_routes.size())
+			return false;
+		entry = &m_routes[block];
+	}
+
+	oldPort = *entry;
+	*entry = port;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Simulation
+
+/*
+	Packets move across links one flit (g_linkWidth bits) per cycle. The head flit of a packet sent at time T arrives at
+	time T (in the commit phase) and the tail at T + flits - 1, unless the packet stalled somewhere along the way.
+
+	Each input port has g_vcCount virtual channels, and each of those has a FIFO of g_fifoDepth flits. We keep the
+	packets in a FIFO as a list rather than simulating each flit: a packet's flits leave at one per cycle once its head
+	is forwarded, so occupancy at any time can be computed from the head/send times.
+
+	Flow control is credit based, counted in flits, per virtual channel. Each output VC starts with one credit per flit
+	of the FIFO on the far end, and a packet uses up one credit per flit. Store-and-forward and virtual cut-through wait
+	until there's enough credit for the whole packet. Wormhole only needs room for the head; if the rest doesn't fit,
+	the transfer stalls (and holds the output VC) until the far end forwards the packet and hands the credits back.
+	The physical link is only held for the flits that fit, so other VCs can use it in the meantime. We don't model
+	the rest of the stalled packet's flits competing for the link when they trickle out later.
+
+	Credits for a packet are returned once it's streaming out at full rate. Since the sender can't put flits in any
+	faster than we take them out, that's early enough that the FIFO never overflows. If our own output stalled, the
+	credits (and the stall) are passed back upstream once it clears.
+
+	Every cycle, the switch allocator matches inputs to outputs (a single iteration of iSLIP):
+	* Request: each input port picks one of its VCs with a routable packet, round-robin starting from the VC after
+	  the last one it got granted. That packet requests its best output port (and a free VC on it).
+	* Grant: each output grants one of its requesting inputs, round-robin starting from the input after the last one
+	  it granted. Since every input only requests one output, there's no separate accept phase.
+	Inputs that lose try again next cycle, possibly with a different route if the router is adaptive.
+ */
+
+/**
+	@brief Get the number of credits needed before we can start sending a packet
+ */
+unsigned int NOCRouter::GetCreditsNeeded(unsigned int flits)
+{
+	if(g_switching == SWITCH_WORMHOLE)
+		return 1;
+	return flits;
+}
+
+/**
+	@brief Check if a packet can ever be sent (it needs to fit in a FIFO, unless we're doing wormhole switching)
+ */
+bool NOCRouter::IsSendable(unsigned int flits)
+{
+	return GetCreditsNeeded(flits) <= g_fifoDepth;
+}
+
+bool NOCRouter::AcceptMessage(NOCPacket packet, SimNode* from)
+{
+	unsigned int srcport = GetPortNumber(from);
+	unsigned int chan = GetChannel(srcport, packet.m_vc);
+	RetirePackets(chan);
+
+	InputPacket p;
+	p.m_packet = packet;
+	p.m_flits = packet.GetFlitCount();
+	p.m_space = GetFreeSpace(chan);
+	p.m_headTime = g_time;
+	p.m_sendTime = NEVER;
+	p.m_leaveTime = NEVER;
+	p.m_creditsReturned = false;
+	p.m_next = NEVER;
+
+	//Sender should never overrun us. If it did, something is wrong with the credit accounting
+	if(p.m_space < GetCreditsNeeded(p.m_flits))
+	{
+		LogError(
+			"[%5u] Router %s: %d-flit message from %04x to %04x (on port %d VC %u) overflows FIFO (%u flits free)\n",
+			g_time, GetName().c_str(), p.m_flits, packet.m_from, packet.m_to, srcport, packet.m_vc, p.m_space);
+	}
+
+	//A wormhole packet that doesn't fit will stall upstream, and we won't know when the tail arrives until it moves
+	if(p.m_flits > p.m_space)
+		p.m_tailTime = NEVER;
+	else
+		p.m_tailTime = g_time + p.m_flits - 1;
+
+	//Store-and-forward waits for the whole packet. Otherwise we can go once the header word is in.
+	//Then the routing pipeline takes g_routerLatency more cycles
+	if(g_switching == SWITCH_STORE_AND_FORWARD)
+		p.m_routeTime = g_time + p.m_flits;
+	else
+		p.m_routeTime = g_time + packet.GetHeaderFlitCount();
+	p.m_routeTime += g_routerLatency;
+
+	Wakeup(p.m_routeTime);
+
+	//Append to the FIFO
+	unsigned int index = AllocatePacket();
+	m_packetPool[index] = p;
+	if(m_fifoTail[chan] == NEVER)
+		m_fifoHead[chan] = index;
+	else
+		m_packetPool[m_fifoTail[chan]].m_next = index;
+	m_fifoTail[chan] = index;
+	if(m_fifoWaiting[chan] == NEVER)
+		m_fifoWaiting[chan] = index;
+	return true;
+}
+
+void NOCRouter::AcceptCredits(SimNode* from, unsigned int credits, unsigned int tailTime, unsigned int vc)
+{
+	unsigned int port = GetPortNumber(from);
+	unsigned int chan = GetChannel(port, vc);
+	m_credits[chan] += credits;
+	m_creditsOutstanding[chan] --;
+
+	//If the transfer on this VC is stalled, it's the last thing we sent. Once that one is back, it's done and the
+	//tail went out at tailTime
+	if( (m_vcFreeTime[chan] == NEVER) && (m_creditsOutstanding[chan] == 0) )
+	{
+		m_vcFreeTime[chan] = tailTime + 1;
+		m_creditStallCycles[port] += tailTime + 1 - m_stallStart[chan];
+
+		//Now we know when the packet leaves our FIFO, so we can pass the credits upstream
+		unsigned int inchan = m_stalledInput[chan];
+		m_stalledInput[chan] = NEVER;
+		for(unsigned int i=m_fifoHead[inchan]; i != NEVER; i = m_packetPool[i].m_next)
+		{
+			auto& p = m_packetPool[i];
+			if( (p.m_sendTime != NEVER) && !p.m_creditsReturned)
+			{
+				FinishInput(inchan, p, tailTime);
+				break;
+			}
+		}
+	}
+
+	//We might be able to send something now
+	Wakeup(g_time);
+}
+
+/**
+	@brief Called once we know when a packet's tail leaves the input FIFO. Returns its credits upstream.
+ */
+void NOCRouter::FinishInput(unsigned int inchan, InputPacket& p, unsigned int leaveTime)
+{
+	p.m_leaveTime = leaveTime;
+	p.m_creditsReturned = true;
+
+	//If the head was stuck long enough to fill the FIFO, the rest of the packet stalled upstream.
+	//Flit k can only come in once flit k-space has left, so the tail is late
+	if(p.m_tailTime == NEVER)
+		p.m_tailTime = max(p.m_headTime + p.m_flits - 1, leaveTime + 1 - p.m_space);
+
+	unsigned int port = inchan / m_vcCount;
+	ReturnCredits(GetPortNode(port), p.m_flits, p.m_tailTime, inchan % m_vcCount);
+
+	RecordReceive(port, p.m_tailTime - p.m_headTime + 1);
+	RecordInboxOccupancy(port, leaveTime + 1 - p.m_headTime);
+
+	//The next packet in the FIFO can go once we're out of the way
+	Wakeup(leaveTime + 1);
+}
+
+/**
+	@brief Forget about packets whose tail has left the FIFO
+ */
+void NOCRouter::RetirePackets(unsigned int chan)
+{
+	//Unforwarded packets have no leave time, so this never gets past m_fifoWaiting
+	while(m_fifoHead[chan] != NEVER)
+	{
+		unsigned int index = m_fifoHead[chan];
+		auto& p = m_packetPool[index];
+		if( (p.m_leaveTime == NEVER) || (p.m_leaveTime >= g_time) )
+			break;
+
+		m_fifoHead[chan] = p.m_next;
+		if(m_fifoHead[chan] == NEVER)
+			m_fifoTail[chan] = NEVER;
+		if(m_fifoPrev[chan] == index)
+			m_fifoPrev[chan] = NEVER;
+		FreePacket(index);
+	}
+}
+
+/**
+	@brief Get a free slot in the packet pool, growing it if there are none
+ */
+unsigned int NOCRouter::AllocatePacket()
+{
+	if(m_freePacket == NEVER)
+	{
+		m_packetPool.push_back(InputPacket());
+		return m_packetPool.size() - 1;
+	}
+
+	unsigned int index = m_freePacket;
+	m_freePacket = m_packetPool[index].m_next;
+	return index;
+}
+
+/**
+	@brief Put a slot in the packet pool back on the free list
+ */
+void NOCRouter::FreePacket(unsigned int index)
+{
+	m_packetPool[index].m_next = m_freePacket;
+	m_freePacket = index;
+}
+
+/**
+	@brief Get the number of free flits in an input FIFO, as seen by the sender (i.e. its credit count)
+ */
+unsigned int NOCRouter::GetFreeSpace(unsigned int chan)
+{
+	//Packets that have had their credits returned are draining as fast as anything can arrive, so they don't count.
+	//Everything else has (or will have) all of its flits here, or as many as fit
+	unsigned int used = 0;
+	for(unsigned int i=m_fifoHead[chan]; i != NEVER; i = m_packetPool[i].m_next)
+	{
+		auto& p = m_packetPool[i];
+		if(!p.m_creditsReturned)
+			used += min(p.m_flits, p.m_space);
+	}
+
+	if(used >= g_fifoDepth)
+		return 0;
+	return g_fifoDepth - used;
+}
+
+/**
+	@brief Get the first waiting packet in a FIFO, if it's at the head (the previous packet's tail is gone) and routed
+ */
+NOCRouter::InputPacket* NOCRouter::GetReadyPacket(unsigned int chan)
+{
+	unsigned int waiting = m_fifoWaiting[chan];
+	if(waiting == NEVER)
+		return NULL;
+
+	//If the previous packet's tail is still in the way, nothing to do
+	if(m_fifoPrev[chan] != NEVER)
+	{
+		auto& prev = m_packetPool[m_fifoPrev[chan]];
+		if( (prev.m_leaveTime == NEVER) || (prev.m_leaveTime >= g_time) )
+			return NULL;
+	}
+
+	//If we're still receiving the header (or the whole packet, for store-and-forward), nothing to do
+	auto& p = m_packetPool[waiting];
+	if(p.m_routeTime > g_time)
+		return NULL;
+
+	return &p;
+}
+
+/**
+	@brief Pick the output port and VC for a packet: of the legal routes with a free link and a VC with enough credits,
+	the one with the most credits (ties go to the router's preferred route).
+
+	@return False if there's nowhere to go this cycle
+ */
+bool NOCRouter::SelectOutput(InputPacket& p, unsigned int& outport, unsigned int& outvc)
+{
+	m_candidates.clear();
+	GetRouteCandidates(p.m_packet, m_candidates);
+
+	int best = -1;
+	unsigned int needed = GetCreditsNeeded(p.m_flits);
+	for(auto port : m_candidates)
+	{
+		if( (GetPortNode(port) == NULL) || (m_outboxFreeTime[port] > g_time) )
+			continue;
+
+		bool waiting = true;
+		for(unsigned int vc=0; vc<m_vcCount; vc++)
+		{
+			unsigned int chan = GetChannel(port, vc);
+			if(m_vcFreeTime[chan] > g_time)
+				continue;
+
+			if(m_credits[chan] < (int)needed)
+				continue;
+			waiting = false;
+
+			if(m_credits[chan] > best)
+			{
+				best = m_credits[chan];
+				outport = port;
+				outvc = vc;
+			}
+		}
+
+		//Link is free but there's no room on the far end
+		if(waiting && (m_creditWaitStart[port] == NEVER) )
+			m_creditWaitStart[port] = g_time;
+	}
+
+	return (best >= 0);
+}
+
+/**
+	@brief Get the next time a blocked packet might be able to go, or NEVER if it's waiting on credits
+ */
+unsigned int NOCRouter::GetRetryTime(InputPacket& p)
+{
+	m_candidates.clear();
+	GetRouteCandidates(p.m_packet, m_candidates);
+
+	unsigned int next = NEVER;
+	for(auto port : m_candidates)
+	{
+		if(m_outboxFreeTime[port] > g_time)
+			next = min(next, m_outboxFreeTime[port]);
+		for(unsigned int vc=0; vc<m_vcCount; vc++)
+		{
+			unsigned int t = m_vcFreeTime[GetChannel(port, vc)];
+			if( (t != NEVER) && (t > g_time) )
+				next = min(next, t);
+		}
+	}
+	return next;
+}
+
+void NOCRouter::Timestep()
+{
+	for(unsigned int i=0; i<m_fifoHead.size(); i++)
+		RetirePackets(i);
+
+	//Request phase: each input picks a VC and asks for an output
+	for(unsigned int i=0; i<m_portCount; i++)
+	{
+		m_requestPort[i] = NEVER;
+		if(m_inputFreeTime[i] > g_time)
+			continue;
+
+		for(unsigned int j=0; j<m_vcCount; j++)
+		{
+			unsigned int chan = GetChannel(i, (m_inputPointer[i] + j) % m_vcCount);
+			auto p = GetReadyPacket(chan);
+			if(p == NULL)
+				continue;
+
+			//If message is unforwardable, drop it and keep looking
+			m_candidates.clear();
+			GetRouteCandidates(p->m_packet, m_candidates);
+			bool routable = false;
+			for(auto port : m_candidates)
+			{
+				if(GetPortNode(port) != NULL)
+					routable = true;
+			}
+			if(!routable)
+			{
+				LogDebug("[%5u] Router %s: cannot forward message to %04x: nothing on port %d!\n",
+					g_time, GetName().c_str(), p->m_packet.m_to, m_candidates[0]);
+				DropPacket(chan);
+				continue;
+			}
+
+			if(SelectOutput(*p, m_requestPort[i], m_requestVC[i]))
+			{
+				m_requestChannel[i] = chan;
+				break;
+			}
+		}
+	}
+
+	//Grant phase: each output picks one of the inputs asking for it
+	for(unsigned int o=0; o<m_portCount; o++)
+	{
+		for(unsigned int j=0; j<m_portCount; j++)
+		{
+			unsigned int i = (m_outputPointer[o] + j) % m_portCount;
+			if(m_requestPort[i] != o)
+				continue;
+
+			Forward(m_requestChannel[i], o, m_requestVC[i]);
+			m_requestPort[i] = NEVER;
+			m_outputPointer[o] = (i + 1) % m_portCount;
+			m_inputPointer[i] = (m_requestChannel[i] % m_vcCount + 1) % m_vcCount;
+			break;
+		}
+	}
+
+	//Sleep until the next time we might be able to make progress.
+	//Anything waiting on credits (or a stalled transfer) gets woken up when they come back.
+	unsigned int next = NEVER;
+	for(unsigned int i=0; i<m_portCount; i++)
+	{
+		//Lost arbitration, try again next cycle
+		if(m_requestPort[i] != NEVER)
+		{
+			next = min(next, g_time + 1);
+			continue;
+		}
+
+		for(unsigned int vc=0; vc<m_vcCount; vc++)
+		{
+			unsigned int chan = GetChannel(i, vc);
+			unsigned int waiting = m_fifoWaiting[chan];
+			if(waiting == NEVER)
+				continue;
+			auto& p = m_packetPool[waiting];
+
+			//Still waiting on the previous packet to leave? Wake up once its tail is gone
+			if(m_fifoPrev[chan] != NEVER)
+			{
+				auto& prev = m_packetPool[m_fifoPrev[chan]];
+				if( (prev.m_leaveTime == NEVER) || (prev.m_leaveTime >= g_time) )
+				{
+					next = min(next, prev.m_leaveTime + 1);
+					continue;
+				}
+			}
+
+			//Still receiving the header? Wake up once it's ready to forward
+			if(p.m_routeTime > g_time)
+				next = min(next, p.m_routeTime);
+
+			//Waiting on the crossbar, a busy outbox or a VC, wake up once it clears
+			else if(m_inputFreeTime[i] > g_time)
+				next = min(next, m_inputFreeTime[i]);
+			else
+				next = min(next, GetRetryTime(p));
+		}
+	}
+	if(next != NEVER)
+		Wakeup(next);
+}
+
+/**
+	@brief Drop the first waiting packet in an input FIFO (it drains at full speed, so hand the credits back right away)
+ */
+void NOCRouter::DropPacket(unsigned int inchan)
+{
+	unsigned int waiting = m_fifoWaiting[inchan];
+	auto& p = m_packetPool[waiting];
+	FinishInput(inchan, p, g_time + p.m_flits - 1);
+
+	//Unlink it
+	unsigned int prev = m_fifoPrev[inchan];
+	if(prev == NEVER)
+		m_fifoHead[inchan] = p.m_next;
+	else
+		m_packetPool[prev].m_next = p.m_next;
+	if(m_fifoTail[inchan] == waiting)
+		m_fifoTail[inchan] = prev;
+	m_fifoWaiting[inchan] = p.m_next;
+	FreePacket(waiting);
+}
+
+/**
+	@brief Send the first waiting packet in an input FIFO out the selected port and VC
+ */
+void NOCRouter::Forward(unsigned int inchan, unsigned int outport, unsigned int outvc)
+{
+	unsigned int waiting = m_fifoWaiting[inchan];
+	auto& p = m_packetPool[waiting];
+	m_fifoPrev[inchan] = waiting;
+	m_fifoWaiting[inchan] = p.m_next;
+
+	unsigned int outchan = GetChannel(outport, outvc);
+	unsigned int inport = inchan / m_vcCount;
+
+	if(m_creditWaitStart[outport] != NEVER)
+	{
+		m_creditStallCycles[outport] += g_time - m_creditWaitStart[outport];
+		m_creditWaitStart[outport] = NEVER;
+	}
+
+	//Forward the packet
+	//LogDebug("[%5u] Router %s: forwarding %d-word message from %04x to %04x (out port %d VC %u)\n",
+	//	g_time, GetName().c_str(), p.m_packet.m_size, p.m_packet.m_from, p.m_packet.m_to, outport, outvc);
+	NOCPacket packet = p.m_packet;
+	packet.m_vc = outvc;
+	SendMessage(GetPortNode(outport), packet);
+	p.m_sendTime = g_time;
+	RecordTransmit(outport, p.m_flits);
+	m_blockedCycles[inport] += g_time - p.m_routeTime;
+
+	//The link and crossbar are busy for as many flits as fit on the far end (the whole packet, unless it stalls)
+	unsigned int burst = min(p.m_flits, (unsigned int)m_credits[outchan]);
+	m_inputFreeTime[inport] = g_time + burst;
+	m_outboxFreeTime[outport] = g_time + burst;
+	m_credits[outchan] -= p.m_flits;
+	m_creditsOutstanding[outchan] ++;
+
+	//Whole packet fits downstream: VC is busy until the tail goes out
+	if(m_credits[outchan] >= 0)
+	{
+		m_vcFreeTime[outchan] = g_time + p.m_flits;
+		FinishInput(inchan, p, g_time + p.m_flits - 1);
+	}
+
+	//Wormhole packet that doesn't fit: the VC stalls until we get the credits back
+	else
+	{
+		m_vcFreeTime[outchan] = NEVER;
+		m_stalledInput[outchan] = inchan;
+		m_stallStart[outchan] = g_time + p.m_flits;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Utilization tracking
+
+/**
+	@brief Called when an output port starts sending a packet that takes the given number of cycles
+ */
+void NOCRouter::RecordTransmit(unsigned int port, unsigned int cycles)
+{
+	m_txBusyCycles[port] += cycles;
+}
+
+/**
+	@brief Called when we know how many cycles it took to receive a packet on a port
+ */
+void NOCRouter::RecordReceive(unsigned int port, unsigned int cycles)
+{
+	m_rxBusyCycles[port] += cycles;
+}
+
+/**
+	@brief Called when we know how long a packet will have been in a port's input FIFO
+ */
+void NOCRouter::RecordInboxOccupancy(unsigned int port, unsigned int cycles)
+{
+	m_inboxCycles[port] += cycles;
+}
+
+void NOCRouter::FillLinkStats(LinkStats& stats, unsigned int port)
+{
+	stats.m_router = GetName();
+	stats.m_txBusyCycles = m_txBusyCycles[port];
+	stats.m_rxBusyCycles = m_rxBusyCycles[port];
+	stats.m_inboxCycles = m_inboxCycles[port];
+	stats.m_creditStallCycles = m_creditStallCycles[port];
+	stats.m_blockedCycles = m_blockedCycles[port];
+}
+
+/**
+	@brief Converts a cycle count to a fraction of the simulation run so far
+ */
+double NOCRouter::GetUtilization(unsigned long busy)
+{
+	if(g_time == 0)
+		return 0;
+
+	//The last packet of the run may hold a port a few cycles past the end
+	return min(1.0, busy / double(g_time));
+}
+
+/**
+	@brief Average inbox occupancy across all of our ports
+ */
+double NOCRouter::GetRouterUtilization()
+{
+	unsigned long total = 0;
+	for(auto c : m_inboxCycles)
+		total += c;
+	if(m_inboxCycles.empty())
+		return 0;
+	return GetUtilization(total / m_inboxCycles.size());
+}
+
+/**
+	@brief Heat map color: gray when idle, then green through yellow to red at full load
+ */
+string NOCRouter::GetHeatColor(double utilization)
+{
+	if(utilization <= 0)
+		return "#c0c0c0";
+
+	int r = min(255, int(510 * utilization));
+	int g = min(255, int(510 * (1 - utilization)));
+	char color[16];
+	snprintf(color, sizeof(color), "#%02x%02x00", r, g);
+	return color;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Rendering
+
+void NOCRouter::RenderHeatNode(FILE* fp)
+{
+	double util = GetRouterUtilization();
+
+	//Nodes grow from 10 to 20 px in diameter as they fill up
+	const unsigned int nodesize = 10;
+	unsigned int radius = nodesize/2 + round(util * nodesize/2);
+
+	fprintf(
+		fp,
+		"<circle cx=\"%u\" cy=\"%u\" r=\"%u\" stroke=\"green\" stroke-width=\"1\" fill=\"%s\">"
+			"<title>%s: %.1f %% inbox occupancy</title></circle>\n",
+		m_renderPosition.first,
+		m_renderPosition.second,
+		radius,
+		GetHeatColor(util).c_str(),
+		GetName().c_str(),
+		util * 100);
+}
+
+/**
+	@brief Draws one link as two halves: the half near us shows our transmit utilization, the half near the peer shows
+	the peer's transmit (our receive) utilization
+ */
+void NOCRouter::RenderHeatLink(FILE* fp, xypos peer, unsigned int port)
+{
+	int midx = (m_renderPosition.first + peer.first) / 2;
+	int midy = (m_renderPosition.second + peer.second) / 2;
+
+	double tx = GetUtilization(m_txBusyCycles[port]);
+	double rx = GetUtilization(m_rxBusyCycles[port]);
+
+	fprintf(fp,
+		"<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" stroke=\"%s\" stroke-width=\"%.1f\">"
+			"<title>%.1f %%</title></line>\n",
+		m_renderPosition.first, m_renderPosition.second, midx, midy,
+		GetHeatColor(tx).c_str(), 1 + tx*5, tx * 100);
+	fprintf(fp,
+		"<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" stroke=\"%s\" stroke-width=\"%.1f\">"
+			"<title>%.1f %%</title></line>\n",
+		peer.first, peer.second, midx, midy,
+		GetHeatColor(rx).c_str(), 1 + rx*5, rx * 100);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reporting
+
+/**
+	@brief Write one row per port to a CSV file. Utilization columns are fractions of the run length.
+ */
+void NOCRouter::WriteLinkStatsCSV(FILE* fp, unsigned int run, const vector<LinkStats>& stats)
+{
+	for(auto& s : stats)
+	{
+		fprintf(fp, "%u,%s,%s,%s,%lu,%.4f,%lu,%.4f,%lu,%.4f,%lu,%lu\n",
+			run,
+			s.m_router.c_str(),
+			s.m_port.c_str(),
+			s.m_peer.c_str(),
+			s.m_txBusyCycles,
+			GetUtilization(s.m_txBusyCycles),
+			s.m_rxBusyCycles,
+			GetUtilization(s.m_rxBusyCycles),
+			s.m_inboxCycles,
+			GetUtilization(s.m_inboxCycles),
+			s.m_creditStallCycles,
+			s.m_blockedCycles);
+	}
+}
+
+/**
+	@brief Print the most heavily loaded link directions
+ */
+void NOCRouter::PrintBusiestLinks(vector<LinkStats> stats, unsigned int count)
+{
+	sort(stats.begin(), stats.end(), [](const LinkStats& a, const LinkStats& b)
+		{ return max(a.m_txBusyCycles, a.m_rxBusyCycles) > max(b.m_txBusyCycles, b.m_rxBusyCycles); } );
+
+	LogDebug("Busiest links:\n");
+	LogIndenter li;
+	for(unsigned int i=0; i<count && i<stats.size(); i++)
+	{
+		auto& s = stats[i];
+		LogDebug("%-10s %-8s (peer %-10s): tx %5.1f %%, rx %5.1f %%, inbox %5.1f %%, stalled %5.1f %%\n",
+			s.m_router.c_str(),
+			s.m_port.c_str(),
+			s.m_peer.c_str(),
+			GetUtilization(s.m_txBusyCycles) * 100,
+			GetUtilization(s.m_rxBusyCycles) * 100,
+			GetUtilization(s.m_inboxCycles) * 100,
+			GetUtilization(s.m_creditStallCycles) * 100);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpointing
+
+void NOCRouter::SaveState(SimSnapshot& snap)
+{
+	SimNode::SaveState(snap);
+	snap.Write(m_packetPool);
+	snap.Write(m_freePacket);
+	snap.Write(m_fifoHead);
+	snap.Write(m_fifoTail);
+	snap.Write(m_fifoWaiting);
+	snap.Write(m_fifoPrev);
+	snap.Write(m_inputFreeTime);
+	snap.Write(m_outboxFreeTime);
+	snap.Write(m_vcFreeTime);
+	snap.Write(m_credits);
+	snap.Write(m_creditsOutstanding);
+	snap.Write(m_creditWaitStart);
+	snap.Write(m_stalledInput);
+	snap.Write(m_stallStart);
+	snap.Write(m_inputPointer);
+	snap.Write(m_outputPointer);
+	snap.Write(m_txBusyCycles);
+	snap.Write(m_rxBusyCycles);
+	snap.Write(m_inboxCycles);
+	snap.Write(m_creditStallCycles);
+	snap.Write(m_blockedCycles);
+}
+
+void NOCRouter::LoadState(SimSnapshot& snap)
+{
+	SimNode::LoadState(snap);
+	snap.Read(m_packetPool);
+	snap.Read(m_freePacket);
+	snap.Read(m_fifoHead);
+	snap.Read(m_fifoTail);
+	snap.Read(m_fifoWaiting);
+	snap.Read(m_fifoPrev);
+	snap.Read(m_inputFreeTime);
+	snap.Read(m_outboxFreeTime);
+	snap.Read(m_vcFreeTime);
+	snap.Read(m_credits);
+	snap.Read(m_creditsOutstanding);
+	snap.Read(m_creditWaitStart);
+	snap.Read(m_stalledInput);
+	snap.Read(m_stallStart);
+	snap.Read(m_inputPointer);
+	snap.Read(m_outputPointer);
+	snap.Read(m_txBusyCycles);
+	snap.Read(m_rxBusyCycles);
+	snap.Read(m_inboxCycles);
+	snap.Read(m_creditStallCycles);
+	snap.Read(m_blockedCycles);
+}
@@ -35,12 +35,58 @@
 #ifndef NOCRouter_h
 #define NOCRouter_h
 
+/**
+	@brief Utilization of one direction of one router port over a simulation run
+ */
+struct LinkStats
+{
+	//Router the port belongs to, and the port name ("child2", "parent", "east", etc)
+	std::string m_router;
+	std::string m_port;
+
+	//Name of the router, or address of the host, on the far end
+	std::string m_peer;
+
+	//Cycles the link was busy sending from us to the peer
+	unsigned long m_txBusyCycles;
+
+	//Cycles the link was busy sending from the peer to us
+	unsigned long m_rxBusyCycles;
+
+	//Cycles our inbox for this port held a packet (receiving or waiting for an outbox)
+	unsigned long m_inboxCycles;
+
+	//Cycles we couldn't send to the peer because it had no room (waiting for credits, or a stalled transfer)
+	unsigned long m_creditStallCycles;
+
+	//Cycles packets from the peer sat at the head of our inbox, ready to go, but blocked
+	unsigned long m_blockedCycles;
+};
+
 class NOCRouter : public SimNode
 {
 public:
-	NOCRouter(uint16_t low, uint16_t high, xypos pos);
+	NOCRouter(uint16_t low, uint16_t high, unsigned int nports, xypos pos);
 	virtual ~NOCRouter();
 
+	/**
+		@brief How a router moves a packet from an input to an output
+	 */
+	enum SwitchingMode
+	{
+		//Whole packet must arrive before the head is forwarded
+		SWITCH_STORE_AND_FORWARD,
+
+		//Head is forwarded as soon as it's routed, but only into a FIFO with room for the whole packet
+		SWITCH_VIRTUAL_CUT_THROUGH,
+
+		//Head is forwarded as soon as it's routed, flits stall in place (spanning several routers) if blocked
+		SWITCH_WORMHOLE
+	};
+
+	static bool ParseSwitchingMode(std::string s, SwitchingMode& mode);
+	static const char* GetSwitchingModeName(SwitchingMode mode);
+
 	/**
 		@brief Get the total number of addresses in the subnet
 	 */
@@ -53,14 +99,221 @@ public:
 	unsigned int GetSubnetBase()
 	{ return m_subnetLow; }
 
+	/**
+		@brief Set which network the router is part of (0 for RPC, 1 for DMA in dual-network mode)
+	 */
+	void SetNetwork(unsigned int network)
+	{ m_network = network; }
+
+	unsigned int GetNetwork()
+	{ return m_network; }
+
+	virtual bool AcceptMessage(NOCPacket packet, SimNode* from);
+	virtual void AcceptCredits(SimNode* from, unsigned int credits, unsigned int tailTime, unsigned int vc);
+	virtual void Timestep();
+
+	static unsigned int GetCreditsNeeded(unsigned int flits);
+	static bool IsSendable(unsigned int flits);
+
 	virtual void AddChild(SimNode* child) =0;
 
+	bool SetRoute(uint16_t addr, unsigned int port, unsigned int& oldPort);
+
+	/**
+		@brief Append utilization stats for every connected port to the list
+	 */
+	virtual void GetLinkStats(std::vector<LinkStats>& stats) =0;
+
+	/**
+		@brief Human readable name of the router for reports
+	 */
+	virtual std::string GetName() =0;
+
+	virtual void SaveState(SimSnapshot& snap);
+	virtual void LoadState(SimSnapshot& snap);
+
+	static void WriteLinkStatsCSV(FILE* fp, unsigned int run, const std::vector<LinkStats>& stats);
+	static void PrintBusiestLinks(std::vector<LinkStats> stats, unsigned int count);
+
 protected:
 
+	void ConnectPort(unsigned int port, SimNode* node);
+
+	/**
+		@brief Prefix for GetName(), so routers on the two networks can be told apart
+	 */
+	const char* GetNetworkPrefix()
+	{ return m_network ? "dma:" : ""; }
+	unsigned int GetPortNumber(SimNode* node);
+
+	/**
+		@brief Get the output port for a destination address, from the routing tables
+	 */
+	unsigned int GetPortNumber(uint16_t addr)
+	{
+		if( (addr >= m_subnetLow) && (addr <= m_subnetHigh) )
+			return m_childRoutes[(addr - m_subnetLow) / m_childBlockSize];
+		return m_routes[addr / m_routeBlockSize];
+	}
+
+	/**
+		@brief Get the node attached to a port, or NULL if nothing is there
+	 */
+	virtual SimNode* GetPortNode(unsigned int port) =0;
+
+	/**
+		@brief Get the list of output ports a packet may legally take, in order of preference.
+
+		Deterministic routers only return one. Adaptive routers return several, and the switch allocator picks the
+		least congested one that's free.
+	 */
+	virtual void GetRouteCandidates(const NOCPacket& packet, std::vector<unsigned int>& ports)
+	{ ports.push_back(GetPortNumber(packet.m_to)); }
+
+	/**
+		@brief A packet in (or arriving into) one of our input FIFOs
+	 */
+	struct InputPacket
+	{
+		NOCPacket m_packet;
+
+		//Length of the packet in flits
+		unsigned int m_flits;
+
+		//FIFO space (in flits) available to the packet when the head arrived
+		unsigned int m_space;
+
+		//Time the head flit arrived
+		unsigned int m_headTime;
+
+		//Time the tail flit arrives (NEVER if we don't know yet, because the packet stalled upstream)
+		unsigned int m_tailTime;
+
+		//Earliest time the packet can be forwarded (the header has been received and routed)
+		unsigned int m_routeTime;
+
+		//Time the head flit was forwarded (NEVER if still waiting)
+		unsigned int m_sendTime;
+
+		//Time the tail flit leaves (NEVER if not forwarded, or the outgoing transfer stalled)
+		unsigned int m_leaveTime;
+
+		//True if we've given the credits for this packet back to the sender
+		bool m_creditsReturned;
+
+		//Pool index of the next packet in the same FIFO (or the next free slot), NEVER if none
+		unsigned int m_next;
+	};
+
+	/**
+		@brief Index of a virtual channel on a port, into the per-channel vectors
+	 */
+	unsigned int GetChannel(unsigned int port, unsigned int vc)
+	{ return port*m_vcCount + vc; }
+
+	InputPacket* GetReadyPacket(unsigned int chan);
+	bool SelectOutput(InputPacket& p, unsigned int& outport, unsigned int& outvc);
+	unsigned int GetRetryTime(InputPacket& p);
+	void Forward(unsigned int inchan, unsigned int outport, unsigned int outvc);
+	void DropPacket(unsigned int inchan);
+	void FinishInput(unsigned int inchan, InputPacket& p, unsigned int leaveTime);
+	unsigned int GetFreeSpace(unsigned int chan);
+	void RetirePackets(unsigned int chan);
+	unsigned int AllocatePacket();
+	void FreePacket(unsigned int index);
+
+	//Total number of ports (children plus links to other routers)
+	unsigned int m_portCount;
+
+	//Number of virtual channels on each port
+	unsigned int m_vcCount;
+
+	//Storage for every packet in any of our input FIFOs. Each FIFO is a singly linked list through m_next, and
+	//retired slots go on a free list, so once the pool has grown to the router's peak occupancy nothing is allocated.
+	//Slots are addressed by index since the pool can move when it grows (only ever in AcceptMessage()).
+	std::vector<InputPacket> m_packetPool;
+	unsigned int m_freePacket;
+
+	//Input FIFOs, one per virtual channel (see GetChannel()), as pool indexes (NEVER if none).
+	//Packets that have already been forwarded stay in the FIFO until their tail leaves.
+	//m_fifoWaiting is the first packet that hasn't been forwarded, m_fifoPrev the one in front of it (if not retired)
+	std::vector<unsigned int> m_fifoHead;
+	std::vector<unsigned int> m_fifoTail;
+	std::vector<unsigned int> m_fifoWaiting;
+	std::vector<unsigned int> m_fifoPrev;
+
+	//First cycle each input port can start moving another packet through the crossbar
+	std::vector<unsigned int> m_inputFreeTime;
+
+	//First cycle each output link is free again
+	std::vector<unsigned int> m_outboxFreeTime;
+
+	//First cycle each output virtual channel is free again (NEVER if the transfer is stalled)
+	std::vector<unsigned int> m_vcFreeTime;
+
+	//Flow control credits (free flits in the FIFO on the far end) for each output virtual channel.
+	//Can go negative while a wormhole transfer is stalled
+	std::vector<int> m_credits;
+
+	//Number of packets sent on each output virtual channel that we haven't had credits back for
+	std::vector<unsigned int> m_creditsOutstanding;
+
+	//Time each output port started waiting for credits (NEVER if not waiting)
+	std::vector<unsigned int> m_creditWaitStart;
+
+	//For each output virtual channel with a stalled transfer: the input channel it's coming from, and when it would
+	//have finished
+	std::vector<unsigned int> m_stalledInput;
+	std::vector<unsigned int> m_stallStart;
+
+	//Switch allocator round-robin pointers: next VC each input looks at first, and next input each output grants
+	std::vector<unsigned int> m_inputPointer;
+	std::vector<unsigned int> m_outputPointer;
+
+	//Scratch space for the allocator, so we don't reallocate every cycle
+	std::vector<unsigned int> m_requestPort;
+	std::vector<unsigned int> m_requestChannel;
+	std::vector<unsigned int> m_requestVC;
+	std::vector<unsigned int> m_candidates;
+
+	void RecordTransmit(unsigned int port, unsigned int cycles);
+	void RecordReceive(unsigned int port, unsigned int cycles);
+	void RecordInboxOccupancy(unsigned int port, unsigned int cycles);
+
+	void FillLinkStats(LinkStats& stats, unsigned int port);
+
+	//Render helpers
+	static double GetUtilization(unsigned long busy);
+	static std::string GetHeatColor(double utilization);
+	double GetRouterUtilization();
+	void RenderHeatNode(FILE* fp);
+	void RenderHeatLink(FILE* fp, xypos peer, unsigned int port);
+
+	//Per-port utilization counters
+	std::vector<unsigned long> m_txBusyCycles;
+	std::vector<unsigned long> m_rxBusyCycles;
+	std::vector<unsigned long> m_inboxCycles;
+	std::vector<unsigned long> m_creditStallCycles;
+	std::vector<unsigned long> m_blockedCycles;
+
 	//Addresses of nodes/routers under us
 	uint16_t m_subnetLow;
 	uint16_t m_subnetHigh;
+
+	//Network we're part of
+	unsigned int m_network;
+
+	//Node attached to each port (filled in as nodes are connected, so finding a sender's port doesn't need RTTI).
+	//There's only a handful of ports, so a linear search of this beats anything fancier
+	std::vector<SimNode*> m_portNodes;
+
+	//Routing tables, filled in by the topology at setup time (and optionally overridden by ones from the RTL).
+	//Addresses in our subnet are looked up in m_childRoutes, in blocks of m_childBlockSize addresses starting at
+	//m_subnetLow. Everything else is looked up in m_routes, in blocks of m_routeBlockSize addresses starting at zero.
+	std::vector<unsigned int> m_childRoutes;
+	unsigned int m_childBlockSize;
+	std::vector<unsigned int> m_routes;
+	unsigned int m_routeBlockSize;
 };
 
 #endif
-
@@ -0,0 +1,85 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief On-disk format for packet traces
+ */
+#ifndef PacketTrace_h
+#define PacketTrace_h
+
+/*
+	A trace file is a PacketTraceHeader followed by m_recordCount PacketTraceRecords, sorted by time. Everything is
+	little endian and naturally aligned, so a trace can be mapped into memory and used in place.
+
+	Traces written by the simulator hold every packet that reached its destination, stamped with the time it was sent
+	and how long it took to arrive. Packets one host sent in the same cycle are in the order it sent them.
+	Captures from hardware should do the same: requests and their replies are both recorded, and replaying a trace
+	doesn't generate any new replies.
+ */
+
+//"NOCTRACE", without the null terminator
+static const char g_packetTraceMagic[8] = {'N', 'O', 'C', 'T', 'R', 'A', 'C', 'E'};
+
+static const uint32_t PACKET_TRACE_VERSION = 2;
+
+struct PacketTraceHeader
+{
+	char m_magic[8];
+	uint32_t m_version;
+
+	//Size of one record, in bytes (so later versions can append fields)
+	uint32_t m_recordSize;
+
+	uint64_t m_recordCount;
+};
+
+struct PacketTraceRecord
+{
+	//Cycle the packet was sent
+	uint32_t m_time;
+
+	uint16_t m_from;
+	uint16_t m_to;
+
+	//Packet length, and the length of the reply requested by a DMA read, in 32-bit words
+	uint16_t m_size;
+	uint16_t m_replySize;
+
+	//A NOCPacket::msgType
+	uint8_t m_type;
+
+	uint8_t m_reserved[3];
+
+	//Cycles from being sent to reaching the destination (0 if not known). Replay checks it gets the same result
+	uint32_t m_latency;
+};
+
+#endif
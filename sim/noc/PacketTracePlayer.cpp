@@ -0,0 +1,290 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Injects packets from a trace file
+ */
+
+#include "nocsim.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+//The active trace player (NULL if we're not replaying)
+PacketTracePlayer* g_tracePlayer = NULL;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+/**
+	@brief Creates the player. The network must be created first, so we can find the hosts.
+ */
+PacketTracePlayer::PacketTracePlayer(const vector<SimNode*>& nodes)
+	: SimNode(xypos(0, 0))
+	, m_fd(-1)
+	, m_map(MAP_FAILED)
+	, m_mapSize(0)
+	, m_records(NULL)
+	, m_recordSize(0)
+	, m_recordCount(0)
+	, m_next(0)
+	, m_hosts(g_hostCount, NULL)
+	, m_packetsInjected(0)
+	, m_packetsSkipped(0)
+	, m_latencyMatched(0)
+	, m_latencyDiffered(0)
+{
+	for(auto n : nodes)
+	{
+		auto host = dynamic_cast<NOCHost*>(n);
+		if(host && (host->GetAddress() < g_hostCount) )
+			m_hosts[host->GetAddress()] = host;
+	}
+}
+
+PacketTracePlayer::~PacketTracePlayer()
+{
+	if(m_map != MAP_FAILED)
+		munmap(m_map, m_mapSize);
+	if(m_fd >= 0)
+		close(m_fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// File I/O
+
+/**
+	@brief Map the trace file, check the header, and schedule the first packet
+ */
+bool PacketTracePlayer::Open(string path)
+{
+	m_path = path;
+	m_fd = open(path.c_str(), O_RDONLY);
+	if(m_fd < 0)
+	{
+		LogError("Couldn't open %s\n", path.c_str());
+		return false;
+	}
+
+	struct stat st;
+	if( (0 != fstat(m_fd, &st)) || (st.st_size < (off_t)sizeof(PacketTraceHeader)) )
+	{
+		LogError("%s is too small to be a packet trace\n", path.c_str());
+		return false;
+	}
+
+	m_mapSize = st.st_size;
+	m_map = mmap(NULL, m_mapSize, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if(m_map == MAP_FAILED)
+	{
+		LogError("Couldn't map %s\n", path.c_str());
+		return false;
+	}
+
+	//We only ever go through it once, front to back
+	madvise(m_map, m_mapSize, MADV_SEQUENTIAL);
+
+	auto header = reinterpret_cast<const PacketTraceHeader*>(m_map);
+	if(0 != memcmp(header->m_magic, g_packetTraceMagic, sizeof(header->m_magic)))
+	{
+		LogError("%s is not a packet trace (bad magic)\n", path.c_str());
+		return false;
+	}
+	if(header->m_version != PACKET_TRACE_VERSION)
+	{
+		LogError("%s is a version %u packet trace, we only support version %u\n",
+			path.c_str(), header->m_version, PACKET_TRACE_VERSION);
+		return false;
+	}
+	if(header->m_recordSize < sizeof(PacketTraceRecord))
+	{
+		LogError("%s has %u-byte records, too small for a packet trace\n", path.c_str(), header->m_recordSize);
+		return false;
+	}
+
+	m_recordSize = header->m_recordSize;
+	m_recordCount = header->m_recordCount;
+	m_records = reinterpret_cast<const uint8_t*>(m_map) + sizeof(PacketTraceHeader);
+	if( (m_mapSize - sizeof(PacketTraceHeader)) / m_recordSize < m_recordCount)
+	{
+		LogError("%s is truncated (header says %lu records)\n", path.c_str(), (unsigned long)m_recordCount);
+		return false;
+	}
+
+	LogNotice("Replaying %lu packets from trace %s\n", (unsigned long)m_recordCount, path.c_str());
+	if(m_recordCount)
+		Wakeup(GetRecord(0)->m_time);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Rendering
+
+void PacketTracePlayer::ExpandBoundingBox(unsigned int& /*width*/, unsigned int& /*height*/)
+{
+	//not part of the network, nothing to draw
+}
+
+void PacketTracePlayer::RenderSVGNodes(FILE* /*fp*/)
+{
+}
+
+void PacketTracePlayer::RenderSVGLines(FILE* /*fp*/)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Simulation
+
+bool PacketTracePlayer::AcceptMessage(NOCPacket /*packet*/, SimNode* /*from*/)
+{
+	//Nothing is ever sent to us
+	return false;
+}
+
+/**
+	@brief Hand every packet due this cycle to its source host, then sleep until the next one
+ */
+void PacketTracePlayer::Timestep()
+{
+	while(m_next < m_recordCount)
+	{
+		auto rec = GetRecord(m_next);
+		if(rec->m_time > g_time)
+			break;
+		m_next ++;
+
+		//Out of order records go out late rather than never
+		if(rec->m_time < g_time)
+		{
+			LogWarning("[%5u] Trace record %lu is out of order (time %u)\n",
+				g_time, (unsigned long)(m_next - 1), rec->m_time);
+		}
+
+		//Skip anything that doesn't fit the network we're simulating
+		if( (rec->m_from >= g_hostCount) || (m_hosts[rec->m_from] == NULL) ||
+			(rec->m_to >= g_hostCount) || (rec->m_type >= NOCPacket::TYPE_COUNT) )
+		{
+			m_packetsSkipped ++;
+			continue;
+		}
+
+		NOCPacket packet(
+			rec->m_from,
+			rec->m_to,
+			rec->m_size,
+			static_cast<NOCPacket::msgType>(rec->m_type),
+			rec->m_replySize);
+		packet.m_replayed = true;
+
+		//Nobody replies to a replayed packet, so the tag is free to say which record it came from
+		packet.m_tag = m_next - 1;
+
+		//The host picks this up in the commit phase and sends it
+		SendMessage(m_hosts[rec->m_from], packet);
+		m_packetsInjected ++;
+	}
+
+	if(m_next < m_recordCount)
+		Wakeup(GetRecord(m_next)->m_time);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Statistics
+
+void PacketTracePlayer::PrintStats()
+{
+	LogDebug("[Trace] Replay of %s:\n", m_path.c_str());
+	LogIndenter li;
+	LogDebug("Injected                 : %5lu packets\n", m_packetsInjected);
+	if(m_packetsSkipped)
+		LogWarning("Skipped                  : %5lu packets (not valid for this network)\n", m_packetsSkipped);
+	if(m_next < m_recordCount)
+	{
+		LogDebug("Not reached              : %5lu packets (trace runs until cycle %u)\n",
+			(unsigned long)(m_recordCount - m_next), GetRecord(m_recordCount - 1)->m_time);
+	}
+	if(m_latencyMatched)
+		LogDebug("Latency as recorded      : %5lu packets\n", m_latencyMatched);
+	if(m_latencyDiffered)
+		LogWarning("Latency not as recorded  : %5lu packets\n", m_latencyDiffered);
+}
+
+/**
+	@brief Called (with the packet stats lock held) when a replayed packet reaches its destination
+ */
+void PacketTracePlayer::PacketDelivered(const NOCPacket& packet, unsigned int latency)
+{
+	auto rec = GetRecord(packet.m_tag);
+	if(rec->m_latency == 0)
+		return;
+
+	if(rec->m_latency == latency)
+		m_latencyMatched ++;
+	else
+	{
+		m_latencyDiffered ++;
+		LogDebug("[%5u] Trace record %u (%s from %04x to %04x) took %u cycles, %u in the trace\n",
+			g_time, packet.m_tag, NOCPacket::GetTypeName(packet.m_type), packet.m_from, packet.m_to,
+			latency, rec->m_latency);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpointing
+
+void PacketTracePlayer::SaveState(SimSnapshot& snap)
+{
+	SimNode::SaveState(snap);
+	snap.Write(m_next);
+	snap.Write(m_packetsInjected);
+	snap.Write(m_packetsSkipped);
+	snap.Write(m_latencyMatched);
+	snap.Write(m_latencyDiffered);
+}
+
+void PacketTracePlayer::LoadState(SimSnapshot& snap)
+{
+	SimNode::LoadState(snap);
+	snap.Read(m_next);
+	snap.Read(m_packetsInjected);
+	snap.Read(m_packetsSkipped);
+	snap.Read(m_latencyMatched);
+	snap.Read(m_latencyDiffered);
+
+	//Snapshot taken while replaying a different trace?
+	if(m_next > m_recordCount)
+		snap.Fail();
+}
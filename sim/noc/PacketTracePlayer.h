@@ -0,0 +1,106 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Injects packets from a trace file
+ */
+#ifndef PacketTracePlayer_h
+#define PacketTracePlayer_h
+
+class NOCHost;
+
+/**
+	@brief Replays a trace file (see PacketTrace.h) against the simulated network.
+
+	The trace is mapped into memory and read sequentially. We wake up at each record's timestamp and hand the
+	packet to its source host, which sends it as soon as its link is free. Replayed packets are flagged so their
+	destinations don't reply (the replies are in the trace too).
+
+	When a replayed packet arrives, its latency is checked against the one in the trace. Replaying a trace the
+	simulator recorded, on the same network, should give every packet the same latency. The exception is a run that
+	ended with packets still in flight: they aren't in the trace, so the replayed network is less loaded.
+ */
+class PacketTracePlayer : public SimNode
+{
+public:
+	PacketTracePlayer(const std::vector<SimNode*>& nodes);
+	virtual ~PacketTracePlayer();
+
+	bool Open(std::string path);
+
+	virtual bool AcceptMessage(NOCPacket packet, SimNode* from);
+	virtual void Timestep();
+
+	virtual void ExpandBoundingBox(unsigned int& width, unsigned int& height);
+	virtual void RenderSVGNodes(FILE* fp);
+	virtual void RenderSVGLines(FILE* fp);
+
+	virtual void PrintStats();
+
+	void PacketDelivered(const NOCPacket& packet, unsigned int latency);
+
+	virtual void SaveState(SimSnapshot& snap);
+	virtual void LoadState(SimSnapshot& snap);
+
+protected:
+	const PacketTraceRecord* GetRecord(uint64_t i)
+	{ return reinterpret_cast<const PacketTraceRecord*>(m_records + i*m_recordSize); }
+
+	std::string m_path;
+
+	//The mapped file
+	int m_fd;
+	void* m_map;
+	size_t m_mapSize;
+
+	//Start of the record array, and the size of each record
+	const uint8_t* m_records;
+	uint32_t m_recordSize;
+	uint64_t m_recordCount;
+
+	//Index of the next record to inject
+	uint64_t m_next;
+
+	//Source host for each address (NULL if the address isn't a host)
+	std::vector<NOCHost*> m_hosts;
+
+	//Statistics
+	unsigned long m_packetsInjected;
+	unsigned long m_packetsSkipped;
+
+	//Delivered packets whose latency did and didn't match the trace
+	unsigned long m_latencyMatched;
+	unsigned long m_latencyDiffered;
+};
+
+extern PacketTracePlayer* g_tracePlayer;
+
+#endif
@@ -0,0 +1,131 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Records delivered packets to a trace file
+ */
+
+#include "nocsim.h"
+#include <algorithm>
+#include <string.h>
+
+using namespace std;
+
+//The active trace writer (NULL if we're not recording)
+PacketTraceWriter* g_traceWriter = NULL;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+PacketTraceWriter::PacketTraceWriter()
+	: m_fp(NULL)
+{
+}
+
+PacketTraceWriter::~PacketTraceWriter()
+{
+	Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// File I/O
+
+bool PacketTraceWriter::Open(string path)
+{
+	m_path = path;
+	m_fp = fopen(path.c_str(), "wb");
+	if(!m_fp)
+	{
+		LogError("Couldn't open %s\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+/**
+	@brief Called (with the packet stats lock held) when a packet reaches its destination
+ */
+void PacketTraceWriter::Record(const NOCPacket& packet)
+{
+	PacketTraceRecord rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.m_time = packet.m_timeSent;
+	rec.m_from = packet.m_from;
+	rec.m_to = packet.m_to;
+	rec.m_size = packet.m_size;
+	rec.m_replySize = packet.m_replysize;
+	rec.m_type = packet.m_type;
+	rec.m_latency = g_time - packet.m_timeSent;
+	m_records.push_back(pair<unsigned int, PacketTraceRecord>(packet.m_seq, rec));
+}
+
+/**
+	@brief Sort the records and write them out
+ */
+bool PacketTraceWriter::Close()
+{
+	if(!m_fp)
+		return true;
+
+	//Each host's packets have unique sequence numbers, so this is a total order
+	typedef pair<unsigned int, PacketTraceRecord> entry;
+	sort(m_records.begin(), m_records.end(), [](const entry& a, const entry& b)
+		{
+			if(a.second.m_time != b.second.m_time)
+				return a.second.m_time < b.second.m_time;
+			if(a.second.m_from != b.second.m_from)
+				return a.second.m_from < b.second.m_from;
+			return a.first < b.first;
+		});
+
+	PacketTraceHeader header;
+	memcpy(header.m_magic, g_packetTraceMagic, sizeof(header.m_magic));
+	header.m_version = PACKET_TRACE_VERSION;
+	header.m_recordSize = sizeof(PacketTraceRecord);
+	header.m_recordCount = m_records.size();
+
+	bool ok = (1 == fwrite(&header, sizeof(header), 1, m_fp));
+	for(size_t i=0; ok && (i < m_records.size()); i++)
+		ok = (1 == fwrite(&m_records[i].second, sizeof(PacketTraceRecord), 1, m_fp));
+	if(0 != fclose(m_fp))
+		ok = false;
+	m_fp = NULL;
+
+	if(!ok)
+	{
+		LogError("Couldn't write trace to %s\n", m_path.c_str());
+		return false;
+	}
+
+	LogNotice("Wrote %zu packets to trace %s\n", m_records.size(), m_path.c_str());
+	m_records.clear();
+	return true;
+}
@@ -36,33 +36,39 @@
 #include "nocsim.h"
 #include <math.h>
 
+using namespace std;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
 
-QuadtreeRouter::QuadtreeRouter(QuadtreeRouter* parent, uint16_t low, uint16_t high, uint16_t mask, xypos pos)
-	: NOCRouter(low, high, pos)
+QuadtreeRouter::QuadtreeRouter(
+	QuadtreeRouter* parent,
+	uint16_t low,
+	uint16_t high,
+	uint16_t mask,
+	unsigned int radix,
+	xypos pos)
+	: NOCRouter(low, high, radix + 1, pos)
 	, m_subnetMask(mask)
+	, m_radix(radix)
 	, m_parentRouter(parent)
+	, m_children(radix, NULL)
 {
-	if(m_parentRouter)
-		m_parentRouter->AddChild(this);
+	unsigned int size = GetSubnetSize();
+	m_portShift = log2(size) - log2(radix);
+
+	//Each child port gets an equal share of our subnet, and anything outside it goes up
+	m_childBlockSize = size / radix;
+	for(unsigned int i=0; i<radix; i++)
+		m_childRoutes.push_back(i);
+	m_routeBlockSize = 0x10000;
+	m_routes.push_back(m_radix);
 
-	for(int i=0; i<4; i++)
-		m_children[i] = NULL;
-	for(int i=0; i<5; i++)
+	if(m_parentRouter)
 	{
-		m_outboxBlocked[i] = false;
-		m_inboxValid[i] = false;
-		m_inboxForwardTime[i] = 0;
-		m_outboxClearTime[i] = 0;
+		ConnectPort(m_radix, m_parentRouter);
+		m_parentRouter->AddChild(this);
 	}
-
-	unsigned int size = GetSubnetSize();
-	uint16_t childMask = 0xffff & ~( (size/4) - 1);
-	m_portMask = childMask & ~mask;
-	m_portShift = log2(size) - 2;
-
-	m_rrcount = 0;
 }
 
 QuadtreeRouter::~QuadtreeRouter()
@@ -71,10 +77,26 @@ QuadtreeRouter::~QuadtreeRouter()
 
 void QuadtreeRouter::AddChild(SimNode* child)
 {
-	unsigned int port = GetPortNumber(child);
+	//Find an address under the child (any one will do for a router, so use the middle of its subnet)
+	auto router = dynamic_cast<QuadtreeRouter*>(child);
+	auto host = dynamic_cast<NOCHost*>(child);
+	uint16_t addr = 0;
+	if(router)
+		addr = (router->m_subnetLow + router->m_subnetHigh)/2;
+	else if(host)
+		addr = host->GetAddress();
+	else
+	{
+		LogWarning("Can't add child (not a quadtree router or host)\n");
+		return;
+	}
 
-	if( port <= 3 )
+	unsigned int port = GetPortNumber(addr);
+	if( port < m_radix )
+	{
 		m_children[port] = child;
+		ConnectPort(port, child);
+	}
 
 	else
 		LogWarning("Can't add child (invalid address)\n");
@@ -85,8 +107,9 @@ void QuadtreeRouter::AddChild(SimNode* child)
 
 void QuadtreeRouter::ExpandBoundingBox(unsigned int& width, unsigned int& height)
 {
+	//Leave room for the node to grow when rendered with a high utilization
 	const unsigned int nodesize = 10;
-	const unsigned int radius = nodesize / 2;
+	const unsigned int radius = nodesize;
 	const unsigned int right = m_renderPosition.first + radius;
 	const unsigned int bottom = m_renderPosition.second + radius;
 
@@ -98,162 +121,76 @@ void QuadtreeRouter::ExpandBoundingBox(unsigned int& width, unsigned int& height
 
 void QuadtreeRouter::RenderSVGNodes(FILE* fp)
 {
-	const unsigned int nodesize = 10;
-	const unsigned int radius = nodesize / 2;
-
-	fprintf(
-		fp,
-		"<circle cx=\"%u\" cy=\"%u\" r=\"%u\" stroke=\"green\" stroke-width=\"1\" fill=\"white\"/>\n",
-		m_renderPosition.first,
-		m_renderPosition.second,
-		radius);
+	RenderHeatNode(fp);
 }
 
 void QuadtreeRouter::RenderSVGLines(FILE* fp)
 {
-	for(int i=0; i<4; i++)
+	//Each router draws the links to its children, so every link is drawn exactly once
+	for(unsigned int i=0; i<m_radix; i++)
 	{
 		auto c = m_children[i];
-		fprintf(fp,
-			"<line x1=\"%u\" y1=\"%u\" x2=\"%u\" y2=\"%u\" stroke=\"blue\" stroke-width=\"1\" />\n",
-			c->m_renderPosition.first,
-			c->m_renderPosition.second,
-			m_renderPosition.first,
-			m_renderPosition.second);
+		if(c == NULL)	//null children are legal if the host count isn't a power of the radix
+			continue;
+		RenderHeatLink(fp, c->m_renderPosition, i);
 	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// Simulation
+// Statistics
 
-/**
-	@brief See which port a given node is attached to
- */
-unsigned int QuadtreeRouter::GetPortNumber(SimNode* node)
+string QuadtreeRouter::GetName()
 {
-	auto router = dynamic_cast<QuadtreeRouter*>(node);
-	auto host = dynamic_cast<NOCHost*>(node);
-
-	//Figure out the base address of our target node
-	uint16_t addr = 0;
-	if(router)
-		addr = (router->m_subnetLow + router->m_subnetHigh)/2;
-
-	else if(host)
-		addr = host->GetAddress();
-
-	else
-	{
-		LogError("Invalid sim node (not a quadtree router or host)\n");
-		return 4;
-	}
-
-	return GetPortNumber(addr);
-}
-
-/**
-	@brief See which port a given address is attached to
- */
-unsigned int QuadtreeRouter::GetPortNumber(uint16_t addr)
-{
-	//Not in our subnet? Go up
-	if( (addr & m_subnetMask) != m_subnetLow)
-		return 4;
-
-	return (addr & m_portMask) >> m_portShift;
+	char name[32];
+	snprintf(name, sizeof(name), "%s%04x/%d", GetNetworkPrefix(), m_subnetLow, 16 - m_portShift);
+	return name;
 }
 
-bool QuadtreeRouter::AcceptMessage(NOCPacket packet, SimNode* from)
+void QuadtreeRouter::GetLinkStats(vector<LinkStats>& stats)
 {
-	unsigned int srcport = GetPortNumber(from);
-
-	//If inbox is already full, reject it!
-	if(m_inboxValid[srcport])
-	{
-		LogError(
-			"[%5u] QuadtreeRouter %04x/%d: rejecting %d-word message from %04x to %04x (on port %d): bus fight!\n",
-			g_time, m_subnetLow, 16 - m_portShift, packet.m_size, packet.m_from, packet.m_to, srcport);
-		return false;
-	}
-
-	//We're good, accept it
-	//LogDebug("[%5u] QuadtreeRouter %04x/%d: accepting %d-word message from %04x to %04x (on port %d)\n",
-	//	g_time, m_subnetLow, 16 - m_portShift, packet.m_size, packet.m_from, packet.m_to, srcport);
-	m_inboxes[srcport] = packet;
-	m_inboxValid[srcport] = true;
-	m_inboxForwardTime[srcport] = g_time + 4;	//4 cycle forwarding latency assuming 32-bit bus width
-	return true;
-}
-
-void QuadtreeRouter::Timestep()
-{
-	//Clear any outboxes that became available this clock
-	for(int i=0; i<5; i++)
+	char name[32];
+	for(unsigned int i=0; i<m_radix; i++)
 	{
-		if(m_outboxBlocked[i] && (m_outboxClearTime[i] < g_time) )
-			m_outboxBlocked[i] = false;
+		auto c = m_children[i];
+		if(c == NULL)
+			continue;
+
+		LinkStats s;
+		FillLinkStats(s, i);
+		snprintf(name, sizeof(name), "child%u", i);
+		s.m_port = name;
+
+		auto router = dynamic_cast<NOCRouter*>(c);
+		if(router)
+			s.m_peer = router->GetName();
+		else
+		{
+			snprintf(name, sizeof(name), "%04x", static_cast<NOCHost*>(c)->GetAddress());
+			s.m_peer = name;
+		}
+
+		stats.push_back(s);
 	}
 
-	//Try forwarding from our round-robin winner first, they always have first priority
-	if(TryForwardFrom(m_rrcount))
-		m_rrcount = (m_rrcount + 1);
-
-	//Try forwarding from every other port
-	for(int i=0; i<5; i++)
+	if(m_parentRouter)
 	{
-		if(TryForwardFrom(i))
-			m_rrcount = (m_rrcount + 1) % 5;
+		LinkStats s;
+		FillLinkStats(s, m_radix);
+		s.m_port = "parent";
+		s.m_peer = m_parentRouter->GetName();
+		stats.push_back(s);
 	}
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Simulation
+
 /**
-	@brief Try forwarding the message located in the specified port's inbox (if present)
+	@brief Get the node on the far end of a port
  */
-bool QuadtreeRouter::TryForwardFrom(unsigned int nport)
+SimNode* QuadtreeRouter::GetPortNode(unsigned int port)
 {
-	//If inbox is empty, nothing to do
-	if(!m_inboxValid[nport])
-		return false;
-
-	//If we're still receiving this packet, nothing to do
-	if(m_inboxForwardTime[nport] > g_time)
-		return false;
-
-	auto& packet = m_inboxes[nport];
-
-	//Packet is forwardable. See where it goes.
-	unsigned int dstaddr = m_inboxes[nport].m_to;
-	unsigned int dstport = GetPortNumber(dstaddr);
-
-	//If the destination port is currently occupied, we can't do anything this cycle
-	if(m_outboxBlocked[dstport])
-		return false;
-
-	//If message is unforwardable, drop it
-	if( (dstport == 4) && (m_parentRouter == NULL) )
-	{
-		LogDebug("[%5u] QuadtreeRouter %04x/%d: cannot forward message to %d: address isn't in root subnet!\n",
-			g_time, m_subnetLow, 16 - m_portShift, packet.m_to);
-		m_inboxValid[nport] = false;
-		return false;
-	}
-
-	//Forward the packet
-	//TODO: allow empty/NULL child ports?
-	//LogDebug("[%5u] QuadtreeRouter %04x/%d: forwarding %d-word message from %04x to %04x (out port %d)\n",
-	//	g_time, m_subnetLow, 16 - m_portShift, packet.m_size, packet.m_from, packet.m_to, dstport);
-	if(dstport == 4)
-		m_parentRouter->AcceptMessage(packet, this);
-	else if(m_children[dstport])
-		m_children[dstport]->AcceptMessage(packet, this);
-	else
-		LogError("child port %d is NULL\n", dstport);
-
-	//Output port is busy for the next 4 clocks
-	m_outboxBlocked[dstport] = true;
-	m_outboxClearTime[dstport] = g_time + 4;
-
-	//Inbox is now available
-	m_inboxValid[nport] = false;
-	return true;
+	if(port == m_radix)
+		return m_parentRouter;
+	return m_children[port];
 }
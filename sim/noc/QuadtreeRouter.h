@@ -43,13 +43,13 @@ public:
 		uint16_t low,
 		uint16_t high,
 		uint16_t mask,
+		unsigned int radix,
 		xypos pos);
 	virtual ~QuadtreeRouter();
 
-	virtual bool AcceptMessage(NOCPacket packet, SimNode* from);
-	virtual void Timestep();
-
 	virtual void AddChild(SimNode* child);
+	virtual void GetLinkStats(std::vector<LinkStats>& stats);
+	virtual std::string GetName();
 
 	virtual void ExpandBoundingBox(unsigned int& width, unsigned int& height);
 	virtual void RenderSVGNodes(FILE* fp);
@@ -57,28 +57,15 @@ public:
 
 protected:
 	uint16_t m_subnetMask;
-	uint16_t m_portMask;
 	unsigned int m_portShift;
 
-	unsigned int GetPortNumber(SimNode* node);
-	unsigned int GetPortNumber(uint16_t addr);
+	//Number of child ports (must be a power of two). The parent port is numbered m_radix
+	unsigned int m_radix;
 
-	bool TryForwardFrom(unsigned int nport);
+	virtual SimNode* GetPortNode(unsigned int port);
 
 	QuadtreeRouter* m_parentRouter;
-	SimNode* m_children[4];
-
-	//Incoming messages (not yet forwarded)
-	NOCPacket m_inboxes[5];
-	bool m_inboxValid[5];
-	unsigned int m_inboxForwardTime[5];
-
-	//Outgoing messages
-	bool m_outboxBlocked[5];
-	unsigned int m_outboxClearTime[5];
-
-	//Round-robin counter
-	unsigned int m_rrcount;
+	std::vector<SimNode*> m_children;
 };
 
 #endif
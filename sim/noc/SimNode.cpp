@@ -35,12 +35,16 @@
 
 #include "nocsim.h"
 
+unsigned int SimNode::m_nextId = 0;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
 
 SimNode::SimNode(xypos pos)
 	: m_renderPosition(pos)
-
+	, m_id(m_nextId ++)
+	, m_lastTimestep(0xffffffff)
+	, m_lastWakeupRequest(0xffffffff)
 {
 }
 
@@ -51,6 +55,41 @@ SimNode::~SimNode()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Simulation
 
+void SimNode::Wakeup(unsigned int time)
+{
+	g_scheduler.Wakeup(this, time);
+}
+
+void SimNode::SendMessage(SimNode* to, const NOCPacket& packet)
+{
+	g_scheduler.SendMessage(this, to, packet);
+}
+
+void SimNode::ReturnCredits(SimNode* to, unsigned int credits, unsigned int tailTime, unsigned int vc)
+{
+	g_scheduler.ReturnCredits(this, to, credits, tailTime, vc);
+}
+
+void SimNode::AcceptCredits(
+	SimNode* /*from*/, unsigned int /*credits*/, unsigned int /*tailTime*/, unsigned int /*vc*/)
+{
+}
+
 void SimNode::PrintStats()
 {
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpointing
+
+void SimNode::SaveState(SimSnapshot& snap)
+{
+	snap.Write(m_lastTimestep);
+	snap.Write(m_lastWakeupRequest);
+}
+
+void SimNode::LoadState(SimSnapshot& snap)
+{
+	snap.Read(m_lastTimestep);
+	snap.Read(m_lastWakeupRequest);
+}
@@ -43,9 +43,37 @@ public:
 	SimNode(xypos pos);
 	virtual ~SimNode();
 
+	/**
+		@brief Ask the scheduler to call our Timestep() at the specified time
+	 */
+	void Wakeup(unsigned int time);
+
+	/**
+		@brief Send a message to another node.
+
+		Delivery (the receiver's AcceptMessage() call) happens in the commit phase at the end of the current cycle,
+		so nodes never touch each other's state from inside Timestep().
+	 */
+	void SendMessage(SimNode* to, const NOCPacket& packet);
+
+	/**
+		@brief Give the flow control credits for a packet back to the node that sent it.
+
+		Credits are returned in the order packets arrived on each virtual channel. tailTime is the cycle the tail of
+		the packet arrived, so if the sender's transfer stalled because the packet didn't fit (wormhole switching only)
+		it knows when its link freed up.
+	 */
+	void ReturnCredits(SimNode* to, unsigned int credits, unsigned int tailTime, unsigned int vc);
+
+	//Placeholder for times that haven't happened (or won't)
+	static const unsigned int NEVER = 0xffffffff;
+
 	//All sim nodes are able to accept messages, whether nodes or routers
 	virtual bool AcceptMessage(NOCPacket packet, SimNode* from) =0;
 
+	//Flow control credits coming back from a node we sent a packet to
+	virtual void AcceptCredits(SimNode* from, unsigned int credits, unsigned int tailTime, unsigned int vc);
+
 	//Process events occuring in one simulated clock cycle
 	virtual void Timestep() = 0;
 
@@ -60,6 +88,22 @@ public:
 	xypos m_renderPosition;
 
 	virtual void PrintStats();
+
+	//Checkpointing: save or restore everything that changes during the simulation (see SimSnapshot)
+	virtual void SaveState(SimSnapshot& snap);
+	virtual void LoadState(SimSnapshot& snap);
+
+	//Unique ID of this node (creation order, used to make event ordering deterministic)
+	unsigned int m_id;
+
+	//Time of the last Timestep() call, used by the scheduler to squash duplicate wakeups
+	unsigned int m_lastTimestep;
+
+	//Time of the most recent wakeup request, used by the scheduler to squash duplicate wakeups
+	unsigned int m_lastWakeupRequest;
+
+protected:
+	static unsigned int m_nextId;
 };
 
 #endif
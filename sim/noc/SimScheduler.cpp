@@ -0,0 +1,370 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Discrete-event scheduler for the simulation
+ */
+
+#include "nocsim.h"
+
+using namespace std;
+
+SimScheduler g_scheduler;
+
+thread_local SimScheduler::StagingBuffer* SimScheduler::m_threadStaging = NULL;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+SimScheduler::SimScheduler()
+	: m_partitionCount(1)
+	, m_threadCount(1)
+	, m_generation(0)
+	, m_busyWorkers(0)
+	, m_stopping(false)
+	, m_running(false)
+	, m_timesteps(0)
+	, m_cycles(0)
+	, m_parallelCycles(0)
+{
+}
+
+SimScheduler::~SimScheduler()
+{
+	StopWorkers();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Thread pool
+
+void SimScheduler::StartWorkers()
+{
+	m_staging.resize(m_threadCount);
+
+	m_stopping = false;
+	for(unsigned int i=1; i<m_threadCount; i++)
+		m_workers.push_back(thread(&SimScheduler::WorkerThread, this, i));
+}
+
+void SimScheduler::StopWorkers()
+{
+	{
+		lock_guard<mutex> lock(m_poolMutex);
+		m_stopping = true;
+	}
+	m_workReady.notify_all();
+
+	for(auto& t : m_workers)
+		t.join();
+	m_workers.clear();
+}
+
+void SimScheduler::WorkerThread(unsigned int npart)
+{
+	unsigned int generation = 0;
+	while(true)
+	{
+		//Wait for the next cycle to be dispatched
+		{
+			unique_lock<mutex> lock(m_poolMutex);
+			m_workReady.wait(lock, [&]{ return m_stopping || (m_generation != generation); });
+			if(m_stopping)
+				return;
+			generation = m_generation;
+		}
+
+		//Run our slice (if the cycle was too small to give us one, do nothing)
+		if(npart < m_partitionCount)
+			ComputePartition(npart);
+
+		{
+			lock_guard<mutex> lock(m_poolMutex);
+			m_busyWorkers --;
+		}
+		m_workDone.notify_one();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Simulation
+
+/**
+	@brief Request that a node's Timestep() be called at the specified time.
+
+	Multiple requests for the same node and time are merged. Requests for the current cycle made once the simulation
+	is running are pushed to the next cycle, since this cycle's compute phase has already started.
+ */
+void SimScheduler::Wakeup(SimNode* node, unsigned int time)
+{
+	if(m_running && (time <= g_time) )
+		time = g_time + 1;
+	else if(time < g_time)
+		time = g_time;
+
+	//Cheap check for the common case of a node asking for the same wakeup repeatedly
+	if(node->m_lastWakeupRequest == time)
+		return;
+	node->m_lastWakeupRequest = time;
+
+	if(m_threadStaging)
+		m_threadStaging->m_wakeups.push_back(Event(time, node));
+	else
+		m_events.push(Event(time, node));
+}
+
+/**
+	@brief Queue a message for delivery in the commit phase of the current cycle
+ */
+void SimScheduler::SendMessage(SimNode* from, SimNode* to, const NOCPacket& packet)
+{
+	if(m_threadStaging)
+		m_threadStaging->m_deliveries.push_back(Delivery(from, to, packet));
+	else
+		m_commitDeliveries.push_back(Delivery(from, to, packet));
+}
+
+/**
+	@brief Queue a credit return for delivery in the commit phase of the current cycle
+ */
+void SimScheduler::ReturnCredits(
+	SimNode* from, SimNode* to, unsigned int credits, unsigned int tailTime, unsigned int vc)
+{
+	if(m_threadStaging)
+		m_threadStaging->m_deliveries.push_back(Delivery(from, to, credits, tailTime, vc));
+	else
+		m_commitDeliveries.push_back(Delivery(from, to, credits, tailTime, vc));
+}
+
+/**
+	@brief Run the simulation until there are no more events, or we reach the end time
+ */
+void SimScheduler::Run(unsigned int endTime)
+{
+	unsigned int start = g_time;
+
+	StartWorkers();
+	m_running = true;
+
+	//Deliver anything sent during setup
+	Commit();
+
+	while(!m_events.empty())
+	{
+		unsigned int now = m_events.top().m_time;
+		if(now >= endTime)
+			break;
+		g_time = now;
+
+		//Pull all of this cycle's events off the queue, dropping duplicate wakeups.
+		//Events come out in node ID order.
+		m_activeNodes.clear();
+		while(!m_events.empty() && (m_events.top().m_time == now) )
+		{
+			SimNode* node = m_events.top().m_node;
+			m_events.pop();
+
+			if(node->m_lastTimestep == now)
+				continue;
+			node->m_lastTimestep = now;
+			m_activeNodes.push_back(node);
+		}
+
+		Compute();
+		Commit();
+		m_timesteps += m_activeNodes.size();
+	}
+
+	m_running = false;
+	StopWorkers();
+
+	//Stats need the total run time, not the time of the last event
+	g_time = endTime;
+	m_cycles += endTime - start;
+}
+
+/**
+	@brief Run Timestep() on all active nodes, splitting them across the worker pool if there's enough of them
+ */
+void SimScheduler::Compute()
+{
+	unsigned int size = m_activeNodes.size();
+	m_partitionCount = min(m_threadCount, max(1u, size / m_minPartitionSize));
+
+	//Not worth waking the pool up
+	if(m_partitionCount == 1)
+	{
+		ComputePartition(0);
+		return;
+	}
+
+	//Kick off the workers, then do our share
+	m_parallelCycles ++;
+	{
+		lock_guard<mutex> lock(m_poolMutex);
+		m_busyWorkers = m_workers.size();
+		m_generation ++;
+	}
+	m_workReady.notify_all();
+
+	ComputePartition(0);
+
+	unique_lock<mutex> lock(m_poolMutex);
+	m_workDone.wait(lock, [&]{ return m_busyWorkers == 0; });
+}
+
+void SimScheduler::ComputePartition(unsigned int npart)
+{
+	unsigned int size = m_activeNodes.size();
+	unsigned int start = (size * npart) / m_partitionCount;
+	unsigned int end = (size * (npart + 1)) / m_partitionCount;
+
+	m_threadStaging = &m_staging[npart];
+	for(unsigned int i=start; i<end; i++)
+		m_activeNodes[i]->Timestep();
+	m_threadStaging = NULL;
+}
+
+/**
+	@brief Apply all staged side effects of the compute phase, in a deterministic order
+ */
+void SimScheduler::Commit()
+{
+	auto& deliveries = m_deliveries;
+	deliveries.clear();
+	for(unsigned int i=0; i<m_partitionCount; i++)
+	{
+		auto& staging = m_staging[i];
+		for(auto& ev : staging.m_wakeups)
+			m_events.push(ev);
+		deliveries.insert(deliveries.end(), staging.m_deliveries.begin(), staging.m_deliveries.end());
+
+		staging.m_wakeups.clear();
+		staging.m_deliveries.clear();
+	}
+	deliveries.insert(deliveries.end(), m_commitDeliveries.begin(), m_commitDeliveries.end());
+	m_commitDeliveries.clear();
+
+	//Deliver everything. Receivers may send more messages (which land in m_commitDeliveries) so keep going until
+	//nothing is left in flight.
+	while(!deliveries.empty())
+	{
+		for(auto& d : deliveries)
+			d.Deliver();
+
+		deliveries.swap(m_commitDeliveries);
+		m_commitDeliveries.clear();
+	}
+}
+
+/**
+	@brief Drop any pending events and clear statistics
+ */
+void SimScheduler::Reset()
+{
+	m_events = decltype(m_events)();
+	m_commitDeliveries.clear();
+	m_timesteps = 0;
+	m_cycles = 0;
+	m_parallelCycles = 0;
+}
+
+void SimScheduler::PrintStats(unsigned int nodeCount)
+{
+	unsigned long naive = m_cycles * nodeCount;
+	if(naive == 0)
+		return;
+
+	LogDebug("[Scheduler] Timesteps:\n");
+	LogIndenter li;
+	LogDebug("Executed                 : %5lu (%5.2f %% of %lu for cycle-by-cycle simulation)\n",
+		m_timesteps, (m_timesteps * 100.0f) / naive, naive);
+	if(m_threadCount > 1)
+	{
+		LogDebug("Parallel cycles          : %5lu (%5.2f %%, %u threads)\n",
+			m_parallelCycles, (m_parallelCycles * 100.0f) / m_cycles, m_threadCount);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpointing
+
+/**
+	@brief Save the pending wakeups and statistics.
+
+	Must be called between runs, when everything sent has been delivered. Nodes are identified by their index in
+	the node list, since that's the same every time the network is built from the same command line.
+ */
+void SimScheduler::SaveState(SimSnapshot& snap, const vector<SimNode*>& nodes)
+{
+	map<SimNode*, uint32_t> indexes;
+	for(size_t i=0; i<nodes.size(); i++)
+		indexes[nodes[i]] = i;
+
+	auto events = m_events;
+	snap.Write<uint64_t>(events.size());
+	while(!events.empty())
+	{
+		snap.Write(events.top().m_time);
+		snap.Write(indexes[events.top().m_node]);
+		events.pop();
+	}
+
+	snap.Write(m_timesteps);
+	snap.Write(m_cycles);
+	snap.Write(m_parallelCycles);
+}
+
+/**
+	@brief Replace the pending wakeups (including any requested while the network was being built) with saved ones
+ */
+void SimScheduler::LoadState(SimSnapshot& snap, const vector<SimNode*>& nodes)
+{
+	m_events = decltype(m_events)();
+	m_commitDeliveries.clear();
+
+	uint64_t count = 0;
+	snap.Read(count);
+	for(uint64_t i=0; (i < count) && snap.IsOK(); i++)
+	{
+		unsigned int time;
+		uint32_t index;
+		snap.Read(time);
+		snap.Read(index);
+		if(index >= nodes.size())
+			snap.Fail();
+		else if(snap.IsOK())
+			m_events.push(Event(time, nodes[index]));
+	}
+
+	snap.Read(m_timesteps);
+	snap.Read(m_cycles);
+	snap.Read(m_parallelCycles);
+}
@@ -0,0 +1,206 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Discrete-event scheduler for the simulation
+ */
+#ifndef SimScheduler_h
+#define SimScheduler_h
+
+/**
+	@brief A timestamp-ordered event queue of node wakeups.
+
+	Nodes only have Timestep() called in cycles they asked to be woken up in (because a message arrived, an outbox
+	cleared, etc) so idle hosts and routers cost nothing.
+
+	Each cycle runs in two phases:
+	* Compute: every node woken this cycle runs Timestep(). Messages sent and wakeups requested are staged in a
+	  per-partition buffer rather than touching other nodes. Partitions are contiguous ranges of node IDs (so a grid
+	  router and its children usually land together) and may run on worker threads.
+	* Commit: staged wakeups and messages are applied serially, in partition order, then in order of sending.
+	  Messages sent from inside AcceptMessage() (replies etc) are delivered in the same commit phase.
+
+	Credit returns are staged and delivered the same way as messages.
+
+	Since the serial run uses exactly the same staging, results are bit-identical regardless of thread count.
+ */
+class SimScheduler
+{
+public:
+	SimScheduler();
+	virtual ~SimScheduler();
+
+	void Wakeup(SimNode* node, unsigned int time);
+	void SendMessage(SimNode* from, SimNode* to, const NOCPacket& packet);
+	void ReturnCredits(SimNode* from, SimNode* to, unsigned int credits, unsigned int tailTime, unsigned int vc);
+
+	void SetThreadCount(unsigned int threads)
+	{ m_threadCount = threads ? threads : 1; }
+
+	void Run(unsigned int endTime);
+	void Reset();
+
+	void SaveState(SimSnapshot& snap, const std::vector<SimNode*>& nodes);
+	void LoadState(SimSnapshot& snap, const std::vector<SimNode*>& nodes);
+
+	void PrintStats(unsigned int nodeCount);
+
+protected:
+
+	class Event
+	{
+	public:
+		Event(unsigned int time, SimNode* node)
+		: m_time(time)
+		, m_id(node->m_id)
+		, m_node(node)
+		{}
+
+		//Sort by time first, then by node ID
+		bool operator>(const Event& rhs) const
+		{
+			if(m_time != rhs.m_time)
+				return m_time > rhs.m_time;
+			return m_id > rhs.m_id;
+		}
+
+		unsigned int m_time;
+
+		//Copy of the node's ID, so sorting doesn't have to go out to the node
+		unsigned int m_id;
+
+		SimNode* m_node;
+	};
+
+	//A message or a credit return
+	class Delivery
+	{
+	public:
+		Delivery(SimNode* from, SimNode* to, const NOCPacket& packet)
+		: m_from(from)
+		, m_to(to)
+		, m_packet(packet)
+		, m_credits(0)
+		, m_tailTime(0)
+		, m_vc(0)
+		{}
+
+		Delivery(SimNode* from, SimNode* to, unsigned int credits, unsigned int tailTime, unsigned int vc)
+		: m_from(from)
+		, m_to(to)
+		, m_credits(credits)
+		, m_tailTime(tailTime)
+		, m_vc(vc)
+		{}
+
+		void Deliver()
+		{
+			if(m_credits)
+				m_to->AcceptCredits(m_from, m_credits, m_tailTime, m_vc);
+			else
+				m_to->AcceptMessage(m_packet, m_from);
+		}
+
+		SimNode* m_from;
+		SimNode* m_to;
+		NOCPacket m_packet;
+
+		//Credit return (only if m_credits is nonzero)
+		unsigned int m_credits;
+		unsigned int m_tailTime;
+		unsigned int m_vc;
+	};
+
+	//Side effects of one partition's compute phase, waiting to be committed
+	class StagingBuffer
+	{
+	public:
+		std::vector<Event> m_wakeups;
+		std::vector<Delivery> m_deliveries;
+	};
+
+	void Compute();
+	void ComputePartition(unsigned int npart);
+	void Commit();
+
+	void StartWorkers();
+	void StopWorkers();
+	void WorkerThread(unsigned int npart);
+
+	std::priority_queue<Event, std::vector<Event>, std::greater<Event> > m_events;
+
+	//Nodes being run in the current cycle, in ID order
+	std::vector<SimNode*> m_activeNodes;
+
+	//Staging buffer for each partition of the active nodes
+	std::vector<StagingBuffer> m_staging;
+
+	//Staging buffer for the partition being computed by the current thread (NULL outside the compute phase)
+	static thread_local StagingBuffer* m_threadStaging;
+
+	//Messages sent during the commit phase (replies from hosts etc)
+	std::vector<Delivery> m_commitDeliveries;
+
+	//Messages being delivered in the current commit phase (kept around so we don't reallocate every cycle)
+	std::vector<Delivery> m_deliveries;
+
+	//Number of partitions the current cycle is split into
+	unsigned int m_partitionCount;
+
+	//Minimum number of active nodes per partition (below this, threading costs more than it saves)
+	static const unsigned int m_minPartitionSize = 64;
+
+	//Worker thread pool (m_threadCount - 1 workers, the main thread runs partition 0)
+	unsigned int m_threadCount;
+	std::vector<std::thread> m_workers;
+	std::mutex m_poolMutex;
+	std::condition_variable m_workReady;
+	std::condition_variable m_workDone;
+	unsigned int m_generation;
+	unsigned int m_busyWorkers;
+	bool m_stopping;
+
+	//True while Run() is executing
+	bool m_running;
+
+	//Number of Timestep() calls actually executed
+	unsigned long m_timesteps;
+
+	//Number of cycles simulated
+	unsigned long m_cycles;
+
+	//Number of cycles that were split across more than one thread
+	unsigned long m_parallelCycles;
+};
+
+extern SimScheduler g_scheduler;
+
+#endif
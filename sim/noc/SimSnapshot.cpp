@@ -0,0 +1,162 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Binary snapshot of the simulation state
+ */
+
+#include "nocsim.h"
+#include <sstream>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+SimSnapshot::SimSnapshot()
+	: m_fp(NULL)
+	, m_size(0)
+	, m_reading(false)
+	, m_ok(false)
+{
+}
+
+SimSnapshot::~SimSnapshot()
+{
+	if(m_fp)
+		fclose(m_fp);
+}
+
+/**
+	@brief Create a new snapshot file for writing
+ */
+bool SimSnapshot::Create(string path)
+{
+	m_fp = fopen(path.c_str(), "wb");
+	m_ok = (m_fp != NULL);
+	if(!m_ok)
+		LogError("Couldn't create snapshot %s\n", path.c_str());
+	return m_ok;
+}
+
+/**
+	@brief Open an existing snapshot file for reading
+ */
+bool SimSnapshot::Open(string path)
+{
+	m_fp = fopen(path.c_str(), "rb");
+	m_ok = (m_fp != NULL);
+	if(!m_ok)
+	{
+		LogError("Couldn't open snapshot %s\n", path.c_str());
+		return false;
+	}
+
+	m_reading = true;
+	fseek(m_fp, 0, SEEK_END);
+	m_size = ftell(m_fp);
+	fseek(m_fp, 0, SEEK_SET);
+	return true;
+}
+
+/**
+	@brief Close the file
+
+	@return True if everything was read or written successfully (and, when reading, nothing was left over)
+ */
+bool SimSnapshot::Close()
+{
+	if(m_fp)
+	{
+		if(m_reading && (static_cast<uint64_t>(ftell(m_fp)) != m_size) )
+			m_ok = false;
+		if(0 != fclose(m_fp))
+			m_ok = false;
+		m_fp = NULL;
+	}
+	return m_ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Serialization
+
+void SimSnapshot::WriteBytes(const void* data, size_t len)
+{
+	if(m_ok && (len != fwrite(data, 1, len, m_fp)) )
+		m_ok = false;
+}
+
+void SimSnapshot::ReadBytes(void* data, size_t len)
+{
+	if(m_ok && (len != fread(data, 1, len, m_fp)) )
+		m_ok = false;
+}
+
+/**
+	@brief Save a random number generator. The standard only lets us get at the state as text, so store that
+ */
+void SimSnapshot::Write(const minstd_rand& rng)
+{
+	ostringstream ss;
+	ss << rng;
+	string s = ss.str();
+	Write<uint32_t>(s.length());
+	WriteBytes(s.c_str(), s.length());
+}
+
+void SimSnapshot::Read(minstd_rand& rng)
+{
+	uint32_t len = 0;
+	Read(len);
+	if(len > 64)
+		m_ok = false;
+	if(!m_ok)
+		return;
+
+	string s(len, '\0');
+	ReadBytes(&s[0], len);
+	istringstream ss(s);
+	ss >> rng;
+	if(ss.fail())
+		m_ok = false;
+}
+
+void SimSnapshot::Write(const atomic<unsigned long>& value)
+{
+	Write<unsigned long>(value.load());
+}
+
+void SimSnapshot::Read(atomic<unsigned long>& value)
+{
+	unsigned long v = 0;
+	Read(v);
+	value.store(v);
+}
@@ -0,0 +1,147 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Binary snapshot of the simulation state
+ */
+#ifndef SimSnapshot_h
+#define SimSnapshot_h
+
+/**
+	@brief A file holding the complete state of a simulation, so a run can be saved part way through and resumed later
+	(or resumed several times, e.g. to try different traffic after a common warmup).
+
+	The network itself isn't saved: it's rebuilt from the same command line, then every node loads its state in
+	creation order. Values are stored raw, in native byte order, so snapshots are only portable between builds for the
+	same platform (the header records enough to detect a mismatch).
+
+	Errors are sticky: once a read or write fails, everything after it is a no-op and IsOK() returns false.
+ */
+class SimSnapshot
+{
+public:
+	SimSnapshot();
+	virtual ~SimSnapshot();
+
+	bool Create(std::string path);
+	bool Open(std::string path);
+	bool Close();
+
+	bool IsOK()
+	{ return m_ok; }
+
+	/**
+		@brief Flag the snapshot as bad (e.g. it's for a different network)
+	 */
+	void Fail()
+	{ m_ok = false; }
+
+	template<class T> void Write(const T& value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be written directly");
+		WriteBytes(&value, sizeof(value));
+	}
+
+	template<class T> void Read(T& value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be read directly");
+		ReadBytes(&value, sizeof(value));
+	}
+
+	template<class A, class B> void Write(const std::pair<A, B>& value)
+	{
+		Write(value.first);
+		Write(value.second);
+	}
+
+	template<class A, class B> void Read(std::pair<A, B>& value)
+	{
+		Read(value.first);
+		Read(value.second);
+	}
+
+	template<class T> void Write(const std::vector<T>& value)
+	{ WriteSequence(value); }
+
+	template<class T> void Read(std::vector<T>& value)
+	{ ReadSequence(value); }
+
+	template<class T> void Write(const std::deque<T>& value)
+	{ WriteSequence(value); }
+
+	template<class T> void Read(std::deque<T>& value)
+	{ ReadSequence(value); }
+
+	void Write(const std::minstd_rand& rng);
+	void Read(std::minstd_rand& rng);
+
+	void Write(const std::atomic<unsigned long>& value);
+	void Read(std::atomic<unsigned long>& value);
+
+protected:
+	void WriteBytes(const void* data, size_t len);
+	void ReadBytes(void* data, size_t len);
+
+	template<class C> void WriteSequence(const C& value)
+	{
+		Write<uint64_t>(value.size());
+		for(auto& x : value)
+			Write(x);
+	}
+
+	template<class C> void ReadSequence(C& value)
+	{
+		uint64_t size = 0;
+		Read(size);
+
+		//Don't let a corrupted length make us allocate the world
+		if(size > m_size)
+			m_ok = false;
+		if(!m_ok)
+			return;
+
+		value.resize(size);
+		for(auto& x : value)
+			Read(x);
+	}
+
+	FILE* m_fp;
+
+	//Size of the file being read
+	uint64_t m_size;
+
+	//True if the file was opened for reading
+	bool m_reading;
+
+	bool m_ok;
+};
+
+#endif
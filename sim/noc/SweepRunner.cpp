@@ -0,0 +1,261 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Runs a grid of simulation scenarios in parallel
+ */
+
+#include "nocsim.h"
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+SweepRunner::SweepRunner()
+	: m_completed(0)
+	, m_failed(0)
+	, m_resultFd(-1)
+{
+}
+
+SweepRunner::~SweepRunner()
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Running the sweep
+
+/**
+	@brief Make one scenario for every combination of parameter values
+ */
+void SweepRunner::BuildScenarios()
+{
+	m_scenarios.clear();
+	for(auto& topo : m_topos)
+	{
+		for(auto hosts : m_hosts)
+		{
+			for(auto rate : m_rates)
+			{
+				for(auto seed : m_seeds)
+				{
+					for(auto latency : m_routerLatencies)
+					{
+						Scenario s;
+						s.m_topo = topo;
+						s.m_hosts = hosts;
+						s.m_rate = rate;
+						s.m_seed = seed;
+						s.m_routerLatency = latency;
+						m_scenarios.push_back(s);
+					}
+				}
+			}
+		}
+	}
+	m_results.clear();
+	m_results.resize(m_scenarios.size());
+}
+
+/**
+	@brief Run every scenario, up to jobs at a time.
+
+	@param jobs		Number of scenarios to run at once
+	@param csvPath	Path to write the results to
+	@param child	Set to true if we're returning in a child process that should simulate the scenario
+	@param scenario	The scenario to simulate (only set in a child)
+
+	@return In the parent, true if every scenario ran successfully. In a child, true.
+ */
+bool SweepRunner::Run(unsigned int jobs, string csvPath, bool& child, Scenario& scenario)
+{
+	child = false;
+	BuildScenarios();
+
+	//Open the output before doing any work, in case it's not writable
+	FILE* fp = fopen(csvPath.c_str(), "w");
+	if(!fp)
+	{
+		LogError("Couldn't open %s\n", csvPath.c_str());
+		return false;
+	}
+
+	LogNotice("Running %zu scenarios, %u at a time\n", m_scenarios.size(), jobs);
+	LogIndenter li;
+
+	m_completed = 0;
+	m_failed = 0;
+	for(unsigned int i=0; i<m_scenarios.size(); i++)
+	{
+		while(m_children.size() >= jobs)
+			Reap();
+
+		fflush(stdout);
+		if(!Launch(i))
+		{
+			m_failed ++;
+			continue;
+		}
+
+		//If we're the child, go off and simulate
+		if(m_resultFd >= 0)
+		{
+			fclose(fp);
+			child = true;
+			scenario = m_current;
+			return true;
+		}
+	}
+	while(!m_children.empty())
+		Reap();
+
+	fprintf(fp, "topo,hosts,rate,seed,router_latency,offered,accepted,latency,p99\n");
+	for(auto& row : m_results)
+	{
+		if(row != "")
+			fputs(row.c_str(), fp);
+	}
+	fclose(fp);
+
+	LogNotice("%u scenarios completed, %u failed. Results written to %s\n",
+		m_completed, m_failed, csvPath.c_str());
+	return (m_failed == 0);
+}
+
+/**
+	@brief Fork off a child to run a scenario
+
+	@return False if we couldn't start it
+ */
+bool SweepRunner::Launch(unsigned int index)
+{
+	int fds[2];
+	if(0 != pipe(fds))
+	{
+		LogError("Couldn't create result pipe: %s\n", strerror(errno));
+		return false;
+	}
+
+	pid_t pid = fork();
+	if(pid < 0)
+	{
+		LogError("Couldn't fork: %s\n", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+
+	//Child: hang on to the write end and our scenario, drop everything else
+	if(pid == 0)
+	{
+		close(fds[0]);
+		for(auto& it : m_children)
+			close(it.second.second);
+		m_children.clear();
+
+		m_current = m_scenarios[index];
+		m_resultFd = fds[1];
+		return true;
+	}
+
+	//Parent: wait for the result
+	close(fds[1]);
+	m_children[pid] = pair<unsigned int, int>(index, fds[0]);
+	return true;
+}
+
+/**
+	@brief Wait for a child to finish and collect its result
+ */
+void SweepRunner::Reap()
+{
+	int status;
+	pid_t pid = wait(&status);
+	if(pid < 0)
+	{
+		LogError("wait() failed: %s\n", strerror(errno));
+		m_failed += m_children.size();
+		m_children.clear();
+		return;
+	}
+
+	auto it = m_children.find(pid);
+	if(it == m_children.end())
+		return;
+	unsigned int index = it->second.first;
+	int fd = it->second.second;
+	m_children.erase(it);
+
+	//The row is much smaller than a pipe buffer, so it's all sitting there waiting for us
+	string row;
+	char buf[256];
+	ssize_t len;
+	while( (len = read(fd, buf, sizeof(buf))) > 0)
+		row.append(buf, len);
+	close(fd);
+
+	auto& s = m_scenarios[index];
+	if(!WIFEXITED(status) || (WEXITSTATUS(status) != 0) || (row == "") )
+	{
+		LogError("Scenario %u (%s, %u hosts, rate %.4f, seed %u, router latency %u) failed\n",
+			index, s.m_topo.c_str(), s.m_hosts, s.m_rate, s.m_seed, s.m_routerLatency);
+		m_failed ++;
+		return;
+	}
+
+	m_results[index] = row;
+	m_completed ++;
+	LogNotice("[%u/%zu] %s", m_completed + m_failed, m_scenarios.size(), row.c_str());
+}
+
+/**
+	@brief Called in a child once the scenario has finished, to send the results back to the parent
+ */
+void SweepRunner::SendResult(double offered, double accepted, double latency, unsigned int latency99)
+{
+	if(m_resultFd < 0)
+		return;
+
+	//Report the host count actually simulated (the scenario might have left it at the default)
+	char row[256];
+	int len = snprintf(row, sizeof(row), "%s,%u,%f,%u,%u,%f,%f,%f,%u\n",
+		m_current.m_topo.c_str(), g_hostCount, m_current.m_rate, m_current.m_seed, m_current.m_routerLatency,
+		offered, accepted, latency, latency99);
+	if(len != write(m_resultFd, row, len))
+		LogError("Couldn't send results to the sweep runner\n");
+
+	close(m_resultFd);
+	m_resultFd = -1;
+}
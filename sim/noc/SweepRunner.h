@@ -0,0 +1,96 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Runs a grid of simulation scenarios in parallel
+ */
+#ifndef SweepRunner_h
+#define SweepRunner_h
+
+/**
+	@brief Runs every combination of a set of parameter values and collects the results into one CSV.
+
+	The simulator keeps its state in globals, and each run may use its own scheduler threads, so scenarios can't share
+	a process. Instead each one runs in a forked child: Run() returns in the child with the scenario to simulate, which
+	then goes through exactly the same path as a normal single run and hands its results back with SendResult(). The
+	parent keeps up to the requested number of children going and writes the CSV (in scenario order, so it doesn't
+	depend on which ones finished first) once they're all done.
+ */
+class SweepRunner
+{
+public:
+	SweepRunner();
+	virtual ~SweepRunner();
+
+	/**
+		@brief One point in the parameter space
+	 */
+	struct Scenario
+	{
+		std::string m_topo;
+		unsigned int m_hosts;
+		double m_rate;
+		unsigned int m_seed;
+		unsigned int m_routerLatency;
+	};
+
+	bool Run(unsigned int jobs, std::string csvPath, bool& child, Scenario& scenario);
+	void SendResult(double offered, double accepted, double latency, unsigned int latency99);
+
+	//Values to sweep over. Anything left empty gets a single value from the rest of the command line
+	std::vector<std::string> m_topos;
+	std::vector<unsigned int> m_hosts;
+	std::vector<double> m_rates;
+	std::vector<unsigned int> m_seeds;
+	std::vector<unsigned int> m_routerLatencies;
+
+protected:
+	void BuildScenarios();
+	bool Launch(unsigned int index);
+	void Reap();
+
+	std::vector<Scenario> m_scenarios;
+
+	//Result row for each scenario ("" if it hasn't finished, or failed)
+	std::vector<std::string> m_results;
+
+	//Running children: the scenario and the read end of the result pipe
+	std::map<pid_t, std::pair<unsigned int, int> > m_children;
+
+	unsigned int m_completed;
+	unsigned int m_failed;
+
+	//In a child: the scenario we're running, and the write end of the result pipe
+	Scenario m_current;
+	int m_resultFd;
+};
+
+#endif
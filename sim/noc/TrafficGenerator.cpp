@@ -0,0 +1,267 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Synthetic traffic generator
+ */
+
+#include "nocsim.h"
+#include <math.h>
+
+using namespace std;
+
+//The active traffic generator (NULL if only the NIC/CPU models are generating traffic)
+TrafficGenerator* g_trafficGenerator = NULL;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+TrafficGenerator::TrafficGenerator(Pattern pattern, double rate)
+	: m_pattern(pattern)
+	, m_rate(rate)
+	, m_rpcWeight(1)
+	, m_dmaReadWeight(0)
+	, m_dmaWriteWeight(0)
+	, m_dmaSize(32)
+	, m_hotspotAddr(0)
+	, m_hotspotFraction(0)
+	, m_warmup(0)
+	, m_packetsOffered(0)
+	, m_wordsOffered(0)
+	, m_packetsAccepted(0)
+	, m_wordsAccepted(0)
+{
+	m_addressBits = ceil(log2(g_hostCount));
+}
+
+TrafficGenerator::~TrafficGenerator()
+{
+}
+
+bool TrafficGenerator::ParsePattern(string name, Pattern& pattern)
+{
+	if(name == "uniform")
+		pattern = PATTERN_UNIFORM;
+	else if(name == "transpose")
+		pattern = PATTERN_TRANSPOSE;
+	else if(name == "bitreverse")
+		pattern = PATTERN_BITREVERSE;
+	else if(name == "hotspot")
+		pattern = PATTERN_HOTSPOT;
+	else if(name == "neighbor")
+		pattern = PATTERN_NEIGHBOR;
+	else
+		return false;
+	return true;
+}
+
+const char* TrafficGenerator::GetPatternName(Pattern pattern)
+{
+	switch(pattern)
+	{
+		case PATTERN_UNIFORM:
+			return "uniform";
+		case PATTERN_TRANSPOSE:
+			return "transpose";
+		case PATTERN_BITREVERSE:
+			return "bitreverse";
+		case PATTERN_HOTSPOT:
+			return "hotspot";
+		case PATTERN_NEIGHBOR:
+			return "neighbor";
+	}
+	return "invalid";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Packet generation
+
+/**
+	@brief Get the number of cycles until a host's next packet (geometric distribution, so hosts can sleep in between)
+ */
+unsigned int TrafficGenerator::GetInterarrivalTime(minstd_rand& rng)
+{
+	if(m_rate >= 1)
+		return 1;
+
+	geometric_distribution<unsigned int> dist(m_rate);
+	return 1 + dist(rng);
+}
+
+/**
+	@brief Create the next packet for a host
+
+	@return False if the host doesn't send anything under this pattern (e.g. it maps to itself under a permutation)
+ */
+bool TrafficGenerator::Generate(uint16_t src, minstd_rand& rng, NOCPacket& packet)
+{
+	uint16_t dst = GetDestination(src, rng);
+	if( (dst == src) || (dst >= g_hostCount) )
+		return false;
+
+	//Pick the message type
+	unsigned int total = m_rpcWeight + m_dmaReadWeight + m_dmaWriteWeight;
+	unsigned int r = rng() % total;
+	if(r < m_rpcWeight)
+		packet = NOCPacket(src, dst, 4, NOCPacket::TYPE_RPC_CALL, 4);
+	else if(r < m_rpcWeight + m_dmaReadWeight)
+		packet = NOCPacket(src, dst, 3, NOCPacket::TYPE_DMA_READ, 3 + m_dmaSize);
+	else
+		packet = NOCPacket(src, dst, 3 + m_dmaSize, NOCPacket::TYPE_DMA_WRITE, 3);
+	packet.m_synthetic = true;
+
+	if(packet.m_timeSent >= m_warmup)
+	{
+		m_packetsOffered ++;
+		m_wordsOffered += packet.m_size;
+	}
+	return true;
+}
+
+uint16_t TrafficGenerator::GetDestination(uint16_t src, minstd_rand& rng)
+{
+	switch(m_pattern)
+	{
+		case PATTERN_HOTSPOT:
+			{
+				uniform_real_distribution<double> dist(0, 1);
+				if(dist(rng) < m_hotspotFraction)
+					return m_hotspotAddr;
+			}
+
+			//The rest of the traffic is uniform
+			//fall through
+
+		case PATTERN_UNIFORM:
+			{
+				//Pick anyone other than ourself
+				uint16_t dst = rng() % (g_hostCount - 1);
+				if(dst >= src)
+					dst ++;
+				return dst;
+			}
+
+		case PATTERN_TRANSPOSE:
+			{
+				unsigned int half = m_addressBits / 2;
+				unsigned int lo = src & ((1 << half) - 1);
+				unsigned int hi = src >> half;
+				return (lo << (m_addressBits - half)) | hi;
+			}
+
+		case PATTERN_BITREVERSE:
+			{
+				unsigned int dst = 0;
+				for(unsigned int i=0; i<m_addressBits; i++)
+				{
+					if(src & (1 << i))
+						dst |= 1 << (m_addressBits - 1 - i);
+				}
+				return dst;
+			}
+
+		case PATTERN_NEIGHBOR:
+			if(rng() & 1)
+				return (src + 1) % g_hostCount;
+			else
+				return (src + g_hostCount - 1) % g_hostCount;
+	}
+
+	return src;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Statistics
+
+void TrafficGenerator::PacketDelivered(const NOCPacket& packet, unsigned int latency)
+{
+	if(packet.m_timeSent < m_warmup)
+		return;
+
+	m_packetsAccepted ++;
+	m_wordsAccepted += packet.m_size;
+	m_latency.Record(latency);
+}
+
+/**
+	@brief Offered load, in words per host per cycle
+ */
+double TrafficGenerator::GetOfferedLoad()
+{
+	if(g_time <= m_warmup)
+		return 0;
+	return m_wordsOffered / (double(g_hostCount) * (g_time - m_warmup));
+}
+
+/**
+	@brief Accepted throughput, in words per host per cycle
+ */
+double TrafficGenerator::GetAcceptedThroughput()
+{
+	if(g_time <= m_warmup)
+		return 0;
+	return m_wordsAccepted / (double(g_hostCount) * (g_time - m_warmup));
+}
+
+void TrafficGenerator::PrintStats()
+{
+	LogDebug("[Traffic] %s, injection rate %.4f packets/host/cycle:\n", GetPatternName(m_pattern), m_rate);
+	LogIndenter li;
+	LogDebug("Offered                  : %5lu packets (%.4f words/host/cycle)\n",
+		(unsigned long)m_packetsOffered, GetOfferedLoad());
+	LogDebug("Accepted                 : %5lu packets (%.4f words/host/cycle)\n",
+		m_packetsAccepted, GetAcceptedThroughput());
+	m_latency.PrintSummary("Latency");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpointing
+
+/**
+	@brief Save the statistics. The pattern, rate and mix come from the command line, so a restored run can change them
+ */
+void TrafficGenerator::SaveState(SimSnapshot& snap)
+{
+	snap.Write(m_packetsOffered);
+	snap.Write(m_wordsOffered);
+	snap.Write(m_packetsAccepted);
+	snap.Write(m_wordsAccepted);
+	m_latency.SaveState(snap);
+}
+
+void TrafficGenerator::LoadState(SimSnapshot& snap)
+{
+	snap.Read(m_packetsOffered);
+	snap.Read(m_wordsOffered);
+	snap.Read(m_packetsAccepted);
+	snap.Read(m_wordsAccepted);
+	m_latency.LoadState(snap);
+}
@@ -0,0 +1,148 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Synthetic traffic generator
+ */
+#ifndef TrafficGenerator_h
+#define TrafficGenerator_h
+
+/**
+	@brief Synthetic traffic for measuring throughput and latency under load.
+
+	Every host without a workload model of its own (i.e. plain hosts and the RAM controller) injects new packets as a
+	Bernoulli process at the configured rate, with destinations picked by the selected pattern and message types
+	picked from the RPC/DMA mix. Packets wait in a source queue until the host's link is free, so latency includes
+	source queueing (as it should, for load-latency curves).
+ */
+class TrafficGenerator
+{
+public:
+
+	enum Pattern
+	{
+		PATTERN_UNIFORM,		//Uniform random destination
+		PATTERN_TRANSPOSE,		//Swap high and low halves of the address
+		PATTERN_BITREVERSE,		//Reverse the address bits
+		PATTERN_HOTSPOT,		//Uniform, but a fraction of all traffic goes to one host
+		PATTERN_NEIGHBOR		//Address one above or below the source
+	};
+
+	TrafficGenerator(Pattern pattern, double rate);
+	virtual ~TrafficGenerator();
+
+	static bool ParsePattern(std::string name, Pattern& pattern);
+	static const char* GetPatternName(Pattern pattern);
+
+	/**
+		@brief Set the relative weights of the message types we generate
+	 */
+	void SetMix(unsigned int rpc, unsigned int dmaRead, unsigned int dmaWrite)
+	{
+		m_rpcWeight = rpc;
+		m_dmaReadWeight = dmaRead;
+		m_dmaWriteWeight = dmaWrite;
+	}
+
+	void SetDMASize(unsigned int words)
+	{ m_dmaSize = words; }
+
+	void SetHotspot(uint16_t addr, double fraction)
+	{
+		m_hotspotAddr = addr;
+		m_hotspotFraction = fraction;
+	}
+
+	void SetWarmup(unsigned int cycles)
+	{ m_warmup = cycles; }
+
+	double GetRate()
+	{ return m_rate; }
+
+	//Called by hosts
+	unsigned int GetInterarrivalTime(std::minstd_rand& rng);
+	bool Generate(uint16_t src, std::minstd_rand& rng, NOCPacket& packet);
+
+	//Called on delivery of a packet we generated
+	void PacketDelivered(const NOCPacket& packet, unsigned int latency);
+
+	double GetOfferedLoad();
+	double GetAcceptedThroughput();
+	double GetAverageLatency()
+	{ return m_latency.GetMean(); }
+
+	unsigned int GetLatencyPercentile(double pct)
+	{ return m_latency.GetPercentile(pct); }
+
+	void PrintStats();
+
+	void SaveState(SimSnapshot& snap);
+	void LoadState(SimSnapshot& snap);
+
+protected:
+	uint16_t GetDestination(uint16_t src, std::minstd_rand& rng);
+
+	Pattern m_pattern;
+
+	//Probability of injecting a new packet at each host, each cycle
+	double m_rate;
+
+	//Relative weights of each message type
+	unsigned int m_rpcWeight;
+	unsigned int m_dmaReadWeight;
+	unsigned int m_dmaWriteWeight;
+
+	//DMA payload size, in words
+	unsigned int m_dmaSize;
+
+	//Hot spot target
+	uint16_t m_hotspotAddr;
+	double m_hotspotFraction;
+
+	//Number of address bits (for permutation patterns)
+	unsigned int m_addressBits;
+
+	//Packets created before this time are ignored for statistics
+	unsigned int m_warmup;
+
+	//Offered traffic (incremented from Timestep() so has to be thread safe)
+	std::atomic<unsigned long> m_packetsOffered;
+	std::atomic<unsigned long> m_wordsOffered;
+
+	//Delivered traffic (incremented from NOCPacket::Processed(), under its stats lock)
+	unsigned long m_packetsAccepted;
+	unsigned long m_wordsAccepted;
+	LatencyHistogram m_latency;
+};
+
+extern TrafficGenerator* g_trafficGenerator;
+
+#endif
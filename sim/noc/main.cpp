@@ -33,30 +33,168 @@
 	@brief NoC topology simulator
  */
 #include "nocsim.h"
+#include <math.h>
 
 using namespace std;
 
 unsigned int g_hostCount = 256;
 unsigned int g_time = 0;
 
-set<SimNode*> g_simNodes;
+//Topology configuration
+unsigned int g_portCount = 0;
+unsigned int g_gridWidth = 0;
+unsigned int g_gridHeight = 0;
 
-void CreateQuadtreeNetwork();
-void CreateGridNetwork(bool randomize);
-void RunSimulation();
+//Addresses of the special hosts
+uint16_t g_nicAddr = 0;
+uint16_t g_ramAddr = 0;
+uint16_t g_cpuAddr = 0;
+
+//CPU cores (g_cpuAddr is the first one, and gets the NIC's interrupts)
+vector<uint16_t> g_cpuAddrs;
+
+//CPU workload: probability per cycle of an I-cache miss, D-cache miss, and syscall, and D-cache misses in flight
+double g_cpuIMissRate = 0;
+double g_cpuDMissRate = 0.01;
+double g_cpuSyscallRate = 0;
+unsigned int g_cpuMSHRs = 1;
+
+//NIC: RX ring slots (frames in flight at once) and frame buffers allocated ahead of time
+unsigned int g_nicRingSize = 1;
+unsigned int g_nicBuffers = 1;
+
+//RAM: cycles from the end of the transfer to the reply, and words per cycle (zero for instant service)
+unsigned int g_ramLatency = 0;
+double g_ramBandwidth = 0;
+
+//Router microarchitecture. 32-bit links and room for a full 512-word DMA in each FIFO match the hardware
+unsigned int g_linkWidth = 32;
+
+//Separate RPC and DMA networks (each host has a port on both), and the width of the DMA network's links
+bool g_dualNetwork = false;
+unsigned int g_dmaLinkWidth = 0;
+unsigned int g_fifoDepth = 515;
+NOCRouter::SwitchingMode g_switching = NOCRouter::SWITCH_VIRTUAL_CUT_THROUGH;
+unsigned int g_vcCount = 1;
+
+//Extra cycles each router takes to route a packet, on top of receiving the header
+unsigned int g_routerLatency = 0;
+
+//Random seed for the run (each host's generator is derived from this and its address)
+unsigned int g_seed = 0;
+
+//All nodes in the simulation, in creation order
+vector<SimNode*> g_simNodes;
+
+//Trace to replay ("" to use the built-in NIC/CPU/RAM workload models)
+string g_tracePath;
+
+enum Topologies
+{
+	TOPO_QUADTREE,
+	TOPO_XYGRID,
+	TOPO_RANDOMGRID
+};
+
+//Shape of one network
+class NetworkConfig
+{
+public:
+	Topologies m_topo;
+	GridRouter::RoutingAlgorithm m_routing;
+	unsigned int m_portCount;
+	unsigned int m_gridWidth;
+	unsigned int m_gridHeight;
+};
+
+//The DMA network, in dual-network mode (the RPC network is described by the g_portCount etc globals)
+NetworkConfig g_dmaNetwork = {TOPO_QUADTREE, GridRouter::ROUTE_XY, 0, 0, 0};
+
+NOCHost* CreateHost(uint16_t addr, NOCRouter* parent, xypos pos);
+NOCHost* AttachHost(uint16_t addr, NOCRouter* router, unsigned int network, const vector<NOCHost*>& hosts, xypos pos);
+bool SizeNetwork(Topologies topo, unsigned int& ports, unsigned int& width, unsigned int& height, unsigned int& hosts,
+	const char* prefix);
+bool CreateNetwork(Topologies topo, GridRouter::RoutingAlgorithm routing);
+bool CreateNetwork(const NetworkConfig& config, unsigned int network, unsigned int yoffset,
+	const vector<NOCHost*>& hosts);
+void CreateQuadtreeNetwork(const NetworkConfig& config, unsigned int network, unsigned int yoffset,
+	const vector<NOCHost*>& hosts);
+void CreateGridNetwork(const NetworkConfig& config, unsigned int network, unsigned int yoffset,
+	const vector<NOCHost*>& hosts);
+bool LoadRouteTables(string path);
+void RunSimulation(unsigned int cycles);
+bool SaveSnapshot(string path, Topologies topo, GridRouter::RoutingAlgorithm routing);
+bool LoadSnapshot(string path, Topologies topo, GridRouter::RoutingAlgorithm routing);
 void PrintStats();
-void RenderOutput();
+void RenderOutput(string path);
+void GetLinkStats(vector<LinkStats>& stats);
+void ResetSimulation();
+bool ParseValues(string s, vector<double>& values);
+bool ParseRates(string s, vector<double>& rates);
+bool ParseTopology(string s, Topologies& topo);
+bool ParseSweep(string s, SweepRunner& sweep);
 
 int main(int argc, char* argv[])
 {
 	Severity console_verbosity = Severity::NOTICE;
 
-	enum Topologies
-	{
-		TOPO_QUADTREE,
-		TOPO_XYGRID,
-		TOPO_RANDOMGRID
-	} topo = TOPO_QUADTREE;
+	Topologies topo = TOPO_QUADTREE;
+	string topoName = "quadtree";
+
+	//Grid routing algorithm, if overriding the topology's default
+	GridRouter::RoutingAlgorithm routing = GridRouter::ROUTE_XY;
+	bool routingSet = false;
+
+	//DMA network options that weren't given copy the RPC network's
+	bool dmaTopoSet = false;
+	bool dmaRoutingSet = false;
+
+	unsigned int cycles = 1000;
+
+	//Special hosts (-1 for the default RAM address)
+	int ramAddr = -1;
+	unsigned int cpuCount = 1;
+
+	//Synthetic traffic configuration
+	bool synthetic = false;
+	TrafficGenerator::Pattern pattern = TrafficGenerator::PATTERN_UNIFORM;
+	vector<double> rates;
+	unsigned int mix[3] = {1, 0, 0};
+	unsigned int dmaSize = 32;
+	int hotspotAddr = -1;
+	double hotspotFraction = 0.25;
+	unsigned int warmup = 0;
+	string curvePath;
+
+	//Latency statistics export
+	string latencyCSVPath;
+	string latencyJSONPath;
+
+	//Link utilization export
+	string linkStatsPath;
+
+	//Trace capture
+	string traceRecordPath;
+
+	//Routing tables to load over the computed ones
+	string routeTablePath;
+
+	//Checkpointing: save the state at a given cycle, or start from a saved state
+	string snapshotSavePath;
+	unsigned int snapshotTime = 0;
+	string snapshotLoadPath;
+
+	//Rendered network ("" to skip)
+	string svgPath = "/tmp/simrun.svg";
+
+	//Parameter sweep (if any values are given), results path, and number of scenarios to run at once
+	SweepRunner sweep;
+	bool sweeping = false;
+	string sweepPath = "sweep.csv";
+	unsigned int jobs = thread::hardware_concurrency();
+
+	//Zero means "not specified"
+	unsigned int hosts = 0;
 
 	//Parse command-line arguments
 	for(int i=1; i<argc; i++)
@@ -69,19 +207,189 @@ int main(int argc, char* argv[])
 
 		if(s == "--topo")
 		{
-			string t = argv[++i];
-			if(t == "quadtree")
-				topo = TOPO_QUADTREE;
-			else if(t == "xygrid")
-				topo = TOPO_XYGRID;
-			else if(t == "randomgrid")
-				topo = TOPO_RANDOMGRID;
-			else
+			topoName = argv[++i];
+			if(!ParseTopology(topoName, topo))
 			{
-				printf("Invalid topology, (must be one of: quadtree)\n");
+				printf("Invalid topology, (must be one of: quadtree, xygrid, randomgrid)\n");
 				return 0;
 			}
 		}
+		else if(s == "--hosts")
+			hosts = atoi(argv[++i]);
+		else if(s == "--grid")
+		{
+			if(2 != sscanf(argv[++i], "%ux%u", &g_gridWidth, &g_gridHeight))
+			{
+				printf("Invalid grid size (must be WxH)\n");
+				return 1;
+			}
+		}
+		else if(s == "--ports")
+			g_portCount = atoi(argv[++i]);
+		else if(s == "--switching")
+		{
+			if(!NOCRouter::ParseSwitchingMode(argv[++i], g_switching))
+			{
+				printf("Invalid switching mode (must be one of: saf, vct, wormhole)\n");
+				return 1;
+			}
+		}
+		else if(s == "--routing")
+		{
+			routingSet = true;
+			if(!GridRouter::ParseRoutingAlgorithm(argv[++i], routing))
+			{
+				printf("Invalid routing algorithm (must be one of: xy, random, west-first, odd-even)\n");
+				return 1;
+			}
+		}
+		else if(s == "--vcs")
+			g_vcCount = atoi(argv[++i]);
+		else if(s == "--link-width")
+			g_linkWidth = atoi(argv[++i]);
+		else if(s == "--fifo-depth")
+			g_fifoDepth = atoi(argv[++i]);
+		else if(s == "--nic-ring")
+			g_nicRingSize = atoi(argv[++i]);
+		else if(s == "--nic-buffers")
+			g_nicBuffers = atoi(argv[++i]);
+		else if(s == "--ram-latency")
+			g_ramLatency = atoi(argv[++i]);
+		else if(s == "--ram-bandwidth")
+			g_ramBandwidth = atof(argv[++i]);
+		else if(s == "--ram-addr")
+			ramAddr = strtol(argv[++i], NULL, 0);
+		else if(s == "--cpus")
+			cpuCount = atoi(argv[++i]);
+		else if(s == "--cpu-imiss")
+			g_cpuIMissRate = atof(argv[++i]) / 100;
+		else if(s == "--cpu-dmiss")
+			g_cpuDMissRate = atof(argv[++i]) / 100;
+		else if(s == "--cpu-syscall")
+			g_cpuSyscallRate = atof(argv[++i]) / 100;
+		else if(s == "--cpu-mshrs")
+			g_cpuMSHRs = atoi(argv[++i]);
+		else if(s == "--dual-network")
+			g_dualNetwork = true;
+		else if(s == "--dma-topo")
+		{
+			g_dualNetwork = true;
+			dmaTopoSet = true;
+			if(!ParseTopology(argv[++i], g_dmaNetwork.m_topo))
+			{
+				printf("Invalid DMA topology, (must be one of: quadtree, xygrid, randomgrid)\n");
+				return 1;
+			}
+		}
+		else if(s == "--dma-grid")
+		{
+			g_dualNetwork = true;
+			if(2 != sscanf(argv[++i], "%ux%u", &g_dmaNetwork.m_gridWidth, &g_dmaNetwork.m_gridHeight))
+			{
+				printf("Invalid DMA grid size (must be WxH)\n");
+				return 1;
+			}
+		}
+		else if(s == "--dma-ports")
+		{
+			g_dualNetwork = true;
+			g_dmaNetwork.m_portCount = atoi(argv[++i]);
+		}
+		else if(s == "--dma-routing")
+		{
+			g_dualNetwork = true;
+			dmaRoutingSet = true;
+			if(!GridRouter::ParseRoutingAlgorithm(argv[++i], g_dmaNetwork.m_routing))
+			{
+				printf("Invalid DMA routing algorithm (must be one of: xy, random, west-first, odd-even)\n");
+				return 1;
+			}
+		}
+		else if(s == "--dma-link-width")
+		{
+			g_dualNetwork = true;
+			g_dmaLinkWidth = atoi(argv[++i]);
+		}
+		else if(s == "--traffic")
+		{
+			synthetic = true;
+			if(!TrafficGenerator::ParsePattern(argv[++i], pattern))
+			{
+				printf("Invalid traffic pattern (must be one of: uniform, transpose, bitreverse, hotspot, neighbor)\n");
+				return 1;
+			}
+		}
+		else if(s == "--rate")
+		{
+			if(!ParseRates(argv[++i], rates))
+			{
+				printf("Invalid injection rate (must be a rate, a comma separated list, or start:step:end)\n");
+				return 1;
+			}
+		}
+		else if(s == "--mix")
+		{
+			if( (3 != sscanf(argv[++i], "%u:%u:%u", &mix[0], &mix[1], &mix[2])) || (mix[0] + mix[1] + mix[2] == 0) )
+			{
+				printf("Invalid traffic mix (must be rpc:dmaread:dmawrite weights)\n");
+				return 1;
+			}
+		}
+		else if(s == "--dma-size")
+			dmaSize = atoi(argv[++i]);
+		else if(s == "--hotspot")
+			hotspotAddr = strtol(argv[++i], NULL, 0);
+		else if(s == "--hotspot-fraction")
+			hotspotFraction = atof(argv[++i]);
+		else if(s == "--warmup")
+			warmup = atoi(argv[++i]);
+		else if(s == "--curve-csv")
+			curvePath = argv[++i];
+		else if(s == "--latency-csv")
+			latencyCSVPath = argv[++i];
+		else if(s == "--latency-json")
+			latencyJSONPath = argv[++i];
+		else if(s == "--link-stats")
+			linkStatsPath = argv[++i];
+		else if(s == "--pair-stats")
+			NOCPacket::EnablePairStats();
+		else if(s == "--trace-record")
+			traceRecordPath = argv[++i];
+		else if(s == "--trace-replay")
+			g_tracePath = argv[++i];
+		else if(s == "--route-table")
+			routeTablePath = argv[++i];
+		else if(s == "--snapshot-save")
+			snapshotSavePath = argv[++i];
+		else if(s == "--snapshot-time")
+			snapshotTime = atoi(argv[++i]);
+		else if(s == "--snapshot-load")
+			snapshotLoadPath = argv[++i];
+		else if(s == "--router-latency")
+			g_routerLatency = atoi(argv[++i]);
+		else if(s == "--seed")
+			g_seed = atoi(argv[++i]);
+		else if(s == "--svg")
+			svgPath = argv[++i];
+		else if(s == "--no-svg")
+			svgPath = "";
+		else if(s == "--sweep")
+		{
+			sweeping = true;
+			if(!ParseSweep(argv[++i], sweep))
+			{
+				printf("Invalid sweep (must be topo, hosts, rate, seed or router-latency, = and a list of values)\n");
+				return 1;
+			}
+		}
+		else if(s == "--sweep-csv")
+			sweepPath = argv[++i];
+		else if(s == "--jobs")
+			jobs = atoi(argv[++i]);
+		else if(s == "--cycles")
+			cycles = atoi(argv[++i]);
+		else if(s == "--threads")
+			g_scheduler.SetThreadCount(atoi(argv[++i]));
 		else
 		{
 			printf("Unrecognized command-line argument \"%s\"\n", s.c_str());
@@ -89,138 +397,809 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	//Parameter sweep: anything not being swept comes from the rest of the command line. Each scenario comes back here
+	//in its own process and carries on as a normal single run
+	if(sweeping)
+	{
+		if(!synthetic)
+		{
+			printf("Sweeps need synthetic traffic (--traffic)\n");
+			return 1;
+		}
+		if( (curvePath != "") || (latencyCSVPath != "") || (latencyJSONPath != "") || (linkStatsPath != "") ||
+			(traceRecordPath != "") || (snapshotSavePath != "") || (snapshotLoadPath != "") )
+		{
+			printf("Sweeps only write the combined results (--sweep-csv), not per-run files\n");
+			return 1;
+		}
+
+		if(sweep.m_topos.empty())
+			sweep.m_topos.push_back(topoName);
+		if(sweep.m_hosts.empty())
+			sweep.m_hosts.push_back(hosts);
+		if(sweep.m_rates.empty())
+			sweep.m_rates = rates.empty() ? vector<double>(1, 0.01) : rates;
+		if(sweep.m_seeds.empty())
+			sweep.m_seeds.push_back(g_seed);
+		if(sweep.m_routerLatencies.empty())
+			sweep.m_routerLatencies.push_back(g_routerLatency);
+
+		g_log_sinks.emplace(g_log_sinks.begin(), new ColoredSTDLogSink(console_verbosity));
+
+		bool child;
+		SweepRunner::Scenario scenario;
+		bool ok = sweep.Run(max(jobs, 1u), sweepPath, child, scenario);
+		if(!child)
+			return ok ? 0 : 1;
+
+		//We're running one scenario. The parent reports the results, so we only need to say if something goes wrong
+		g_log_sinks.clear();
+		console_verbosity = Severity::WARNING;
+		ParseTopology(scenario.m_topo, topo);
+		hosts = scenario.m_hosts;
+		rates.assign(1, scenario.m_rate);
+		g_seed = scenario.m_seed;
+		g_routerLatency = scenario.m_routerLatency;
+		svgPath = "";
+	}
+
+	if( (g_linkWidth == 0) || (g_fifoDepth == 0) || (g_vcCount == 0) )
+	{
+		printf("Link width, FIFO depth and VC count must be nonzero\n");
+		return 1;
+	}
+
+	if( (g_nicRingSize == 0) || (g_nicBuffers == 0) || (g_ramBandwidth < 0) )
+	{
+		printf("NIC ring size and buffer count must be nonzero, and RAM bandwidth can't be negative\n");
+		return 1;
+	}
+
+	if( (g_cpuMSHRs == 0) || (g_cpuIMissRate < 0) || (g_cpuDMissRate < 0) || (g_cpuSyscallRate < 0) )
+	{
+		printf("CPU MSHR count must be nonzero, and miss/syscall rates can't be negative\n");
+		return 1;
+	}
+
+	if(routingSet && (topo == TOPO_QUADTREE) )
+	{
+		printf("--routing is only meaningful for grid topologies\n");
+		return 1;
+	}
+	if(!routingSet && (topo == TOPO_RANDOMGRID) )
+		routing = GridRouter::ROUTE_RANDOM;
+
+	//Figure out the final network dimensions
+	if(!SizeNetwork(topo, g_portCount, g_gridWidth, g_gridHeight, hosts, ""))
+		return 1;
+	g_hostCount = hosts;
+
+	//Network addresses are 16 bits, and the workload needs a NIC, a RAM and at least one CPU
+	if( (g_hostCount < 3) || (g_hostCount > 65536) )
+	{
+		printf("Host count must be between 3 (NIC, RAM and one CPU) and 65536\n");
+		return 1;
+	}
+
+	//The DMA network has to connect to the same hosts, but can be shaped differently
+	if(g_dualNetwork)
+	{
+		if(!dmaTopoSet)
+			g_dmaNetwork.m_topo = topo;
+		if(!dmaRoutingSet)
+			g_dmaNetwork.m_routing = (g_dmaNetwork.m_topo == TOPO_RANDOMGRID) ? GridRouter::ROUTE_RANDOM : routing;
+		if(g_dmaLinkWidth == 0)
+			g_dmaLinkWidth = g_linkWidth;
+
+		if(dmaRoutingSet && (g_dmaNetwork.m_topo == TOPO_QUADTREE) )
+		{
+			printf("--dma-routing is only meaningful for grid topologies\n");
+			return 1;
+		}
+
+		unsigned int dmaHosts = g_hostCount;
+		if(!SizeNetwork(g_dmaNetwork.m_topo, g_dmaNetwork.m_portCount, g_dmaNetwork.m_gridWidth,
+			g_dmaNetwork.m_gridHeight, dmaHosts, "dma-"))
+		{
+			return 1;
+		}
+	}
+
+	//Store-and-forward and virtual cut-through need room for a whole packet in a FIFO, or it can never be sent.
+	//Check the largest packets the workload models and traffic generator can send, on whichever network they use
+	vector<NOCPacket> largest;
+	if(g_tracePath == "")
+	{
+		largest.push_back(NOCPacket(0, 0, NOCNicHost::GetMaxWriteSize(), NOCPacket::TYPE_DMA_WRITE, 3));
+		largest.push_back(NOCPacket(0, 0, 3 + NOCCpuHost::m_lineSize, NOCPacket::TYPE_DMA_RDATA));
+		largest.push_back(NOCPacket(0, 0, 4, NOCPacket::TYPE_RPC_CALL));
+	}
+	if(synthetic && (mix[1] != 0) )
+		largest.push_back(NOCPacket(0, 0, 3 + dmaSize, NOCPacket::TYPE_DMA_RDATA));
+	if(synthetic && (mix[2] != 0) )
+		largest.push_back(NOCPacket(0, 0, 3 + dmaSize, NOCPacket::TYPE_DMA_WRITE, 3));
+	for(auto& p : largest)
+	{
+		if(!NOCRouter::IsSendable(p.GetFlitCount()))
+		{
+			printf("%u-word %s messages take %u flits, more than the FIFO depth (%u) allows with %s switching\n",
+				p.m_size, NOCPacket::GetTypeName(p.m_type), p.GetFlitCount(), g_fifoDepth,
+				NOCRouter::GetSwitchingModeName(g_switching));
+			return 1;
+		}
+	}
+
+	//Put the special hosts at the start, middle, and end of the address space
+	g_nicAddr = 0;
+	g_ramAddr = g_hostCount / 2;
+	if(ramAddr >= 0)
+	{
+		if( (ramAddr == g_nicAddr) || (ramAddr >= static_cast<int>(g_hostCount)) )
+		{
+			printf("RAM address must be between 1 and %u\n", g_hostCount - 1);
+			return 1;
+		}
+		g_ramAddr = ramAddr;
+	}
+	if( (cpuCount == 0) || (cpuCount > g_hostCount - 2) )
+	{
+		printf("CPU count must be between 1 and %u\n", g_hostCount - 2);
+		return 1;
+	}
+
+	//CPUs are spread evenly, working down from the end. Skip over anything that's already taken.
+	unsigned int cpuStride = g_hostCount / cpuCount;
+	for(unsigned int i=0; i<cpuCount; i++)
+	{
+		uint16_t addr = g_hostCount - 1 - i*cpuStride;
+		while( (addr == g_nicAddr) || (addr == g_ramAddr) || IsCPUAddress(addr) )
+			addr = (addr == 0) ? (g_hostCount - 1) : (addr - 1);
+		g_cpuAddrs.push_back(addr);
+	}
+	g_cpuAddr = g_cpuAddrs[0];
+
 	//Reset RNG
-	srand(0);
+	srand(g_seed);
 
 	//Set up logging
 	g_log_sinks.emplace(g_log_sinks.begin(), new ColoredSTDLogSink(console_verbosity));
 
-	//Fun stuff here!
-	switch(topo)
+	//Default to a single run
+	if(rates.empty())
+		rates.push_back(0.01);
+	if(warmup >= cycles)
 	{
-		case TOPO_QUADTREE:
-			CreateQuadtreeNetwork();
+		printf("Warmup period must be shorter than the simulation\n");
+		return 1;
+	}
+	if(synthetic && (g_tracePath != "") )
+	{
+		printf("Can't generate synthetic traffic and replay a trace at the same time\n");
+		return 1;
+	}
+	if( (traceRecordPath != "") && (rates.size() > 1) )
+	{
+		printf("Can only record a trace of a single run\n");
+		return 1;
+	}
+
+	bool snapshotting = (snapshotSavePath != "") || (snapshotLoadPath != "");
+	if(snapshotting && (rates.size() > 1) )
+	{
+		printf("Snapshots can only be used with a single run\n");
+		return 1;
+	}
+	if( (snapshotSavePath != "") && ( (snapshotTime == 0) || (snapshotTime >= cycles) ) )
+	{
+		printf("--snapshot-save needs a --snapshot-time after the start and before the end of the simulation\n");
+		return 1;
+	}
+
+	//Open latency stats files (one row/object per run)
+	FILE* latencyCSV = NULL;
+	FILE* latencyJSON = NULL;
+	if(latencyCSVPath != "")
+	{
+		latencyCSV = fopen(latencyCSVPath.c_str(), "w");
+		if(!latencyCSV)
+		{
+			LogError("Couldn't open %s\n", latencyCSVPath.c_str());
+			return 1;
+		}
+	}
+	if(latencyJSONPath != "")
+	{
+		latencyJSON = fopen(latencyJSONPath.c_str(), "w");
+		if(!latencyJSON)
+		{
+			LogError("Couldn't open %s\n", latencyJSONPath.c_str());
+			return 1;
+		}
+		fprintf(latencyJSON, "[\n");
+	}
+
+	FILE* linkStats = NULL;
+	if(linkStatsPath != "")
+	{
+		linkStats = fopen(linkStatsPath.c_str(), "w");
+		if(!linkStats)
+		{
+			LogError("Couldn't open %s\n", linkStatsPath.c_str());
+			return 1;
+		}
+		fprintf(linkStats, "run,router,port,peer,tx_cycles,tx_util,rx_cycles,rx_util,inbox_cycles,inbox_util,credit_stall_cycles,blocked_cycles\n");
+	}
+
+	//Run the simulation once per injection rate (or just once, if we're not generating synthetic traffic)
+	vector<double> offered;
+	vector<double> accepted;
+	vector<double> latency;
+	vector<unsigned int> latency99;
+	for(unsigned int run = 0; run < rates.size(); run ++)
+	{
+		double rate = rates[run];
+		if(synthetic)
+		{
+			g_trafficGenerator = new TrafficGenerator(pattern, rate);
+			g_trafficGenerator->SetMix(mix[0], mix[1], mix[2]);
+			g_trafficGenerator->SetDMASize(dmaSize);
+			g_trafficGenerator->SetHotspot( (hotspotAddr < 0) ? g_ramAddr : hotspotAddr, hotspotFraction);
+			g_trafficGenerator->SetWarmup(warmup);
+		}
+
+		//Fun stuff here!
+		if(!CreateNetwork(topo, routing))
+			return 1;
+		if( (routeTablePath != "") && !LoadRouteTables(routeTablePath) )
+			return 1;
+		if(g_tracePath != "")
+		{
+			g_tracePlayer = new PacketTracePlayer(g_simNodes);
+			g_simNodes.push_back(g_tracePlayer);
+			if(!g_tracePlayer->Open(g_tracePath))
+				return 1;
+		}
+		if(traceRecordPath != "")
+		{
+			g_traceWriter = new PacketTraceWriter;
+			if(!g_traceWriter->Open(traceRecordPath))
+				return 1;
+		}
+
+		//Times are absolute, so a restored run carries on from where the snapshot was taken
+		if( (snapshotLoadPath != "") && !LoadSnapshot(snapshotLoadPath, topo, routing) )
+			return 1;
+		if( (snapshotSavePath != "") && (snapshotTime <= g_time) )
+		{
+			LogError("Snapshot time %u is before the restored state (cycle %u)\n", snapshotTime, g_time);
+			return 1;
+		}
+		if(cycles <= g_time)
+		{
+			LogError("Simulation ends at cycle %u, before the restored state (cycle %u)\n", cycles, g_time);
+			return 1;
+		}
+		if(snapshotSavePath != "")
+		{
+			RunSimulation(snapshotTime);
+			if(!SaveSnapshot(snapshotSavePath, topo, routing))
+				return 1;
+		}
+		RunSimulation(cycles);
+		PrintStats();
+		if(svgPath != "")
+			RenderOutput(svgPath);
+
+		if(g_trafficGenerator)
+		{
+			offered.push_back(g_trafficGenerator->GetOfferedLoad());
+			accepted.push_back(g_trafficGenerator->GetAcceptedThroughput());
+			latency.push_back(g_trafficGenerator->GetAverageLatency());
+			latency99.push_back(g_trafficGenerator->GetLatencyPercentile(99));
+		}
+
+		if(latencyCSV)
+			NOCPacket::WriteStatsCSV(latencyCSV, run);
+		if(latencyJSON)
+		{
+			if(run != 0)
+				fprintf(latencyJSON, ",\n");
+			NOCPacket::WriteStatsJSON(latencyJSON, run);
+		}
+		if(linkStats)
+		{
+			vector<LinkStats> stats;
+			GetLinkStats(stats);
+			NOCRouter::WriteLinkStatsCSV(linkStats, run, stats);
+		}
+
+		ResetSimulation();
+
+		if(!synthetic)
 			break;
+	}
 
-		case TOPO_XYGRID:
-			CreateGridNetwork(false);
+	//Running one scenario of a sweep? Hand the results back
+	if(sweeping)
+	{
+		sweep.SendResult(offered[0], accepted[0], latency[0], latency99[0]);
+		return 0;
+	}
+
+	if(latencyCSV)
+		fclose(latencyCSV);
+	if(linkStats)
+		fclose(linkStats);
+	if(latencyJSON)
+	{
+		fprintf(latencyJSON, "\n]\n");
+		fclose(latencyJSON);
+	}
+
+	//Print the load-latency curve
+	if(synthetic)
+	{
+		LogNotice("\n\nLoad curve (%s traffic):\n", TrafficGenerator::GetPatternName(pattern));
+		LogIndenter li;
+		LogNotice("Rate in packets/host/cycle, Offered/Accepted in words/host/cycle, Latency/p99 in cycles\n");
+		LogNotice("Rate        Offered     Accepted    Latency     p99\n");
+		for(size_t i=0; i<rates.size(); i++)
+		{
+			LogNotice("%-10.4f  %-10.4f  %-10.4f  %-10.2f  %u\n",
+				rates[i], offered[i], accepted[i], latency[i], latency99[i]);
+		}
+
+		if(curvePath != "")
+		{
+			FILE* fp = fopen(curvePath.c_str(), "w");
+			if(!fp)
+			{
+				LogError("Couldn't open %s\n", curvePath.c_str());
+				return 1;
+			}
+			fprintf(fp, "rate,offered,accepted,latency,p99\n");
+			for(size_t i=0; i<rates.size(); i++)
+				fprintf(fp, "%f,%f,%f,%f,%u\n", rates[i], offered[i], accepted[i], latency[i], latency99[i]);
+			fclose(fp);
+		}
+	}
+
+	//All good
+	return 0;
+}
+
+/**
+	@brief Parse a list of injection rates: either a single value, a comma separated list, or start:step:end
+ */
+bool ParseRates(string s, vector<double>& rates)
+{
+	if(!ParseValues(s, rates))
+		return false;
+
+	for(auto r : rates)
+	{
+		if( (r <= 0) || (r > 1) )
+			return false;
+	}
+	return true;
+}
+
+/**
+	@brief Parse a list of numbers: either a single value, a comma separated list, or start:step:end
+ */
+bool ParseValues(string s, vector<double>& values)
+{
+	double start;
+	double step;
+	double end;
+	if(3 == sscanf(s.c_str(), "%lf:%lf:%lf", &start, &step, &end))
+	{
+		if(step <= 0)
+			return false;
+
+		//Fudge factor so rounding doesn't eat the last point
+		for(double r = start; r <= end + step/1000; r += step)
+			values.push_back(r);
+	}
+	else
+	{
+		size_t pos = 0;
+		while(pos < s.length())
+		{
+			size_t comma = s.find(',', pos);
+			if(comma == string::npos)
+				comma = s.length();
+			values.push_back(atof(s.substr(pos, comma - pos).c_str()));
+			pos = comma + 1;
+		}
+	}
+
+	return !values.empty();
+}
+
+bool ParseTopology(string s, Topologies& topo)
+{
+	if(s == "quadtree")
+		topo = TOPO_QUADTREE;
+	else if(s == "xygrid")
+		topo = TOPO_XYGRID;
+	else if(s == "randomgrid")
+		topo = TOPO_RANDOMGRID;
+	else
+		return false;
+	return true;
+}
+
+/**
+	@brief Parse one swept parameter: the name, =, and a list of values (a comma separated list, or start:step:end for
+	numeric parameters)
+ */
+bool ParseSweep(string s, SweepRunner& sweep)
+{
+	size_t eq = s.find('=');
+	if(eq == string::npos)
+		return false;
+	string name = s.substr(0, eq);
+	string values = s.substr(eq + 1);
+
+	if(name == "topo")
+	{
+		size_t pos = 0;
+		while(pos < values.length())
+		{
+			size_t comma = values.find(',', pos);
+			if(comma == string::npos)
+				comma = values.length();
+			string t = values.substr(pos, comma - pos);
+			Topologies topo;
+			if(!ParseTopology(t, topo))
+				return false;
+			sweep.m_topos.push_back(t);
+			pos = comma + 1;
+		}
+		return !sweep.m_topos.empty();
+	}
+
+	if(name == "rate")
+		return ParseRates(values, sweep.m_rates);
+
+	vector<unsigned int>* list = NULL;
+	if(name == "hosts")
+		list = &sweep.m_hosts;
+	else if(name == "seed")
+		list = &sweep.m_seeds;
+	else if(name == "router-latency")
+		list = &sweep.m_routerLatencies;
+	else
+		return false;
+
+	vector<double> v;
+	if(!ParseValues(values, v))
+		return false;
+	for(auto x : v)
+	{
+		if(x < 0)
+			return false;
+		list->push_back(lround(x));
+	}
+	return true;
+}
+
+/**
+	@brief Fill in the dimensions of a network that weren't specified, and check that it's valid
+
+	@param topo		Topology of the network
+	@param ports	Ports per router (tree radix for quadtrees), zero for the default
+	@param width	Grid width (zero to pick one)
+	@param height	Grid height
+	@param hosts	Host count (zero for the default, or to fill the grid)
+	@param prefix	Prefix of the command line options for the network, for error messages
+ */
+bool SizeNetwork(Topologies topo, unsigned int& ports, unsigned int& width, unsigned int& height, unsigned int& hosts,
+	const char* prefix)
+{
+	if(topo == TOPO_QUADTREE)
+	{
+		if(ports == 0)
+			ports = 4;
+		if( (ports < 2) || (ports & (ports - 1)) )
+		{
+			printf("Tree radix must be a power of two\n");
+			return false;
+		}
+		if(width != 0)
+		{
+			printf("--%sgrid is only meaningful for grid topologies\n", prefix);
+			return false;
+		}
+		if(hosts == 0)
+			hosts = g_hostCount;
+
+		//The tree is padded out to a power of the radix, and that has to fit in the address space
+		unsigned long long size = ports;
+		while(size < hosts)
+			size *= ports;
+		if(size > 65536)
+		{
+			printf("A radix-%u tree for %u hosts needs %llu leaves, more than the 65536 addresses available\n",
+				ports, hosts, size);
+			return false;
+		}
+		return true;
+	}
+
+	if(ports == 0)
+		ports = 16;
+
+	//Grid size specified? Default to filling it
+	if(width != 0)
+	{
+		unsigned int capacity = width * height * ports;
+		if(hosts == 0)
+			hosts = capacity;
+		else if(hosts > capacity)
+		{
+			printf("%u hosts won't fit in a %ux%u grid with %u ports per router\n", hosts, width, height, ports);
+			return false;
+		}
+	}
+
+	//If not, make the grid as close to square as we can
+	else
+	{
+		if(hosts == 0)
+			hosts = g_hostCount;
+		unsigned int nrouters = (hosts + ports - 1) / ports;
+		width = ceil(sqrt(nrouters));
+		height = (nrouters + width - 1) / width;
+	}
+
+	if( (width == 0) || (height == 0) || (ports == 0) )
+	{
+		printf("Grid dimensions must be nonzero\n");
+		return false;
+	}
+	if(width * height * ports > 65536)
+	{
+		printf("Grid is too big for a 16-bit address space\n");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+	@brief Create the network for the selected topology, and the DMA network too in dual-network mode
+ */
+bool CreateNetwork(Topologies topo, GridRouter::RoutingAlgorithm routing)
+{
+	LogNotice("Using %s switching with %u-bit links and %u virtual channels of %u flits per input\n",
+		NOCRouter::GetSwitchingModeName(g_switching), g_linkWidth, g_vcCount, g_fifoDepth);
+
+	NetworkConfig config = {topo, routing, g_portCount, g_gridWidth, g_gridHeight};
+	if(!CreateNetwork(config, 0, 0, vector<NOCHost*>()))
+		return false;
+	if(!g_dualNetwork)
+		return true;
+
+	//The hosts exist now, so look them up to connect them to the DMA network.
+	//Draw the DMA network underneath the RPC network.
+	vector<NOCHost*> hosts(g_hostCount, NULL);
+	unsigned int width = 0;
+	unsigned int height = 0;
+	for(auto n : g_simNodes)
+	{
+		n->ExpandBoundingBox(width, height);
+		auto host = dynamic_cast<NOCHost*>(n);
+		if(host)
+			hosts[host->GetAddress()] = host;
+	}
+
+	LogNotice("DMA traffic uses a separate network with %u-bit links\n", g_dmaLinkWidth);
+	return CreateNetwork(g_dmaNetwork, 1, height + 50, hosts);
+}
+
+/**
+	@brief Create one network
+
+	@param config	Shape of the network
+	@param network	Network number (0 for RPC, 1 for DMA)
+	@param yoffset	Vertical offset for rendering
+	@param hosts	Hosts to connect to the DMA network, indexed by address (the RPC network creates the hosts)
+ */
+bool CreateNetwork(const NetworkConfig& config, unsigned int network, unsigned int yoffset,
+	const vector<NOCHost*>& hosts)
+{
+	switch(config.m_topo)
+	{
+		case TOPO_QUADTREE:
+			CreateQuadtreeNetwork(config, network, yoffset, hosts);
 			break;
 
+		case TOPO_XYGRID:
 		case TOPO_RANDOMGRID:
-			CreateGridNetwork(true);
+			CreateGridNetwork(config, network, yoffset, hosts);
 			break;
 
 		default:
 			LogError("Invalid topology, can't run sim\n");
-			return 0;
+			return false;
 	}
-	RunSimulation();
-	PrintStats();
-	RenderOutput();
 
-	//Clean up
+	return true;
+}
+
+/**
+	@brief Delete all nodes and clear statistics so we can run another simulation
+ */
+void ResetSimulation()
+{
 	for(auto p : g_simNodes)
 		delete p;
 	g_simNodes.clear();
+	g_tracePlayer = NULL;
 
-	//All good
-	return 0;
+	delete g_trafficGenerator;
+	g_trafficGenerator = NULL;
+
+	//Closing the trace writer flushes it
+	delete g_traceWriter;
+	g_traceWriter = NULL;
+
+	g_scheduler.Reset();
+	NOCPacket::ResetStats();
+	g_time = 0;
 }
 
 /**
-	@brief Create a network using the grid topology, with either X-then-Y or pseudorandom routing
+	@brief Check if there's a CPU at the specified address
  */
-void CreateGridNetwork(bool randomize)
+bool IsCPUAddress(uint16_t addr)
 {
-	LogNotice("Creating network (2D grid topology, with %s routing) with %d hosts\n",
-		randomize ? "pseudorandom" : "X-Y",
+	return find(g_cpuAddrs.begin(), g_cpuAddrs.end(), addr) != g_cpuAddrs.end();
+}
+
+/**
+	@brief Create a host at the specified address.
+
+	Special hosts go at a few addresses, then random stuff after that. When replaying a trace, all of the traffic
+	comes from the trace, so every host is a plain one.
+ */
+NOCHost* CreateHost(uint16_t addr, NOCRouter* parent, xypos pos)
+{
+	NOCHost* host = NULL;
+	if(g_tracePath != "")
+		host = new NOCHost(addr, parent, pos);
+	else if(addr == g_ramAddr)
+		host = new NOCRamHost(addr, parent, pos);
+	else if(IsCPUAddress(addr))
+		host = new NOCCpuHost(addr, parent, pos);
+	else if(addr == g_nicAddr)
+		host = new NOCNicHost(addr, parent, pos);
+	else
+		host = new NOCHost(addr, parent, pos);
+
+	g_simNodes.push_back(host);
+	return host;
+}
+
+/**
+	@brief Create the host at an address (on the RPC network) or connect the existing one (on the DMA network)
+ */
+NOCHost* AttachHost(uint16_t addr, NOCRouter* router, unsigned int network, const vector<NOCHost*>& hosts, xypos pos)
+{
+	if(network == 0)
+		return CreateHost(addr, router, pos);
+
+	auto host = hosts[addr];
+	host->ConnectDMANetwork(router);
+	return host;
+}
+
+/**
+	@brief Create a network using the grid topology, with the specified routing algorithm
+ */
+void CreateGridNetwork(const NetworkConfig& config, unsigned int network, unsigned int yoffset,
+	const vector<NOCHost*>& hosts)
+{
+	unsigned int ports = config.m_portCount;
+	unsigned int width = config.m_gridWidth;
+	unsigned int height = config.m_gridHeight;
+	LogNotice("Creating %s (%u x %u grid topology, with %s routing) with %d hosts\n",
+		network ? "DMA network" : "network",
+		width,
+		height,
+		GridRouter::GetRoutingAlgorithmName(config.m_routing),
 		g_hostCount);
 	LogIndenter li;
 
 	/*
-		256 hosts in the network
-
-		Have a 4x4 grid of routers with 16 addresses under each one
+		Have a WxH grid of routers with P addresses under each one.
+		Routers are numbered left to right, then top to bottom.
 
 		Address mapping:
-		a[15:8] = unused
-		a[7:6] = Y
-		a[5:4] = X
-		a[3:0] = port
+		router = addr / P
+		X = router % W
+		Y = router / W
+		port = addr % P
+
+		If the host count isn't a multiple of P, the last few ports are left empty.
 	 */
 	unsigned int nodesize = 10;
 	unsigned int nodepitch = 25;
-	unsigned int routerpitch = 450;
-	GridRouter* routers[4][4];
-	for(int y=0; y<4; y++)
+	unsigned int routerpitch = max(450u, (ports + 2) * nodepitch);
+	vector< vector<GridRouter*> > routers(height, vector<GridRouter*>(width, NULL));
+	unsigned int nhosts = 0;
+	for(unsigned int y=0; y<height; y++)
 	{
-		for(int x=0; x<4; x++)
+		for(unsigned int x=0; x<width; x++)
 		{
 			//Create the router
-			uint16_t addr = (y << 6) | (x << 4);
-			unsigned int xbase = x*routerpitch + nodesize + 8*nodepitch;
-			unsigned int ypos = y*routerpitch + nodesize;
-			auto router = new GridRouter(addr, addr+15, xypos(xbase, ypos), randomize);
-			g_simNodes.emplace(router);
+			uint16_t addr = (y*width + x) * ports;
+			unsigned int xbase = x*routerpitch + nodesize + (ports/2)*nodepitch;
+			unsigned int ypos = y*routerpitch + nodesize + yoffset;
+			auto router = new GridRouter(
+				addr, addr + ports - 1, x, y, width, xypos(xbase, ypos), config.m_routing);
+			router->SetNetwork(network);
+			g_simNodes.push_back(router);
 			routers[y][x] = router;
 
 			//move children down half a row
 			ypos += routerpitch/2;
 
 			//Create child nodes
-			for(int i=0; i<16; i++)
+			for(unsigned int i=0; i<ports; i++)
 			{
-				uint16_t cbase = addr | i;
-
-				unsigned int xpos = xbase + i*nodepitch - 7.5*nodepitch;
-
-				//Create special hosts at a few addresses, then random stuff after that
-				NOCHost* child = NULL;
-				if(cbase == RAM_ADDR)
-					child = new NOCRamHost(cbase, router, xypos(xpos, ypos) );
-				else if(cbase == CPU_ADDR)
-					child = new NOCCpuHost(cbase, router, xypos(xpos, ypos) );
-				else if(cbase == NIC_ADDR)
-					child = new NOCNicHost(cbase, router, xypos(xpos, ypos) );
-				else
-					child = new NOCHost(cbase, router, xypos(xpos, ypos) );
+				unsigned int cbase = addr + i;
+				if(cbase >= g_hostCount)
+					break;
 
-				router->AddChild(child);
-
-				//Done
-				g_simNodes.emplace(child);
+				unsigned int xpos = xbase + i*nodepitch - (ports - 1)*nodepitch/2;
+				router->AddChild(AttachHost(cbase, router, network, hosts, xypos(xpos, ypos)));
+				nhosts ++;
 			}
 		}
 	}
 
 	//Connect the routers to each other
-	for(int y=0; y<4; y++)
+	for(unsigned int y=0; y<height; y++)
 	{
-		for(int x=0; x<4; x++)
+		for(unsigned int x=0; x<width; x++)
 		{
 			GridRouter* r = routers[y][x];
 			if(y > 0)
 				r->AddNeighbor(0, routers[y-1][x]);
-			if(x < 3)
+			if(x+1 < width)
 				r->AddNeighbor(1, routers[y][x+1]);
-			if(y < 3)
+			if(y+1 < height)
 				r->AddNeighbor(2, routers[y+1][x]);
 			if(x > 0)
 				r->AddNeighbor(3, routers[y][x-1]);
 		}
 	}
 
-	LogVerbose("Created %d routers\n", 16);
-	LogVerbose("Created %d hosts\n", 256);
+	LogVerbose("Created %u routers\n", width * height);
+	LogVerbose("Created %u hosts\n", nhosts);
 }
 
 /**
-	@brief Create a network using the quadtree topology
+	@brief Create a network using the quadtree topology (or more generally, a tree with config.m_portCount children
+	per router).
+
+	If the host count isn't a power of the radix, the tree is sized up to the next power and the unused leaves (and any
+	routers with nothing under them) are left out.
  */
-void CreateQuadtreeNetwork()
+void CreateQuadtreeNetwork(const NetworkConfig& config, unsigned int network, unsigned int yoffset,
+	const vector<NOCHost*>& hosts)
 {
-	set<QuadtreeRouter*> routers;
-	set<QuadtreeRouter*> new_routers;
+	unsigned int ports = config.m_portCount;
+	vector<QuadtreeRouter*> routers;
+	vector<QuadtreeRouter*> new_routers;
+
+	//Size of the root subnet
+	unsigned int size = ports;
+	while(size < g_hostCount)
+		size *= ports;
 
 	//Column pitch of the nodes at the bottom level of the tree, also row pitch
 	unsigned int pitch = 30;
@@ -230,25 +1209,26 @@ void CreateQuadtreeNetwork()
 	unsigned int left = nodesize/2;
 
 	//X center position of the rightmost host
-	unsigned int right = left + (g_hostCount - 1)*pitch;
+	unsigned int right = left + (size - 1)*pitch;
 
 	//Y center position of the topmost router
-	unsigned int top = nodesize/2;
+	unsigned int top = nodesize/2 + yoffset;
 
 	//Seed things by creating a root router
-	unsigned int size = g_hostCount;
 	unsigned int mask = 0xffff & ~(size - 1);
 	unsigned int base = 0;
-	auto root = new QuadtreeRouter(NULL, base, base + size - 1, mask, xypos( (left + right)/2, top) );
-	g_simNodes.emplace(root);
-	routers.emplace(root);
+	auto root = new QuadtreeRouter(NULL, base, base + size - 1, mask, ports, xypos( (left + right)/2, top) );
+	root->SetNetwork(network);
+	g_simNodes.push_back(root);
+	routers.push_back(root);
 
-	LogNotice("Creating network (quadtree topology) with %d hosts\n", root->GetSubnetSize());
+	LogNotice("Creating %s (radix-%u tree topology) with %u hosts\n",
+		network ? "DMA network" : "network", ports, g_hostCount);
 	LogIndenter li;
 
 	//Create each row of the tree
 	bool done = false;
-	int nrouters = 0;
+	int nrouters = 1;
 	int nhosts = 0;
 	while(!done)
 	{
@@ -256,46 +1236,45 @@ void CreateQuadtreeNetwork()
 		new_routers.clear();
 		top += pitch;
 
-		//For each parent router in our list, add four child nodes
+		//For each parent router in our list, add child nodes
 		for(auto r : routers)
 		{
-			//Figure out the new subnet size and mask
-			size = r->GetSubnetSize() / 4;
+			//Figure out the new subnet size and mask.
+			//SizeNetwork() makes sure the tree fits, but never loop forever if it somehow doesn't.
+			size = r->GetSubnetSize() / ports;
+			if(size == 0)
+			{
+				LogError("Router subnet is smaller than the tree radix, giving up\n");
+				done = true;
+				break;
+			}
 			mask = 0xffff & ~(size - 1);
 			base = r->GetSubnetBase();
 
 			//Create the new routers
-			for(int i=0; i<4; i++)
+			for(unsigned int i=0; i<ports; i++)
 			{
 				unsigned int cbase = base + i*size;
-				unsigned int rowpitch = pitch * size;
-				unsigned int xpos = r->m_renderPosition.first + (i-1)*rowpitch - rowpitch/2;
+				if(cbase >= g_hostCount)
+					break;
+
+				int rowpitch = pitch * size;
+				unsigned int xpos = r->m_renderPosition.first + ( (2*(int)i + 1 - (int)ports) * rowpitch)/2;
 
 				//If child subnet size is 1, create hosts instead
 				if(size == 1)
 				{
-					//Create special hosts at a few addresses, then random stuff after that
-					NOCHost* child = NULL;
-					if(cbase == RAM_ADDR)
-						child = new NOCRamHost(cbase, r, xypos(xpos, top) );
-					else if(cbase == CPU_ADDR)
-						child = new NOCCpuHost(cbase, r, xypos(xpos, top) );
-					else if(cbase == NIC_ADDR)
-						child = new NOCNicHost(cbase, r, xypos(xpos, top) );
-					else
-						child = new NOCHost(cbase, r, xypos(xpos, top) );
-
-					//Done
-					g_simNodes.emplace(child);
+					AttachHost(cbase, r, network, hosts, xypos(xpos, top) );
 					nhosts ++;
 				}
 
 				else
 				{
-					auto child = new QuadtreeRouter(r, cbase, cbase + size - 1, mask, xypos(xpos, top) );
+					auto child = new QuadtreeRouter(r, cbase, cbase + size - 1, mask, ports, xypos(xpos, top) );
 					//LogDebug("Creating router at %u (size %u)\n", cbase, size);
-					g_simNodes.emplace(child);
-					new_routers.emplace(child);
+					child->SetNetwork(network);
+					g_simNodes.push_back(child);
+					new_routers.push_back(child);
 					nrouters ++;
 				}
 			}
@@ -312,17 +1291,242 @@ void CreateQuadtreeNetwork()
 	LogVerbose("Created %d hosts\n", nhosts);
 }
 
+/**
+	@brief Load routing tables (e.g. generated from the RTL) over the ones the routers computed.
+
+	One route per line: the router's subnet as "low-high", a destination address, and the output port number, with
+	addresses in hex. Each route covers all of the addresses the router treats alike (the whole subnet of a child, or
+	everything under another grid router), so any address in the block will do. Blank lines and lines starting with
+	# are ignored.
+
+	Routes that differ from the computed ones are reported, so the RTL and the model can be checked against each
+	other. Adaptive grid routing only uses the table for its preferred route. In dual-network mode, the tables are for
+	the RPC network.
+ */
+bool LoadRouteTables(string path)
+{
+	FILE* fp = fopen(path.c_str(), "r");
+	if(!fp)
+	{
+		LogError("Couldn't open %s\n", path.c_str());
+		return false;
+	}
+
+	//Look up routers by subnet
+	map< pair<unsigned int, unsigned int>, NOCRouter* > routers;
+	for(auto n : g_simNodes)
+	{
+		auto r = dynamic_cast<NOCRouter*>(n);
+		if(!r || (r->GetNetwork() != 0) )
+			continue;
+		unsigned int base = r->GetSubnetBase();
+		routers[pair<unsigned int, unsigned int>(base, base + r->GetSubnetSize() - 1)] = r;
+	}
+
+	LogNotice("Loading routing tables from %s\n", path.c_str());
+	LogIndenter li;
+
+	char line[256];
+	unsigned int nline = 0;
+	unsigned int nroutes = 0;
+	unsigned int ndiffs = 0;
+	bool ok = true;
+	while(fgets(line, sizeof(line), fp))
+	{
+		nline ++;
+
+		const char* p = line;
+		while(isspace(*p))
+			p++;
+		if( (*p == '\0') || (*p == '#') )
+			continue;
+
+		unsigned int low;
+		unsigned int high;
+		unsigned int addr;
+		unsigned int port;
+		if(4 != sscanf(p, "%x-%x %x %u", &low, &high, &addr, &port))
+		{
+			LogError("%s:%u: malformed route\n", path.c_str(), nline);
+			ok = false;
+			break;
+		}
+
+		auto it = routers.find(pair<unsigned int, unsigned int>(low, high));
+		if(it == routers.end())
+		{
+			LogError("%s:%u: no router with subnet %04x-%04x\n", path.c_str(), nline, low, high);
+			ok = false;
+			break;
+		}
+
+		unsigned int oldPort;
+		if( (addr >= g_hostCount) || !it->second->SetRoute(addr, port, oldPort) )
+		{
+			LogError("%s:%u: invalid route (to %04x via port %u)\n", path.c_str(), nline, addr, port);
+			ok = false;
+			break;
+		}
+
+		nroutes ++;
+		if(oldPort != port)
+		{
+			LogVerbose("Router %s: route to %04x is port %u (computed port %u)\n",
+				it->second->GetName().c_str(), addr, port, oldPort);
+			ndiffs ++;
+		}
+	}
+	fclose(fp);
+
+	if(ok)
+		LogNotice("Loaded %u routes (%u differ from the computed tables)\n", nroutes, ndiffs);
+	return ok;
+}
+
 /**
 	@brief Run the discrete event simulation
  */
-void RunSimulation()
+void RunSimulation(unsigned int cycles)
+{
+	LogNotice("Running simulation for %u cycles...\n", cycles - g_time);
+	g_scheduler.Run(cycles);
+}
+
+/**
+	@brief Append the bit pattern of a floating point option to a snapshot config
+ */
+static void AppendSnapshotConfig(vector<uint32_t>& config, double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	config.push_back(bits & 0xffffffff);
+	config.push_back(bits >> 32);
+}
+
+/**
+	@brief Network and workload configuration recorded in a snapshot. The state only makes sense for an identical
+	network with the same timing models.
+
+	Synthetic traffic pattern and rate aren't included, so a restored run can change them.
+ */
+static vector<uint32_t> GetSnapshotConfig(Topologies topo, GridRouter::RoutingAlgorithm routing)
 {
-	LogNotice("Running simulation...\n");
-	for(g_time = 0; g_time < 1000; g_time ++)
+	vector<uint32_t> config
 	{
-		for(auto n : g_simNodes)
-			n->Timestep();
+		g_hostCount,
+		topo,
+		(topo == TOPO_QUADTREE) ? 0u : static_cast<uint32_t>(routing),
+		g_portCount,
+		g_gridWidth,
+		g_gridHeight,
+		g_linkWidth,
+		g_fifoDepth,
+		g_vcCount,
+		g_switching,
+		g_routerLatency,
+		g_dualNetwork,
+		g_dmaLinkWidth,
+		g_dmaNetwork.m_topo,
+		static_cast<uint32_t>(g_dmaNetwork.m_routing),
+		g_dmaNetwork.m_portCount,
+		g_dmaNetwork.m_gridWidth,
+		g_dmaNetwork.m_gridHeight,
+		g_tracePath != "",
+		g_ramAddr,
+		g_ramLatency,
+		g_nicRingSize,
+		g_nicBuffers,
+		g_cpuMSHRs,
+		g_trafficGenerator != NULL,
+		static_cast<uint32_t>(g_simNodes.size()),
+		sizeof(NOCPacket)
+	};
+	config.insert(config.end(), g_cpuAddrs.begin(), g_cpuAddrs.end());
+	AppendSnapshotConfig(config, g_ramBandwidth);
+	AppendSnapshotConfig(config, g_cpuIMissRate);
+	AppendSnapshotConfig(config, g_cpuDMissRate);
+	AppendSnapshotConfig(config, g_cpuSyscallRate);
+	return config;
+}
+
+static const char g_snapshotMagic[8] = "NOCSNAP";
+static const uint32_t g_snapshotVersion = 3;
+
+/**
+	@brief Save the state of the simulation, so it can be resumed later by a run with the same network options
+ */
+bool SaveSnapshot(string path, Topologies topo, GridRouter::RoutingAlgorithm routing)
+{
+	LogNotice("Saving snapshot at cycle %u to %s\n", g_time, path.c_str());
+
+	SimSnapshot snap;
+	if(!snap.Create(path))
+		return false;
+
+	snap.Write(g_snapshotMagic);
+	snap.Write(g_snapshotVersion);
+	snap.Write(GetSnapshotConfig(topo, routing));
+	snap.Write(g_time);
+
+	g_scheduler.SaveState(snap, g_simNodes);
+	for(auto n : g_simNodes)
+		n->SaveState(snap);
+	NOCPacket::SaveStats(snap);
+	if(g_trafficGenerator)
+		g_trafficGenerator->SaveState(snap);
+
+	if(!snap.Close())
+	{
+		LogError("Couldn't write snapshot %s\n", path.c_str());
+		return false;
 	}
+	return true;
+}
+
+/**
+	@brief Load a snapshot over a freshly created network
+ */
+bool LoadSnapshot(string path, Topologies topo, GridRouter::RoutingAlgorithm routing)
+{
+	SimSnapshot snap;
+	if(!snap.Open(path))
+		return false;
+
+	char magic[8] = {0};
+	uint32_t version = 0;
+	snap.Read(magic);
+	snap.Read(version);
+	if(!snap.IsOK() || memcmp(magic, g_snapshotMagic, sizeof(magic)) || (version != g_snapshotVersion) )
+	{
+		LogError("%s is not a snapshot from this version of the simulator\n", path.c_str());
+		return false;
+	}
+
+	vector<uint32_t> config;
+	snap.Read(config);
+	if(!snap.IsOK() || (config != GetSnapshotConfig(topo, routing)) )
+	{
+		LogError("Snapshot %s was taken with different network, workload or traffic options\n", path.c_str());
+		return false;
+	}
+
+	snap.Read(g_time);
+	g_scheduler.LoadState(snap, g_simNodes);
+	for(auto n : g_simNodes)
+		n->LoadState(snap);
+	NOCPacket::LoadStats(snap);
+	if(g_trafficGenerator)
+		g_trafficGenerator->LoadState(snap);
+
+	//Anything left over means we're out of step with the file
+	if(!snap.Close())
+	{
+		LogError("Snapshot %s is corrupted\n", path.c_str());
+		return false;
+	}
+
+	LogNotice("Restored snapshot %s at cycle %u\n", path.c_str(), g_time);
+	return true;
 }
 
 void PrintStats()
@@ -332,11 +1536,19 @@ void PrintStats()
 	for(auto n : g_simNodes)
 		n->PrintStats();
 	NOCPacket::PrintStats();
+
+	vector<LinkStats> links;
+	GetLinkStats(links);
+	NOCRouter::PrintBusiestLinks(links, 8);
+
+	if(g_trafficGenerator)
+		g_trafficGenerator->PrintStats();
+	g_scheduler.PrintStats(g_simNodes.size());
 }
 
-void RenderOutput()
+void RenderOutput(string path)
 {
-	LogDebug("Writing simulation results to /tmp/simrun.svg...\n");
+	LogDebug("Writing simulation results to %s...\n", path.c_str());
 	LogIndenter li;
 
 	unsigned int width = 0;
@@ -347,7 +1559,12 @@ void RenderOutput()
 		n->ExpandBoundingBox(width, height);
 
 	//Generate the final drawing
-	FILE* fp = fopen("/tmp/simrun.svg", "w");
+	FILE* fp = fopen(path.c_str(), "w");
+	if(!fp)
+	{
+		LogError("Couldn't open %s\n", path.c_str());
+		return;
+	}
 	fprintf(fp,
 		"<svg width=\"%u\" height=\"%u\" xmlns=\"http://www.w3.org/2000/svg\" "
 		"xmlns:xlink=\"http://www.w3.org/1999/xlink\">\n",
@@ -361,5 +1578,19 @@ void RenderOutput()
 		n->RenderSVGNodes(fp);
 
 	fprintf(fp, "</svg>\n");
+	fclose(fp);
 	LogDebug("Done\n");
 }
+
+/**
+	@brief Collect per-port utilization from every router in the network
+ */
+void GetLinkStats(vector<LinkStats>& stats)
+{
+	for(auto n : g_simNodes)
+	{
+		auto router = dynamic_cast<NOCRouter*>(n);
+		if(router)
+			router->GetLinkStats(stats);
+	}
+}
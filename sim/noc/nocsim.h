@@ -36,14 +36,36 @@
 #define nocsim_h
 
 #include <stdint.h>
+#include <sys/types.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <random>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 #include "../../src/log/log.h"
 
+#include "SimSnapshot.h"
+
+#include "LatencyHistogram.h"
 #include "NOCPacket.h"
+#include "PacketTrace.h"
+#include "PacketTraceWriter.h"
 
 #include "SimNode.h"
+#include "SimScheduler.h"
+#include "PacketTracePlayer.h"
+#include "SweepRunner.h"
+#include "TrafficGenerator.h"
 
 #include "NOCHost.h"
 #include "NOCCpuHost.h"
@@ -58,8 +80,34 @@
 extern unsigned int g_hostCount;
 extern unsigned int g_time;
 
-#define NIC_ADDR 0x0000
-#define RAM_ADDR 0x0080		//put in the middle
-#define CPU_ADDR 0x00ff
+extern unsigned int g_portCount;
+extern unsigned int g_gridWidth;
+extern unsigned int g_gridHeight;
+
+extern uint16_t g_nicAddr;
+extern uint16_t g_ramAddr;		//put in the middle
+extern uint16_t g_cpuAddr;
+extern std::vector<uint16_t> g_cpuAddrs;
+bool IsCPUAddress(uint16_t addr);
+
+extern double g_cpuIMissRate;
+extern double g_cpuDMissRate;
+extern double g_cpuSyscallRate;
+extern unsigned int g_cpuMSHRs;
+
+extern unsigned int g_nicRingSize;
+extern unsigned int g_nicBuffers;
+extern unsigned int g_ramLatency;
+extern double g_ramBandwidth;
+
+extern unsigned int g_linkWidth;
+extern bool g_dualNetwork;
+extern unsigned int g_dmaLinkWidth;
+extern unsigned int g_fifoDepth;
+extern NOCRouter::SwitchingMode g_switching;
+extern unsigned int g_vcCount;
+extern unsigned int g_routerLatency;
+
+extern unsigned int g_seed;
 
 #endif
@@ -0,0 +1,174 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of DMAMessage
+ */
+
+#include "nocbridge.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// DMAMessage
+
+const size_t DMAMessage::HEADER_WORDS;
+const size_t DMAMessage::MAX_DATA_WORDS;
+
+DMAMessage::DMAMessage()
+{
+	from = 0;
+	to = 0;
+	opcode = DMA_OP_WRITE_REQUEST;
+	len = 0;
+	address = 0;
+}
+
+/**
+	@brief Packs the header into HEADER_WORDS words
+ */
+void DMAMessage::PackHeader(uint32_t* buf) const
+{
+	if(len > MAX_DATA_WORDS)
+		LogWarning("DMA messages can't be longer than %zu words (got %u)\n", MAX_DATA_WORDS, len);
+
+	buf[0] = (from << 16) | to;
+	buf[1] = ( (opcode & 3) << 30) | (len & 0x3ff);
+	buf[2] = address;
+}
+
+/**
+	@brief Packs the message into GetPackedLength() words, in host byte order
+ */
+void DMAMessage::Pack(uint32_t* buf) const
+{
+	PackHeader(buf);
+	for(size_t i=0; i<GetDataLength(); i++)
+		buf[HEADER_WORDS + i] = data[i];
+}
+
+/**
+	@brief Packs the message into 4*GetPackedLength() bytes, in network byte order
+ */
+void DMAMessage::Pack(uint8_t* buf) const
+{
+	uint32_t header[HEADER_WORDS];
+	PackHeader(header);
+
+	size_t words = GetPackedLength();
+	for(size_t i=0; i<words; i++)
+	{
+		uint32_t w = (i < HEADER_WORDS) ? header[i] : data[i - HEADER_WORDS];
+		buf[i*4 + 0] = w >> 24;
+		buf[i*4 + 1] = (w >> 16) & 0xff;
+		buf[i*4 + 2] = (w >> 8) & 0xff;
+		buf[i*4 + 3] = w & 0xff;
+	}
+}
+
+/**
+	@brief Unpacks the header words only, so the caller can find out how much data follows
+
+	@return false if the length is too big for a DMAMessage
+ */
+bool DMAMessage::UnpackHeader(const uint32_t* buf)
+{
+	from = buf[0] >> 16;
+	to = buf[0] & 0xffff;
+	opcode = buf[1] >> 30;
+	len = buf[1] & 0x3ff;
+	address = buf[2];
+	return (len <= MAX_DATA_WORDS);
+}
+
+/**
+	@brief Unpacks a whole message (header, then GetDataLength() words of data)
+
+	@return false if the length is too big for a DMAMessage
+ */
+bool DMAMessage::Unpack(const uint32_t* buf)
+{
+	if(!UnpackHeader(buf))
+		return false;
+	for(size_t i=0; i<GetDataLength(); i++)
+		data[i] = buf[HEADER_WORDS + i];
+	return true;
+}
+
+bool DMAMessage::UnpackHeader(const uint8_t* buf)
+{
+	uint32_t header[HEADER_WORDS];
+	for(size_t i=0; i<HEADER_WORDS; i++)
+		header[i] = (buf[i*4] << 24) | (buf[i*4 + 1] << 16) | (buf[i*4 + 2] << 8) | buf[i*4 + 3];
+	return UnpackHeader(header);
+}
+
+bool DMAMessage::Unpack(const uint8_t* buf)
+{
+	if(!UnpackHeader(buf))
+		return false;
+
+	const uint8_t* pdata = buf + HEADER_WORDS*4;
+	for(size_t i=0; i<GetDataLength(); i++)
+		data[i] = (pdata[i*4] << 24) | (pdata[i*4 + 1] << 16) | (pdata[i*4 + 2] << 8) | pdata[i*4 + 3];
+	return true;
+}
+
+/*
+	@brief Returns a printable version of the message (headers only)
+ */
+std::string DMAMessage::Format() const
+{
+	const char* sop = "Reserved";
+	switch(opcode)
+	{
+	case DMA_OP_WRITE_REQUEST:
+		sop = "Write";
+		break;
+	case DMA_OP_READ_REQUEST:
+		sop = "Read request";
+		break;
+	case DMA_OP_READ_DATA:
+		sop = "Read data";
+		break;
+	}
+
+	char outbuf[1024];
+	snprintf(
+		outbuf,
+		sizeof(outbuf),
+		"From: %04x | To  : %04x | Op  : %s | Len : %u | Addr: %08x",
+		from,
+		to,
+		sop,
+		len,
+		address);
+
+	return std::string(outbuf);
+}
@@ -0,0 +1,112 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of DMAMessage
+ */
+
+#ifndef DMAMessage_h
+#define DMAMessage_h
+
+#include <stdint.h>
+#include <string>
+
+/**
+	@brief A single packet on the DMA network
+
+	The DMA network is a packet-switched NoC intended for bulk data transfers. Each packet has a three-word header
+	(routing, opcode and length, address) followed by up to 512 words of data.
+
+	Read requests carry a length but no data; the target answers with a read-data packet of that length.
+
+	\ingroup libjtaghal
+ */
+class DMAMessage
+{
+public:
+	DMAMessage();
+
+	enum DMAOpcode
+	{
+		DMA_OP_WRITE_REQUEST	= 0,
+		DMA_OP_READ_REQUEST		= 1,
+		DMA_OP_READ_DATA		= 2
+	};
+
+	///Number of header words before the data
+	static const size_t HEADER_WORDS = 3;
+
+	///Largest payload a single message can carry
+	static const size_t MAX_DATA_WORDS = 512;
+
+	///Source address
+	uint16_t from;
+
+	///Destination address
+	uint16_t to;
+
+	///Opcode (a DMAOpcode)
+	unsigned int opcode;
+
+	///Length of the transfer, in words
+	unsigned int len;
+
+	///Address of the first word of the transfer
+	uint32_t address;
+
+	///Payload data (only the first len words are valid, and only if opcode isn't DMA_OP_READ_REQUEST)
+	uint32_t data[MAX_DATA_WORDS];
+
+	///Number of data words actually sent on the wire
+	size_t GetDataLength() const
+	{
+		if(opcode == DMA_OP_READ_REQUEST)
+			return 0;
+		return (len < MAX_DATA_WORDS) ? len : MAX_DATA_WORDS;
+	}
+
+	///Number of words the packed message takes up (header plus data)
+	size_t GetPackedLength() const
+	{ return HEADER_WORDS + GetDataLength(); }
+
+	void Pack(uint8_t* buf) const;
+	void Pack(uint32_t* buf) const;
+	bool UnpackHeader(const uint8_t* buf);
+	bool Unpack(const uint8_t* buf);
+	bool UnpackHeader(const uint32_t* buf);
+	bool Unpack(const uint32_t* buf);
+
+	std::string Format() const;
+
+protected:
+	void PackHeader(uint32_t* buf) const;
+};
+#endif
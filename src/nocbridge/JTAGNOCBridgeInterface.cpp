@@ -34,6 +34,18 @@
  */
 #include "nocbridge.h"
 #include "JtagDebugBridge_addresses_enum.h"
+#include <memory.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#define HAVE_CRC32_PCLMUL
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define HAVE_CRC32_ARMV8
+#endif
 
 using namespace std;
 
@@ -126,11 +138,49 @@ static uint32_t g_crc32Table[] =
 	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
+/*
+	Derived tables for processing a word at a time, generated from the ones above by JTAGNOCBridgeInterface::InitCRC().
+
+	g_crc8Slices[n][x] is the CRC8 register after feeding in byte x followed by n zero bytes (slice 0 is g_crc8Table).
+	g_crc32Slices[n][x] is the same for the CRC32 register.
+ */
+static uint8_t g_crc8Slices[4][256];
+static uint32_t g_crc32Slices[8][256];
+
+///CRC32 inner loop: takes the raw CRC register (no inversion / byte swap) and returns the updated register
+typedef uint32_t (*CRC32Function)(uint32_t crc, const uint32_t* data, unsigned int words);
+
+static uint32_t CRC32Slice8(uint32_t crc, const uint32_t* data, unsigned int words);
+static CRC32Function g_crc32Function = CRC32Slice8;
+
+static once_flag g_crcInitFlag;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Construction / destruction
 
+const size_t JTAGNOCBridgeInterface::RPC_FIFO_SIZE;
+const size_t JTAGNOCBridgeInterface::DMA_FIFO_SIZE;
+const size_t JTAGNOCBridgeInterface::MIN_WINDOW_SIZE;
+const size_t JTAGNOCBridgeInterface::DEFAULT_WINDOW_SIZE;
+const size_t JTAGNOCBridgeInterface::SCAN_PIPELINE_DEPTH;
+const size_t JTAGNOCBridgeInterface::MAX_UNACKED_FRAMES;
+const unsigned int JTAGNOCBridgeInterface::RETRANSMIT_TIMEOUT;
+
 JTAGNOCBridgeInterface::JTAGNOCBridgeInterface(JtagFPGA* pfpga)
 	: m_fpga(pfpga)
+	, m_windowSize(DEFAULT_WINDOW_SIZE)
+	, m_adaptiveWindow(false)
+	, m_minWindowSize(DEFAULT_WINDOW_SIZE)
+	, m_maxWindowSize(DEFAULT_WINDOW_SIZE)
+	, m_lastRxPayload(0)
+	, m_rpcTxFifo(RPC_FIFO_SIZE)
+	, m_dmaTxFifo(DMA_FIFO_SIZE)
+	, m_dmaTxWords(0)
+	, m_dmaFirst(false)
+	, m_rpcRxFifo(RPC_FIFO_SIZE)
+	, m_dmaRxFifo(DMA_FIFO_SIZE)
+	, m_scansInFlight(0)
+	, m_scanThreadQuit(false)
 {
 	//Populate free list
 	for(unsigned int i = DEBUG_LOW_ADDR; i <= DEBUG_HIGH_ADDR; i++)
@@ -144,16 +194,50 @@ JTAGNOCBridgeInterface::JTAGNOCBridgeInterface(JtagFPGA* pfpga)
 	//Switch to SHIFT-DR but don't send any data
 	pfpga->EnterShiftDR();
 
+	//Figure out which CRC implementation to use (once only, the tables are shared)
+	call_once(g_crcInitFlag, InitCRC);
+
 	//Start out sending packets with a zero sequence number
 	m_nextSequence = 0;
 
 	//Not ACKing anything yet
 	m_acking = 0;
 	m_nextAck = 0;
+
+	//Expecting the DUT's first payload frame, nothing to NAK
+	m_rxExpected = 0;
+	m_nakPending = false;
+	m_nakOutstanding = false;
+	m_lastNakScan = 0;
+	m_lastNakSeq = 0;
+	m_rxSynced = true;
+
+	//Nothing to retransmit
+	m_retransmitBase = 0;
+	m_framesSent = 0;
+	m_lastAckProgress = 0;
+
+	//No credits until the DUT tells us how much buffer space it has
+	m_txCredits = 0;
+	m_txWordsInFlight = 0;
+	m_creditStalled = false;
+
+	//Start the scan pipeline
+	for(auto& scan : m_scanBuffers)
+		m_freeScans.push_back(&scan);
+	m_scanThread = thread(&JTAGNOCBridgeInterface::ScanThread, this);
 }
 
 JTAGNOCBridgeInterface::~JTAGNOCBridgeInterface()
 {
+	//Let the scan thread finish up before we touch the adapter
+	{
+		lock_guard<mutex> lock(m_scanMutex);
+		m_scanThreadQuit = true;
+	}
+	m_scanReady.notify_one();
+	m_scanThread.join();
+
 	m_fpga->ResetToIdle();
 }
 
@@ -206,21 +290,131 @@ void JTAGNOCBridgeInterface::FreeClientAddress(uint16_t addr)
 	m_freeAddresses.emplace(addr);
 }
 
+/**
+	@brief Queues a message for the DUT. Blocks if the queue is full, until the JTAG thread catches up.
+ */
 void JTAGNOCBridgeInterface::SendRPCMessage(const RPCMessage& tx_msg)
+{
+	while(!TrySendRPCMessage(tx_msg))
+		this_thread::yield();
+}
+
+/**
+	@brief Queues a message for the DUT, unless the queue is full
+
+	@return false if the queue is full (nothing was sent)
+ */
+bool JTAGNOCBridgeInterface::TrySendRPCMessage(const RPCMessage& tx_msg)
 {
 	lock_guard<mutex> lock(m_txMutex);
-	m_rpcTxFifo.push_back(tx_msg);
+	return m_rpcTxFifo.Push(tx_msg);
 }
 
 bool JTAGNOCBridgeInterface::RecvRPCMessage(RPCMessage& rx_msg)
 {
-	lock_guard<mutex> lock(m_rxMutex);
-	if(m_rpcRxFifo.empty())
-		return false;
+	return m_rpcRxFifo.Pop(rx_msg);
+}
 
-	rx_msg = *m_rpcRxFifo.begin();
-	m_rpcRxFifo.pop_front();
-	return true;
+void JTAGNOCBridgeInterface::SendDMAMessage(const DMAMessage& tx_msg)
+{
+	while(!TrySendDMAMessage(tx_msg))
+		this_thread::yield();
+}
+
+/**
+	@brief Queues a DMA message for the DUT, unless the queue is full
+
+	@return false if the queue is full (nothing was sent)
+ */
+bool JTAGNOCBridgeInterface::TrySendDMAMessage(const DMAMessage& tx_msg)
+{
+	if(tx_msg.len > DMAMessage::MAX_DATA_WORDS)
+		throw JtagExceptionWrapper("DMA message is too long", "");
+
+	//Count the words before pushing, so the JTAG thread never sees the count go negative
+	lock_guard<mutex> lock(m_dmaTxMutex);
+	size_t length = tx_msg.GetPackedLength();
+	m_dmaTxWords += length;
+	if(m_dmaTxFifo.Push(tx_msg))
+		return true;
+	m_dmaTxWords -= length;
+	return false;
+}
+
+/**
+	@brief Checks if both TX queues are at most half full, so a sender that found one full can make real progress
+ */
+bool JTAGNOCBridgeInterface::HasTxSpace()
+{
+	return (m_rpcTxFifo.size() <= m_rpcTxFifo.capacity() / 2) && (m_dmaTxFifo.size() <= m_dmaTxFifo.capacity() / 2);
+}
+
+bool JTAGNOCBridgeInterface::RecvDMAMessage(DMAMessage& rx_msg)
+{
+	return m_dmaRxFifo.Pop(rx_msg);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Window sizing
+
+/**
+	@brief Use a fixed window size
+
+	@param words	Number of words to shift per Cycle()
+ */
+void JTAGNOCBridgeInterface::SetWindowSize(size_t words)
+{
+	m_adaptiveWindow = false;
+	m_windowSize = max(words, MIN_WINDOW_SIZE);
+	m_minWindowSize = m_windowSize;
+	m_maxWindowSize = m_windowSize;
+}
+
+/**
+	@brief Resize the window automatically: big scans to amortize the per-scan overhead when there's a lot of data to
+	move, small ones to keep latency down when there isn't.
+
+	@param min_words	Smallest window to use when idle
+	@param max_words	Largest window to use under load
+ */
+void JTAGNOCBridgeInterface::SetAdaptiveWindow(size_t min_words, size_t max_words)
+{
+	m_adaptiveWindow = true;
+	m_minWindowSize = max(min_words, MIN_WINDOW_SIZE);
+	m_maxWindowSize = max(max_words, m_minWindowSize);
+	m_windowSize = m_minWindowSize;
+}
+
+/**
+	@brief Pick the window size for the next scan.
+
+	Grow (by doubling) until the whole TX FIFO fits, or if the DUT filled more than half of the last scan with
+	payload (it probably has more waiting). Shrink by half at a time once we're using less than a quarter of it.
+ */
+void JTAGNOCBridgeInterface::UpdateWindowSize()
+{
+	if(!m_adaptiveWindow)
+		return;
+
+	//Each RPC frame is a 2-word header, 4 words of payload and a CRC. DMA frames are the same plus the DMA message.
+	//Leave room for an idle frame too.
+	size_t demand = m_rpcTxFifo.size() * 7 + m_dmaTxFifo.size() * 3 + m_dmaTxWords + 2;
+	demand = max(demand, m_lastRxPayload);
+
+	size_t old_size = m_windowSize;
+	if( (demand > m_windowSize) || (m_lastRxPayload > m_windowSize / 2) )
+	{
+		while( (m_windowSize < demand) && (m_windowSize < m_maxWindowSize) )
+			m_windowSize *= 2;
+		if(m_windowSize == old_size)
+			m_windowSize *= 2;
+	}
+	else if(demand < m_windowSize / 4)
+		m_windowSize /= 2;
+
+	m_windowSize = min(max(m_windowSize, m_minWindowSize), m_maxWindowSize);
+	if(m_windowSize != old_size)
+		LogTrace("Window size: %zu words\n", m_windowSize);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -231,201 +425,687 @@ bool JTAGNOCBridgeInterface::RecvRPCMessage(RPCMessage& rx_msg)
 
 	Push any pending messages to the DUT; send idles if we have nothing to send.
 	Take any returned data and put it in our queue.
+
+	Scans are pipelined: the JTAG adapter is driven from a separate thread, and we keep up to SCAN_PIPELINE_DEPTH
+	scans queued for it. Each call queues up new scans (if there's room), then waits for the oldest one to complete
+	and processes its reply. Encoding the next scan and decoding the last one both overlap with the scan in progress.
  */
 void JTAGNOCBridgeInterface::Cycle()
 {
-	//Send up to 4KB (1K words) of data.
+	//Keep the scan thread fed, so the adapter never has to wait for us
+	while(m_scansInFlight < SCAN_PIPELINE_DEPTH)
+	{
+		ScanBuffer* scan = m_freeScans.back();
+		m_freeScans.pop_back();
+		EncodeScan(*scan);
+		scan->m_rx.resize(scan->m_tx.size());
+
+		{
+			lock_guard<mutex> lock(m_scanMutex);
+			m_pendingScans.push_back(scan);
+		}
+		m_scanReady.notify_one();
+		m_scansInFlight ++;
+	}
+
+	//Wait for the oldest scan to come back
+	ScanBuffer* scan;
+	{
+		unique_lock<mutex> lock(m_scanMutex);
+		m_scanDone.wait(lock, [this]{ return !m_completedScans.empty(); });
+		scan = m_completedScans.front();
+		m_completedScans.pop_front();
+	}
+	m_scansInFlight --;
+
+	//If the scan failed, report that on this thread.
+	//We don't know what the DUT got, so its credits are left as they are (the frames will time out and be resent).
+	if(scan->m_error)
+	{
+		m_txWordsInFlight -= scan->m_payloadWords;
+		exception_ptr error = scan->m_error;
+		scan->m_error = nullptr;
+		m_freeScans.push_back(scan);
+		rethrow_exception(error);
+	}
+
+	DecodeScan(*scan);
+	m_freeScans.push_back(scan);
+}
+
+/**
+	@brief Thread that drives the JTAG adapter, shifting scans as Cycle() queues them up
+ */
+void JTAGNOCBridgeInterface::ScanThread()
+{
+	while(true)
+	{
+		//Wait for something to do. Finish anything that's queued before quitting.
+		ScanBuffer* scan;
+		{
+			unique_lock<mutex> lock(m_scanMutex);
+			m_scanReady.wait(lock, [this]{ return m_scanThreadQuit || !m_pendingScans.empty(); });
+			if(m_pendingScans.empty())
+				return;
+			scan = m_pendingScans.front();
+			m_pendingScans.pop_front();
+		}
+
+		//Do the actual scan
+		try
+		{
+			m_fpga->ShiftData(
+				(unsigned char*)&scan->m_tx[0],
+				(unsigned char*)&scan->m_rx[0],
+				scan->m_tx.size() * 32);
+		}
+		catch(...)
+		{
+			scan->m_error = current_exception();
+		}
+
+		//Hand it back
+		{
+			lock_guard<mutex> lock(m_scanMutex);
+			m_completedScans.push_back(scan);
+		}
+		m_scanDone.notify_one();
+	}
+}
+
+/**
+	@brief Build the data for the next scan: anything we have to resend, new messages, then idle frames to fill the
+	window
+ */
+void JTAGNOCBridgeInterface::EncodeScan(ScanBuffer& scan)
+{
+	//Send one window's worth of data.
 	//Note that some of this may be idle frames rather than actual data if there's nothing to send
-	//const int tx_buf_len = 1024;
+	UpdateWindowSize();
+	const size_t tx_buf_len = m_windowSize;
+	vector<uint32_t>& tx = scan.m_tx;
+	tx.clear();
+	scan.m_payloadFrames.clear();
+	scan.m_payloadWords = 0;
+	m_creditStalled = false;
+	m_stats.m_scans ++;
+
+	//If the DUT hasn't ACKed anything in a while, assume the frames (or the ACKs) got lost and go back
+	if(!m_retransmitFrames.empty() && (m_stats.m_scans - m_lastAckProgress > RETRANSMIT_TIMEOUT) )
+	{
+		LogTrace("Retransmit timeout, resending from %d\n", m_retransmitFrames.front().m_header.bits.sequence);
+		m_stats.m_timeouts ++;
+		m_framesSent = 0;
+		m_lastAckProgress = m_stats.m_scans;
+	}
 
-	//Shrink window size for testing
-	const int tx_buf_len = 32;
+	//Resend anything we were asked to
+	LogTrace("Sending stuff...\n");
+	while(m_framesSent < m_retransmitFrames.size())
+	{
+		if(!SendFrame(scan, tx_buf_len, m_framesSent))
+			break;
+		m_framesSent ++;
+		m_stats.m_framesResent ++;
+	}
 
-	//TODO: we do NOT want to clear these buffers! Make them member variables and process stuff statefully
-	//so that messages can span multiple Cycle() calls
+	//Then new messages. RPCs go first since they're latency sensitive, unless they crowded out a DMA frame last time
+	//(so a steady stream of RPCs can't starve bulk transfers).
+	if(m_dmaFirst)
+	{
+		EncodeDMAFrames(scan, tx_buf_len);
+		EncodeRPCFrames(scan, tx_buf_len);
+		m_dmaFirst = false;
+	}
+	else
+	{
+		EncodeRPCFrames(scan, tx_buf_len);
+		m_dmaFirst = !EncodeDMAFrames(scan, tx_buf_len);
+	}
+	m_txWordsInFlight += scan.m_payloadWords;
+	if(m_creditStalled)
+		m_stats.m_creditStalls ++;
 
 	//Generate an idle frame we can fill empty space in the TX buffer with
 	AntikernelJTAGFrameHeader idle_frame;
-	idle_frame.bits.ack = m_acking;				//Might be ACKing packets
-	idle_frame.bits.nak = 0;					//not nacking anything
-	idle_frame.bits.credits = 0x3FF;			//we have no limit on buffer space, always report "max"
-	idle_frame.bits.ack_seq = m_nextAck;		//ACK number
 	idle_frame.bits.payload_present = 0;		//no payload
 	idle_frame.bits.rpc = 0;					//no RPC payload
 	idle_frame.bits.dma = 0;					//no DMA payload
 	idle_frame.bits.length = 0;					//empty payload
 	idle_frame.bits.reserved_zero = 0;			//nothing here
+	idle_frame.bits.sequence = m_nextSequence;	//Sequence number of the next payload frame
 
-	//Send any RPC messages we have in the queue
-	LogTrace("Sending stuff...\n");
-	while(m_txBuffer.size() < (tx_buf_len - 7))
+	//Pad the buffer out to size with idle frames
+	while(tx.size() <= (tx_buf_len - 2) )
 	{
-		RPCMessage txm;
+		//Update the link fields, and the CRC for the new headers
+		FillLinkFields(idle_frame);
+		ComputeHeaderChecksum(idle_frame);
 
-		//Critical section to pull data from the shared buffer
-		{
-			lock_guard<mutex> rpclock(m_txMutex);
+		//Save packet
+		tx.push_back(idle_frame.words[0]);
+		tx.push_back(idle_frame.words[1]);
 
-			if(m_rpcTxFifo.empty())
-				break;
+		//only print first few
+		if(tx.size() < 64)
+			PrintMessageHeader(idle_frame);
+	}
+}
 
-			txm = *m_rpcTxFifo.begin();
-			m_rpcTxFifo.pop_front();
+/**
+	@brief Send any RPC messages we have in the queue, as long as there's room and the DUT can ACK and buffer them
+ */
+void JTAGNOCBridgeInterface::EncodeRPCFrames(ScanBuffer& scan, size_t tx_buf_len)
+{
+	RPCMessage txm;
+	while( (m_framesSent == m_retransmitFrames.size()) &&
+		(m_retransmitFrames.size() < MAX_UNACKED_FRAMES) &&
+		(scan.m_tx.size() + 7 <= tx_buf_len) &&
+		!m_rpcTxFifo.empty() )
+	{
+		//Leave it in the FIFO if the DUT can't take it yet
+		if(m_txCredits < 4)
+		{
+			m_creditStalled = true;
+			break;
 		}
-
-		//TODO: Send proper NAKs:
-		//One NAK with sequence number of the bad packet
-		//then ACK with sequence number of the last good packet (if any)
+		m_rpcTxFifo.Pop(txm);
 
 		//Format a header for it
 		AntikernelJTAGFrameHeader rpc_frame;
-		rpc_frame.bits.ack = m_acking;
-		rpc_frame.bits.nak = 0;
-		rpc_frame.bits.credits = 0x3ff;
-		rpc_frame.bits.ack_seq = m_nextAck;
 		rpc_frame.bits.payload_present = 1;
 		rpc_frame.bits.rpc = 1;
 		rpc_frame.bits.dma = 0;
 		rpc_frame.bits.length = 4;
 		rpc_frame.bits.reserved_zero = 0;
-		rpc_frame.bits.sequence = m_nextSequence;		//Sequence number of the outbound packet
-		m_nextSequence = NextSeq(m_nextSequence);
-		ComputeHeaderChecksum(rpc_frame);
-		PrintMessageHeader(rpc_frame);
-		m_txBuffer.push_back(rpc_frame.words[0]);		//header
-		m_txBuffer.push_back(rpc_frame.words[1]);
 
 		uint32_t payload[4];							//message body
 		txm.Pack(payload);
-		for(int i=0; i<4; i++)
-			m_txBuffer.push_back(payload[i]);
+		QueueFrame(rpc_frame, payload);
+
+		if(!SendFrame(scan, tx_buf_len, m_framesSent))
+			break;
+		m_framesSent ++;
+	}
+}
+
+/**
+	@brief Send any DMA messages we have in the queue, as long as there's room and the DUT can ACK and buffer them
+
+	Messages stay in the FIFO until we know they fit, since they can be big. The first frame of a scan is always sent,
+	so one bigger than the window can't get stuck.
+
+	@return false if a message had to wait for the next scan because this one was full
+ */
+bool JTAGNOCBridgeInterface::EncodeDMAFrames(ScanBuffer& scan, size_t tx_buf_len)
+{
+	vector<uint32_t>& tx = scan.m_tx;
+	uint32_t payload[DMAMessage::HEADER_WORDS + DMAMessage::MAX_DATA_WORDS];
+	while( (m_framesSent == m_retransmitFrames.size()) && (m_retransmitFrames.size() < MAX_UNACKED_FRAMES) )
+	{
+		DMAMessage* txm = m_dmaTxFifo.Front();
+		if(!txm)
+			break;
 
-		uint32_t crc = CRC32(&payload[0], 16);
-		LogTrace("TX CRC: %08x\n", crc);
+		size_t length = txm->GetPackedLength();
+		if(!tx.empty() && (tx.size() + 3 + length > tx_buf_len) )
+			return false;
+		if(length > m_txCredits)
+		{
+			m_creditStalled = true;
+			break;
+		}
 
-		m_txBuffer.push_back(crc);						//crc32 of data
+		//Format a header for it
+		AntikernelJTAGFrameHeader dma_frame;
+		dma_frame.bits.payload_present = 1;
+		dma_frame.bits.rpc = 0;
+		dma_frame.bits.dma = 1;
+		dma_frame.bits.length = length;
+		dma_frame.bits.reserved_zero = 0;
+
+		txm->Pack(payload);
+		m_dmaTxFifo.Discard();
+		m_dmaTxWords -= length;
+		QueueFrame(dma_frame, payload);
+
+		if(!SendFrame(scan, tx_buf_len, m_framesSent))
+			break;
+		m_framesSent ++;
 	}
 
-	//TODO: retransmit logic etc
+	return true;
+}
 
-	//Pad the buffer out to size with idle frames
-	while(m_txBuffer.size() <= (tx_buf_len - 2) )
+/**
+	@brief Add a new payload frame to the retransmit buffer, giving it the next sequence number
+
+	@param header	Header with the payload fields filled out
+	@param payload	The payload (header.bits.length words)
+ */
+void JTAGNOCBridgeInterface::QueueFrame(AntikernelJTAGFrameHeader header, const uint32_t* payload)
+{
+	header.bits.sequence = m_nextSequence;		//Sequence number of the outbound packet
+	m_nextSequence = NextSeq(m_nextSequence);
+
+	//If nothing was waiting for an ACK, the timeout starts now
+	if(m_retransmitFrames.empty())
+		m_lastAckProgress = m_stats.m_scans;
+
+	RetransmitFrame frame;
+	frame.m_header = header;
+	frame.m_offset = m_retransmitBase + m_retransmitWords.size();
+	m_retransmitFrames.push_back(frame);
+
+	m_retransmitWords.insert(m_retransmitWords.end(), payload, payload + header.bits.length);
+	m_retransmitWords.push_back(CRC32(payload, header.bits.length * 4));
+}
+
+/**
+	@brief Append a frame from the retransmit buffer to the scan, if there's room and the DUT has credits for it
+
+	The first frame of a scan is always sent even if it's bigger than the window, so big frames can't get stuck.
+	Resent frames are charged for too, even though the DUT drops them if it already has them (it'll give the credits
+	back in its next header).
+
+	@return true if it was sent
+ */
+bool JTAGNOCBridgeInterface::SendFrame(ScanBuffer& scan, size_t tx_buf_len, size_t index)
+{
+	vector<uint32_t>& tx = scan.m_tx;
+	RetransmitFrame& frame = m_retransmitFrames[index];
+	size_t length = frame.m_header.bits.length;
+	if(!tx.empty() && (tx.size() + 3 + length > tx_buf_len) )
+		return false;
+	if(length > m_txCredits)
 	{
-		//Sequence number changes for each packet
-		idle_frame.bits.sequence = m_nextSequence;	//Sequence number of the outbound packet
-		m_nextSequence = NextSeq(m_nextSequence);
+		m_creditStalled = true;
+		return false;
+	}
 
-		//TODO: Send proper NAKs:
-		//One NAK with sequence number of the bad packet
-		//then ACK with sequence number of the last good packet (if any)
+	//Header gets the latest link fields
+	AntikernelJTAGFrameHeader header = frame.m_header;
+	FillLinkFields(header);
+	ComputeHeaderChecksum(header);
+	PrintMessageHeader(header);
+	tx.push_back(header.words[0]);
+	tx.push_back(header.words[1]);
 
-		//Update the CRC for the new headers
-		ComputeHeaderChecksum(idle_frame);
+	//Payload and CRC
+	auto start = m_retransmitWords.begin() + (frame.m_offset - m_retransmitBase);
+	tx.insert(tx.end(), start, start + length + 1);
 
-		//Save packet
-		m_txBuffer.push_back(idle_frame.words[0]);
-		m_txBuffer.push_back(idle_frame.words[1]);
+	//Charge it to the DUT's buffer
+	m_txCredits -= length;
+	scan.m_payloadFrames.push_back(pair<size_t, size_t>(tx.size(), length));
+	scan.m_payloadWords += length;
 
-		//only print first few
-		if(m_txBuffer.size() < 64)
-			PrintMessageHeader(idle_frame);
+	m_stats.m_framesSent ++;
+	return true;
+}
+
+/**
+	@brief Fill out the ACK/NAK and flow control fields of an outbound header
+
+	A pending NAK goes out in the first frame only, then we go back to ACKing the last good frame.
+ */
+void JTAGNOCBridgeInterface::FillLinkFields(AntikernelJTAGFrameHeader& header)
+{
+	header.bits.credits = 0x3ff;				//we have no limit on buffer space, always report "max"
+	if(m_nakPending)
+	{
+		header.bits.ack = 0;
+		header.bits.nak = 1;
+		header.bits.ack_seq = m_rxExpected;
+		m_nakPending = false;
+	}
+	else
+	{
+		header.bits.ack = m_acking;				//Might be ACKing packets
+		header.bits.nak = 0;
+		header.bits.ack_seq = m_nextAck;		//ACK number
 	}
+}
 
-	//Input/output data buffers (must be contiguous memory!)
-	vector<uint32_t> tx_buf;
-	vector<uint32_t> rx_buf;
-	tx_buf.reserve(m_txBuffer.size());
-	rx_buf.resize(m_txBuffer.size());
+/**
+	@brief Ask the DUT to go back and resend from m_rxExpected, unless we just did
+ */
+void JTAGNOCBridgeInterface::SendNak()
+{
+	if( m_nakOutstanding &&
+		(m_lastNakSeq == m_rxExpected) &&
+		(m_stats.m_scans - m_lastNakScan <= RETRANSMIT_TIMEOUT) )
+	{
+		return;
+	}
 
-	//Append our pending outbox data
-	for(auto b : m_txBuffer)
-		tx_buf.push_back(b);
-	m_txBuffer.clear();
+	LogTrace("NAKing frame %d\n", m_rxExpected);
+	m_nakPending = true;
+	m_nakOutstanding = true;
+	m_lastNakSeq = m_rxExpected;
+	m_lastNakScan = m_stats.m_scans;
+	m_stats.m_naksSent ++;
+}
 
-	//Send the actual data
-	//TODO: do split transactions
-	m_fpga->ShiftData((unsigned char*)&tx_buf[0], (unsigned char*)&rx_buf[0], tx_buf.size() * 32);
+/**
+	@brief We've seen a frame from the DUT that's past m_rxExpected, so something got lost. NAK it.
 
-	//Append the new data to our existing RX buffer
-	for(auto b : rx_buf)
-		m_rxBuffer.push_back(b);
+	Every frame until the resend shows up (including the idle frames padding out each scan) tells us the same thing,
+	so the gap is only counted the first time.
+ */
+void JTAGNOCBridgeInterface::ReportGap()
+{
+	if(!m_nakOutstanding || (m_lastNakSeq != m_rxExpected) )
+		m_stats.m_outOfOrder ++;
+	SendNak();
+}
 
-	//Process the RX buffer
-	LogTrace("Got %d words (%d)\n", (int)rx_buf.size(), (int)m_rxBuffer.size());
+/**
+	@brief Handle the ACK/NAK fields of a frame from the DUT (whether it has a payload or not)
+ */
+void JTAGNOCBridgeInterface::ProcessLinkFields(const AntikernelJTAGFrameHeader& header)
+{
+	if(header.bits.nak)
+	{
+		//Everything before the NAKed frame got through
+		PopAckedFrames(PrevSeq(header.bits.ack_seq));
+
+		//Go back and send the rest again, unless it's not something we sent
+		if(!m_retransmitFrames.empty() && (m_retransmitFrames.front().m_header.bits.sequence == header.bits.ack_seq))
+		{
+			LogTrace("Got NAK for %d, resending\n", header.bits.ack_seq);
+			m_stats.m_naksReceived ++;
+			m_framesSent = 0;
+			m_lastAckProgress = m_stats.m_scans;
+		}
+	}
+	else if(header.bits.ack)
+		PopAckedFrames(header.bits.ack_seq);
+}
+
+/**
+	@brief Drop everything up to and including last_acked from the retransmit buffer
+ */
+void JTAGNOCBridgeInterface::PopAckedFrames(unsigned int last_acked)
+{
+	if(m_retransmitFrames.empty())
+		return;
+
+	//Ignore stale ACKs from before the window, and anything for a frame we haven't sent yet
+	size_t count = SeqDiff(last_acked, m_retransmitFrames.front().m_header.bits.sequence) + 1;
+	if(count > m_retransmitFrames.size())
+		return;
+
+	for(size_t i=0; i<count; i++)
+	{
+		RetransmitFrame& frame = m_retransmitFrames.front();
+		size_t words = frame.m_header.bits.length + 1;
+		m_retransmitWords.erase(m_retransmitWords.begin(), m_retransmitWords.begin() + words);
+		m_retransmitBase += words;
+		m_retransmitFrames.pop_front();
+
+		if(m_framesSent > 0)
+			m_framesSent --;
+	}
+	m_lastAckProgress = m_stats.m_scans;
+}
+
+/**
+	@brief Handle a payload frame from the DUT. Only the next one in sequence is accepted, anything else is dropped.
+
+	@param header	The frame header (already checked)
+	@param payload	Payload data
+	@param crc_ok	True if the payload CRC was good
+ */
+void JTAGNOCBridgeInterface::ProcessPayloadFrame(
+	const AntikernelJTAGFrameHeader& header,
+	const uint32_t* payload,
+	bool crc_ok)
+{
+	unsigned int seq = header.bits.sequence;
+
+	//If the CRC is bad, ask for it again
+	if(!crc_ok)
+	{
+		m_stats.m_payloadErrors ++;
+		SendNak();
+		return;
+	}
+
+	//Old frame we've already seen (the DUT went back further than it needed to). Nothing to do.
+	if(seq != m_rxExpected)
+	{
+		if(SeqDiff(m_rxExpected, seq) <= MAX_UNACKED_FRAMES)
+			m_stats.m_duplicates ++;
+
+		//We missed something, ask for it again
+		else
+			ReportGap();
+		return;
+	}
+
+	//It's the one we were waiting for. ACK it.
+	m_stats.m_framesReceived ++;
+	m_acking = true;
+	m_nextAck = seq;
+	m_rxExpected = NextSeq(seq);
+	m_nakOutstanding = false;
+
+	//DMA message
+	if(header.bits.dma)
+	{
+		DMAMessage rxm;
+		if(!rxm.Unpack(payload) || (rxm.GetPackedLength() != header.bits.length) )
+			LogWarning("Malformed DMA message (%d words), dropping\n", header.bits.length);
+		else if(!m_dmaRxFifo.Push(rxm))
+			LogError("DMA RX FIFO overflow, dropping message\n");
+	}
+
+	//RPC message
+	else
+	{
+		uint32_t body[4];
+		memcpy(body, payload, sizeof(body));
+		RPCMessage rxm;
+		rxm.Unpack(body);
+		//LogTrace("Got: %s\n", rxm.Format().c_str());
+
+		if(!m_rpcRxFifo.Push(rxm))
+			LogError("RPC RX FIFO overflow, dropping message\n");
+	}
+}
+
+/**
+	@brief Process the data that came back from a scan
+ */
+void JTAGNOCBridgeInterface::DecodeScan(ScanBuffer& scan)
+{
+	//Append to whatever's left over from last time
+	const vector<uint32_t>& rx = scan.m_rx;
+	const size_t leftover = m_rxBuffer.size();
+	m_rxBuffer.insert(m_rxBuffer.end(), rx.begin(), rx.end());
+
+	//Latest good header from this scan, for credits
+	bool got_credits = false;
+	unsigned int credits = 0;
+	size_t credits_offset = 0;
+
+	//Process the RX buffer in place. Everything before rpos has been consumed.
+	LogTrace("Got %d words (%d)\n", (int)rx.size(), (int)m_rxBuffer.size());
+	size_t rpos = 0;
 	int i = 0;
-	while(m_rxBuffer.size() > 1)
+	m_lastRxPayload = 0;
+	while( (m_rxBuffer.size() - rpos) > 1)
 	{
+		size_t hpos = rpos;
 		AntikernelJTAGFrameHeader msg;
-		msg.words[0] = *m_rxBuffer.begin();
-		m_rxBuffer.pop_front();
-		msg.words[1] = *m_rxBuffer.begin();
-		m_rxBuffer.pop_front();
+		msg.words[0] = m_rxBuffer[rpos];
+		msg.words[1] = m_rxBuffer[rpos + 1];
 
-		//TODO: We need to reset link if this happens, handle it properly!
-		if(!VerifyHeaderChecksum(msg))
+		//If the header is bad we've lost our place in the stream (or it got corrupted).
+		//Slide forward a word at a time until we find a good one; anything we skipped gets NAKed once we're back.
+		if(!VerifyHeader(msg))
 		{
-			LogError("Bad header CRC (at offset %d in buffer)\n", i);
-			break;
+			LogTrace("Bad header CRC (at offset %d in buffer)\n", i);
+			m_stats.m_headerErrors ++;
+			m_rxSynced = false;
+			rpos ++;
+			continue;
 		}
 
-		//debug print
-		if(i++ < 63)
-			PrintMessageHeader(msg);
-
 		//Process payload, if we have it
 		if(msg.bits.payload_present)
 		{
 			//Do we have the full payload?
-			//If not, push the headers back onto the start of the buffer and stop.
-			if(m_rxBuffer.size() <= msg.bits.length)
+			//If not, leave the headers at the start of the buffer and stop.
+			if( (m_rxBuffer.size() - rpos - 2) <= msg.bits.length)
 			{
 				LogTrace("Need moar payload\n");
-				m_rxBuffer.push_front(msg.words[1]);
-				m_rxBuffer.push_front(msg.words[0]);
 				break;
 			}
 
 			//We have the payload, crunch it
-			vector<uint32_t> payload;
-			for(int i=0; i<msg.bits.length; i++)
+			const uint32_t* payload = &m_rxBuffer[rpos + 2];
+			uint32_t message_crc = payload[msg.bits.length];
+			uint32_t actual_crc = CRC32(payload, msg.bits.length * 4);
+			bool crc_ok = (message_crc == actual_crc);
+
+			//If we're hunting for a header, a bad CRC means this probably wasn't a header at all. Keep sliding.
+			if(!m_rxSynced && !crc_ok)
 			{
-				payload.push_back(*m_rxBuffer.begin());
-				m_rxBuffer.pop_front();
+				m_stats.m_headerErrors ++;
+				rpos ++;
+				continue;
 			}
-			uint32_t message_crc = *m_rxBuffer.begin();
-			m_rxBuffer.pop_front();
-			uint32_t actual_crc = CRC32(&payload[0], msg.bits.length * 4);
+			m_rxSynced = true;
 
-			//If the CRC is bad, skip it (TODO send NAK etc)
-			if(message_crc != actual_crc)
+			if(i++ < 63)
+				PrintMessageHeader(msg);
+			rpos += 2 + msg.bits.length + 1;
+			m_lastRxPayload += msg.bits.length + 3;
+
+			if(!crc_ok)
+				LogTrace("CRC mismatch! expected %08x, got %08x\n", actual_crc, message_crc);
+			ProcessPayloadFrame(msg, payload, crc_ok);
+		}
+
+		//Idle frames carry the sequence number of the next payload frame. If that's ahead of what we're expecting,
+		//we lost one.
+		else
+		{
+			//If we're hunting for a header, we're back in sync if there's another good one right after this.
+			//But this one might still be garbage that happened to land just before a real header, so skip it:
+			//idle frames carry nothing that the next frame won't tell us again.
+			if(!m_rxSynced)
 			{
-				LogWarning("CRC mismatch! expected %08x, got %08x\n", actual_crc, message_crc);
+				if( (m_rxBuffer.size() - rpos) < 4)
+					break;
+
+				AntikernelJTAGFrameHeader next;
+				next.words[0] = m_rxBuffer[rpos + 2];
+				next.words[1] = m_rxBuffer[rpos + 3];
+				if(VerifyHeader(next))
+				{
+					m_rxSynced = true;
+					rpos += 2;
+				}
+				else
+				{
+					m_stats.m_headerErrors ++;
+					rpos ++;
+				}
 				continue;
 			}
 
-			//See what it is! If it's not an RPC packet ignore it and warn
-			if(!msg.bits.rpc || msg.bits.dma || (msg.bits.length != 4) )
-				LogWarning("Don't know what to do with payloads other than RPC at this time\n");
+			if(i++ < 63)
+				PrintMessageHeader(msg);
+			rpos += 2;
+			unsigned int ahead = SeqDiff(msg.bits.sequence, m_rxExpected);
+			if( (ahead != 0) && (ahead < MAX_UNACKED_FRAMES) )
+				ReportGap();
+		}
 
-			//It's RPC if we get here. Process it.
-			else
-			{
-				RPCMessage rxm;
-				rxm.Unpack(&payload[0]);
-				//LogTrace("Got: %s\n", rxm.Format().c_str());
+		//Header is good, so the ACK/NAK fields can be trusted even if the payload is bad
+		ProcessLinkFields(msg);
 
-				lock_guard<mutex> rpclock(m_rxMutex);
-				m_rpcRxFifo.push_back(rxm);
-			}
+		//Headers left over from the last scan are too old to work out credits from (we've forgotten what was sent
+		//around them), but there's always a newer one
+		if(hpos >= leftover)
+		{
+			got_credits = true;
+			credits = msg.bits.credits;
+			credits_offset = hpos - leftover;
 		}
+	}
+
+	//Discard everything we parsed, keeping any partial frame for next time
+	m_rxBuffer.erase(m_rxBuffer.begin(), m_rxBuffer.begin() + rpos);
+
+	if(got_credits)
+		UpdateCredits(scan, credits, credits_offset);
+	m_txWordsInFlight -= scan.m_payloadWords;
+}
 
-		//TODO: credit / sequence number processing
+/**
+	@brief Work out how much more the DUT can take, from the credits it reported in a header
+
+	The DUT shifts a header out at the same time as it shifts in the word at the same offset in our scan, so any frame
+	that hadn't finished by then wasn't counted. Neither were any of the scans queued after this one.
+
+	Every frame that had finished must have been counted, though, even if the DUT hasn't checked it yet (say, because
+	it's still looking for a header after a bit error).
 
-		//If we get here the message was properly verified!
-		//Bump the ACK number
-		m_acking = true;
-		m_nextAck = msg.bits.sequence;
+	@param scan		The scan the header came back in
+	@param credits	Free buffer space the DUT reported, in payload words
+	@param offset	Offset of the header in the scan
+ */
+void JTAGNOCBridgeInterface::UpdateCredits(const ScanBuffer& scan, unsigned int credits, size_t offset)
+{
+	size_t unseen = m_txWordsInFlight - scan.m_payloadWords;
+	for(auto& frame : scan.m_payloadFrames)
+	{
+		if(frame.first > offset)
+			unseen += frame.second;
 	}
+
+	if(credits > unseen)
+		m_txCredits = credits - unseen;
+	else
+		m_txCredits = 0;
+}
+
+/**
+	@brief Print the link layer counters
+ */
+void JTAGNOCBridgeInterface::PrintStatistics()
+{
+	LogVerbose("JTAG link statistics:\n");
+	LogIndenter li;
+	LogVerbose("Scans:                     %lu\n", m_stats.m_scans);
+	LogVerbose("Frames sent:               %lu (%lu resent)\n", m_stats.m_framesSent, m_stats.m_framesResent);
+	LogVerbose("Frames received:           %lu\n", m_stats.m_framesReceived);
+	LogVerbose("Header errors:             %lu\n", m_stats.m_headerErrors);
+	LogVerbose("Payload errors:            %lu\n", m_stats.m_payloadErrors);
+	LogVerbose("Gaps / duplicates:         %lu / %lu\n", m_stats.m_outOfOrder, m_stats.m_duplicates);
+	LogVerbose("NAKs sent / received:      %lu / %lu\n", m_stats.m_naksSent, m_stats.m_naksReceived);
+	LogVerbose("Retransmit timeouts:       %lu\n", m_stats.m_timeouts);
+	LogVerbose("Credit stalls:             %lu\n", m_stats.m_creditStalls);
+}
+
+JTAGNOCBridgeInterface::LinkStatistics::LinkStatistics()
+	: m_scans(0)
+	, m_framesSent(0)
+	, m_framesResent(0)
+	, m_framesReceived(0)
+	, m_headerErrors(0)
+	, m_payloadErrors(0)
+	, m_outOfOrder(0)
+	, m_duplicates(0)
+	, m_naksSent(0)
+	, m_naksReceived(0)
+	, m_timeouts(0)
+	, m_creditStalls(0)
+{
 }
 
 /**
@@ -467,12 +1147,93 @@ bool JTAGNOCBridgeInterface::VerifyHeaderChecksum(AntikernelJTAGFrameHeader head
 	return ok;
 }
 
+/**
+	@brief Make sure an inbound header has a good CRC, and that the fields make sense.
+
+	Checking the fields too makes it much less likely that we'll mistake garbage for a header when resyncing.
+ */
+bool JTAGNOCBridgeInterface::VerifyHeader(AntikernelJTAGFrameHeader header)
+{
+	if(!VerifyHeaderChecksum(header))
+		return false;
+
+	if(header.bits.reserved_zero || (header.bits.ack && header.bits.nak) )
+		return false;
+
+	//Idle frames are always empty, payload frames are either RPC or DMA
+	if(!header.bits.payload_present)
+		return !header.bits.rpc && !header.bits.dma && (header.bits.length == 0);
+	if(header.bits.rpc)
+		return !header.bits.dma && (header.bits.length == 4);
+	if(header.bits.dma)
+	{
+		return (header.bits.length >= DMAMessage::HEADER_WORDS) &&
+			(header.bits.length <= DMAMessage::HEADER_WORDS + DMAMessage::MAX_DATA_WORDS);
+	}
+	return false;
+}
+
 /**
 	@brief Checksums a buffer of data in network byte order
+ */
+uint8_t JTAGNOCBridgeInterface::CRC8(const uint32_t* data, unsigned int len)
+{
+	//Whole words: one lookup per byte, but no dependency on the previous byte except for the first one
+	uint8_t crc = 0x00;
+	unsigned int words = len / 4;
+	for(unsigned int i=0; i<words; i++)
+	{
+		uint32_t d = data[i];
+		crc =	g_crc8Slices[3][(d >> 24) ^ crc] ^
+				g_crc8Slices[2][(d >> 16) & 0xff] ^
+				g_crc8Slices[1][(d >> 8) & 0xff] ^
+				g_crc8Slices[0][d & 0xff];
+	}
+
+	//Partial word at the end (the last three bytes of a frame header)
+	unsigned int tail = len & 3;
+	if(tail)
+	{
+		uint32_t d = data[words];
+		crc = g_crc8Slices[tail - 1][(d >> 24) ^ crc];
+		for(unsigned int j=1; j<tail; j++)
+			crc ^= g_crc8Slices[tail - 1 - j][(d >> (24 - 8*j)) & 0xff];
+	}
 
-	//TODO: switch to faster implementation? this is slooow
+	return crc;
+}
+
+/**
+	@brief Checksums a buffer of data (little-endian byte order within each word)
+ */
+uint32_t JTAGNOCBridgeInterface::CRC32(const uint32_t* data, unsigned int len)
+{
+	//Bulk of the data goes through whichever implementation InitCRC() picked
+	unsigned int words = len / 4;
+	uint32_t crc = g_crc32Function(0xffffffff, data, words);
+
+	//Partial word at the end
+	if(len & 3)
+	{
+		uint32_t d = data[words];
+		for(unsigned int j=0; j < (len & 3); j++)
+		{
+			crc = g_crc32Table[ (crc ^ d) & 0xff] ^ (crc >> 8);
+			d >>= 8;
+		}
+	}
+
+	//This CRC code has backwards endianness, so fix that
+	//TODO: Update the table to be proper endianness in the first place
+	FlipEndian32Array((unsigned char*)&crc, 4);
+
+	return ~crc;
+}
+
+/**
+	@brief Reference CRC8, one byte at a time. Only used to check the fast version.
  */
-uint8_t JTAGNOCBridgeInterface::CRC8(uint32_t* data, unsigned int len)
+uint8_t JTAGNOCBridgeInterface::CRC8Bytewise(const uint32_t* data, unsigned int len)
 {
 	uint8_t crc = 0x00;
 	for(unsigned int i=0; i<len; i += 4)
@@ -488,7 +1249,10 @@ uint8_t JTAGNOCBridgeInterface::CRC8(uint32_t* data, unsigned int len)
 	return crc;
 }
 
-uint32_t JTAGNOCBridgeInterface::CRC32(uint32_t* data, unsigned int len)
+/**
+	@brief Reference CRC32, one byte at a time. Only used to check the fast versions.
+ */
+uint32_t JTAGNOCBridgeInterface::CRC32Bytewise(const uint32_t* data, unsigned int len)
 {
 	uint32_t crc = 0xffffffff;
 
@@ -503,9 +1267,232 @@ uint32_t JTAGNOCBridgeInterface::CRC32(uint32_t* data, unsigned int len)
 		}
 	}
 
-	//This CRC code has backwards endianness, so fix that
-	//TODO: Update the table to be proper endianness in the first place
 	FlipEndian32Array((unsigned char*)&crc, 4);
 
 	return ~crc;
 }
+
+/**
+	@brief CRC32 over whole words, eight bytes per step
+ */
+static uint32_t CRC32Slice8(uint32_t crc, const uint32_t* data, unsigned int words)
+{
+	unsigned int i = 0;
+	for(; i+1 < words; i += 2)
+	{
+		uint32_t lo = data[i] ^ crc;
+		uint32_t hi = data[i+1];
+		crc =	g_crc32Slices[7][lo & 0xff] ^
+				g_crc32Slices[6][(lo >> 8) & 0xff] ^
+				g_crc32Slices[5][(lo >> 16) & 0xff] ^
+				g_crc32Slices[4][lo >> 24] ^
+				g_crc32Slices[3][hi & 0xff] ^
+				g_crc32Slices[2][(hi >> 8) & 0xff] ^
+				g_crc32Slices[1][(hi >> 16) & 0xff] ^
+				g_crc32Slices[0][hi >> 24];
+	}
+
+	//Odd word at the end
+	if(i < words)
+	{
+		uint32_t lo = data[i] ^ crc;
+		crc =	g_crc32Slices[3][lo & 0xff] ^
+				g_crc32Slices[2][(lo >> 8) & 0xff] ^
+				g_crc32Slices[1][(lo >> 16) & 0xff] ^
+				g_crc32Slices[0][lo >> 24];
+	}
+
+	return crc;
+}
+
+#ifdef HAVE_CRC32_PCLMUL
+
+/**
+	@brief CRC32 using carry-less multiplication to fold 64 bytes at a time.
+
+	See "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Gopal et al, Intel, 2009). The
+	constants are the bit-reflected fold multipliers and Barrett reduction constants for the 802.3 polynomial.
+
+	Data is read in memory order, which matches our LSB-first word order on x86. Anything that isn't a multiple of 16
+	bytes, or is too short to be worth it, goes through CRC32Slice8().
+ */
+__attribute__((target("pclmul,sse2")))
+static uint32_t CRC32Pclmul(uint32_t crc, const uint32_t* data, unsigned int words)
+{
+	if(words < 16)
+		return CRC32Slice8(crc, data, words);
+
+	static const uint64_t k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4, 0x01c6e41596 };
+	static const uint64_t k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0, 0x00ccaa009e };
+	static const uint64_t k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124, 0x0000000000 };
+	static const uint64_t poly[2] __attribute__((aligned(16))) = { 0x01db710641, 0x01f7011641 };
+
+	const __m128i* p = reinterpret_cast<const __m128i*>(data);
+	unsigned int blocks = words / 4;
+
+	//Load the first 64 bytes and mix in the incoming CRC
+	__m128i x1 = _mm_xor_si128(_mm_loadu_si128(p), _mm_cvtsi32_si128(crc));
+	__m128i x2 = _mm_loadu_si128(p + 1);
+	__m128i x3 = _mm_loadu_si128(p + 2);
+	__m128i x4 = _mm_loadu_si128(p + 3);
+	p += 4;
+	blocks -= 4;
+
+	//Fold four lanes in parallel while we have 64 bytes left
+	__m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+	for(; blocks >= 4; blocks -= 4, p += 4)
+	{
+		__m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+		__m128i x6 = _mm_clmulepi64_si128(x2, k, 0x00);
+		__m128i x7 = _mm_clmulepi64_si128(x3, k, 0x00);
+		__m128i x8 = _mm_clmulepi64_si128(x4, k, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(p));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(p + 1));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(p + 2));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(p + 3));
+	}
+
+	//Fold the four lanes down to one, then fold in any remaining 16-byte blocks
+	k = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+	__m128i lanes[3] = {x2, x3, x4};
+	for(unsigned int i=0; i<3; i++)
+	{
+		__m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, lanes[i]), x5);
+	}
+	for(; blocks > 0; blocks--, p++)
+	{
+		__m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(p)), x5);
+	}
+
+	//Fold 128 bits down to 64
+	__m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x2f = _mm_clmulepi64_si128(x1, k, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2f);
+
+	k = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+	x2f = _mm_srli_si128(x1, 4);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00);
+	x1 = _mm_xor_si128(x1, x2f);
+
+	//Barrett reduction to 32 bits
+	k = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+	x2f = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+	x2f = _mm_clmulepi64_si128(_mm_and_si128(x2f, mask), k, 0x00);
+	x1 = _mm_xor_si128(x1, x2f);
+	crc = _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+
+	//Last few words that didn't make a whole block
+	return CRC32Slice8(crc, data + (words & ~3u), words & 3);
+}
+
+#endif
+
+#ifdef HAVE_CRC32_ARMV8
+
+/**
+	@brief CRC32 using the ARMv8 CRC32 instructions (which implement the 802.3 polynomial, bit reflected, natively)
+ */
+__attribute__((target("+crc")))
+static uint32_t CRC32Armv8(uint32_t crc, const uint32_t* data, unsigned int words)
+{
+	//Doublewords from memory are in the same byte order as our LSB-first words on little-endian systems
+	unsigned int i = 0;
+	for(; i+1 < words; i += 2)
+	{
+		uint64_t d = data[i] | (static_cast<uint64_t>(data[i+1]) << 32);
+		crc = __crc32d(crc, d);
+	}
+	if(i < words)
+		crc = __crc32w(crc, data[i]);
+	return crc;
+}
+
+#endif
+
+/**
+	@brief Builds the word-at-a-time tables and picks the fastest CRC32 implementation the CPU supports.
+
+	Each candidate is checked against the bytewise reference over a range of lengths before we trust it.
+ */
+void JTAGNOCBridgeInterface::InitCRC()
+{
+	for(unsigned int x=0; x<256; x++)
+	{
+		g_crc8Slices[0][x] = g_crc8Table[x];
+		g_crc32Slices[0][x] = g_crc32Table[x];
+	}
+	for(unsigned int n=1; n<4; n++)
+	{
+		for(unsigned int x=0; x<256; x++)
+			g_crc8Slices[n][x] = g_crc8Table[g_crc8Slices[n-1][x]];
+	}
+	for(unsigned int n=1; n<8; n++)
+	{
+		for(unsigned int x=0; x<256; x++)
+		{
+			uint32_t prev = g_crc32Slices[n-1][x];
+			g_crc32Slices[n][x] = g_crc32Table[prev & 0xff] ^ (prev >> 8);
+		}
+	}
+
+	//Test pattern: a full DMA frame worth of pseudorandom data
+	uint32_t test[515];
+	uint32_t lfsr = 0x12345678;
+	for(auto& w : test)
+	{
+		lfsr = lfsr * 1664525 + 1013904223;
+		w = lfsr;
+	}
+
+	//Sanity check the sliced CRC8 (all headers go through it)
+	for(unsigned int len=0; len<=32; len++)
+	{
+		if(CRC8(test, len) != CRC8Bytewise(test, len))
+			LogError("JTAGNOCBridgeInterface: sliced CRC8 doesn't match reference (length %u)\n", len);
+	}
+
+	//Candidate CRC32 implementations, fastest first
+	vector< pair<const char*, CRC32Function> > candidates;
+	#ifdef HAVE_CRC32_PCLMUL
+		if(__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2"))
+			candidates.push_back(pair<const char*, CRC32Function>("PCLMULQDQ", CRC32Pclmul));
+	#endif
+	#ifdef HAVE_CRC32_ARMV8
+		if(getauxval(AT_HWCAP) & HWCAP_CRC32)
+			candidates.push_back(pair<const char*, CRC32Function>("ARMv8 CRC32", CRC32Armv8));
+	#endif
+	candidates.push_back(pair<const char*, CRC32Function>("slice-by-8", CRC32Slice8));
+
+	for(auto c : candidates)
+	{
+		g_crc32Function = c.second;
+
+		bool ok = true;
+		for(unsigned int len=0; len<=sizeof(test); len += (len < 128) ? 1 : 61)
+		{
+			if(CRC32(test, len) != CRC32Bytewise(test, len))
+			{
+				LogWarning("JTAGNOCBridgeInterface: %s CRC32 doesn't match reference (length %u), not using it\n",
+					c.first, len);
+				ok = false;
+				break;
+			}
+		}
+
+		if(ok)
+		{
+			LogTrace("Using %s CRC32\n", c.first);
+			return;
+		}
+	}
+}
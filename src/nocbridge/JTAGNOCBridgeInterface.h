@@ -91,6 +91,18 @@ union AntikernelJTAGFrameHeader
 
 /**
 	@brief A NOCBridgeInterface that runs over JTAG
+
+	Link layer
+	----------
+
+	Frames with a payload are numbered consecutively and delivered reliably using go-back-N. Idle frames don't use up
+	a sequence number; they carry the number the next payload frame will have, so the receiver can tell if the last
+	frame of a burst went missing.
+
+	ack_seq acknowledges every payload frame up to and including that number. A frame with the nak bit set asks the
+	sender to go back and resend everything starting at ack_seq (so it acknowledges everything before that). A NAK is
+	sent once, in a single frame, when a payload frame is lost or corrupted; if it doesn't get through, the sender's
+	retransmit timeout covers it.
  */
 class JTAGNOCBridgeInterface : public NOCBridgeInterface
 {
@@ -104,12 +116,76 @@ public:
 	///IMPORTANT: These functions DO NOT call Cycle()!
 	virtual void SendRPCMessage(const RPCMessage& tx_msg);
 	virtual bool RecvRPCMessage(RPCMessage& rx_msg);
+	virtual void SendDMAMessage(const DMAMessage& tx_msg);
+	virtual bool RecvDMAMessage(DMAMessage& rx_msg);
+
+	bool TrySendRPCMessage(const RPCMessage& tx_msg);
+	bool TrySendDMAMessage(const DMAMessage& tx_msg);
+	bool HasTxSpace();
 
 	void Cycle();
 
+	void SetWindowSize(size_t words);
+	void SetAdaptiveWindow(size_t min_words, size_t max_words);
+
+	///Current number of words shifted per Cycle()
+	size_t GetWindowSize()
+	{ return m_windowSize; }
+
+	///Number of messages each RPC FIFO can hold
+	static const size_t RPC_FIFO_SIZE = 4096;
+
+	///Number of messages each DMA FIFO can hold (they're ~2 KB each)
+	static const size_t DMA_FIFO_SIZE = 256;
+
+	///Smallest window that fits an RPC frame plus an idle frame
+	static const size_t MIN_WINDOW_SIZE = 9;
+
+	///Default window (small, for low latency on single RPCs)
+	static const size_t DEFAULT_WINDOW_SIZE = 32;
+
+	///Number of scans queued for (or in progress on) the adapter at once
+	static const size_t SCAN_PIPELINE_DEPTH = 2;
+
+	///Most payload frames that can be waiting for an ACK (under half the sequence space, so old and new never mix)
+	static const size_t MAX_UNACKED_FRAMES = 0x1ff;
+
+	///Number of scans without an ACK before we resend everything, or re-send a NAK
+	static const unsigned int RETRANSMIT_TIMEOUT = 2*SCAN_PIPELINE_DEPTH + 4;
+
+	/**
+		@brief Link layer counters. Only safe to read from the thread calling Cycle(), or after it's stopped.
+	 */
+	class LinkStatistics
+	{
+	public:
+		LinkStatistics();
+
+		unsigned long m_scans;
+		unsigned long m_framesSent;
+		unsigned long m_framesResent;
+		unsigned long m_framesReceived;
+		unsigned long m_headerErrors;
+		unsigned long m_payloadErrors;
+		unsigned long m_outOfOrder;
+		unsigned long m_duplicates;
+		unsigned long m_naksSent;
+		unsigned long m_naksReceived;
+		unsigned long m_timeouts;
+		unsigned long m_creditStalls;
+	};
+
+	const LinkStatistics& GetStatistics()
+	{ return m_stats; }
+
+	void PrintStatistics();
+
 protected:
+	class ScanBuffer;
+
 	void ComputeHeaderChecksum(AntikernelJTAGFrameHeader& header);
 	bool VerifyHeaderChecksum(AntikernelJTAGFrameHeader header);
+	bool VerifyHeader(AntikernelJTAGFrameHeader header);
 
 	unsigned int NextSeq(unsigned int seq)
 	{
@@ -127,10 +203,33 @@ protected:
 			return 0x3ff;
 	}
 
+	///Number of frames from b to a (modulo the sequence space)
+	unsigned int SeqDiff(unsigned int a, unsigned int b)
+	{ return (a - b) & 0x3ff; }
+
+	void FillLinkFields(AntikernelJTAGFrameHeader& header);
+	void ProcessLinkFields(const AntikernelJTAGFrameHeader& header);
+	void ProcessPayloadFrame(const AntikernelJTAGFrameHeader& header, const uint32_t* payload, bool crc_ok);
+	void SendNak();
+	void ReportGap();
+	void PopAckedFrames(unsigned int last_acked);
+	void QueueFrame(AntikernelJTAGFrameHeader header, const uint32_t* payload);
+	bool SendFrame(ScanBuffer& scan, size_t tx_buf_len, size_t index);
+
 	void PrintMessageHeader(const AntikernelJTAGFrameHeader& header);
 
-	uint8_t CRC8(uint32_t* data, unsigned int len);
-	uint32_t CRC32(uint32_t* data, unsigned int len);
+	void EncodeScan(ScanBuffer& scan);
+	void EncodeRPCFrames(ScanBuffer& scan, size_t tx_buf_len);
+	bool EncodeDMAFrames(ScanBuffer& scan, size_t tx_buf_len);
+	void DecodeScan(ScanBuffer& scan);
+	void UpdateCredits(const ScanBuffer& scan, unsigned int credits, size_t offset);
+	void ScanThread();
+
+	static uint8_t CRC8(const uint32_t* data, unsigned int len);
+	static uint32_t CRC32(const uint32_t* data, unsigned int len);
+	static uint8_t CRC8Bytewise(const uint32_t* data, unsigned int len);
+	static uint32_t CRC32Bytewise(const uint32_t* data, unsigned int len);
+	static void InitCRC();
 
 	/// The device we're debugging
 	JtagFPGA* m_fpga;
@@ -141,39 +240,175 @@ protected:
 	/// Set of free addresses
 	std::set<uint16_t> m_freeAddresses;
 
-	/// Sequence number of the next packet to be sent
+	/// Sequence number of the next payload frame to be sent
 	unsigned int m_nextSequence;
 
-	/// ACK number of next packet to be sent
+	/// ACK number of next packet to be sent (last payload frame received in order)
 	unsigned int m_nextAck;
 
 	///True if we're sending ACKs
 	bool m_acking;
 
-	///TODO: handle NAKs
+	/// Sequence number of the next payload frame we expect from the DUT
+	unsigned int m_rxExpected;
+
+	/// True if the next frame we send should NAK m_rxExpected
+	bool m_nakPending;
+
+	/// Scan count when we last sent a NAK, and what it was for (so we don't NAK the same loss over and over)
+	unsigned long m_lastNakScan;
+	unsigned int m_lastNakSeq;
+	bool m_nakOutstanding;
+
+	/**
+		@brief False after a bad header, until we've found our place in the stream again.
+
+		While hunting for a header, about one in 256 garbage word pairs will pass the header checksum by chance, so we
+		don't trust a header until it's confirmed by the payload CRC (or, for an idle frame, a good header right after).
+	 */
+	bool m_rxSynced;
+
+	/**
+		@brief A payload frame we've sent, kept until it's ACKed
+	 */
+	class RetransmitFrame
+	{
+	public:
+		/// The header (the ACK fields and checksum are redone when it's resent)
+		AntikernelJTAGFrameHeader m_header;
+
+		/// Offset of the payload (and its CRC) in m_retransmitWords, counting from m_retransmitBase
+		size_t m_offset;
+	};
+
+	/// Payload frames that haven't been ACKed yet, oldest first
+	std::deque<RetransmitFrame> m_retransmitFrames;
+
+	/// Payloads and CRCs of m_retransmitFrames, back to back
+	std::deque<uint32_t> m_retransmitWords;
+
+	/// Offset of the first word in m_retransmitWords
+	size_t m_retransmitBase;
 
-	/// Data to be sent to the DUT
-	std::list<uint32_t> m_txBuffer;
+	/// Number of frames at the front of m_retransmitFrames that have been sent since we last went back
+	size_t m_framesSent;
 
-	/// Data that came back from the DUT
-	std::list<uint32_t> m_rxBuffer;
+	/// Scan count when the oldest unacked frame was last acked or resent
+	unsigned long m_lastAckProgress;
 
-	//TODO: retransmit buffer
+	/**
+		@brief Payload words the DUT has room for, as of the frames we've queued so far.
 
-	/// Mutex for data going to the DUT
+		The DUT reports its free buffer space (in payload words) in the credits field of each header. By the time we see
+		that, more of our frames are on the way, so we take off everything sent after the DUT sent the header. Starts
+		at zero, so nothing is sent until the DUT has told us how much it can take.
+	 */
+	size_t m_txCredits;
+
+	/// Payload words in scans that have been queued but not decoded yet
+	size_t m_txWordsInFlight;
+
+	/// Set when a frame had to wait for credits during the current EncodeScan()
+	bool m_creditStalled;
+
+	/// Link layer counters
+	LinkStatistics m_stats;
+
+	/// Number of words shifted per Cycle()
+	size_t m_windowSize;
+
+	/// True to resize the window between m_minWindowSize and m_maxWindowSize depending on load
+	bool m_adaptiveWindow;
+
+	/// Limits for the adaptive window
+	size_t m_minWindowSize;
+	size_t m_maxWindowSize;
+
+	/// Payload words the DUT sent us in the last scan (for sizing the next one)
+	size_t m_lastRxPayload;
+
+	void UpdateWindowSize();
+
+	/// Data that came back from the DUT and hasn't been parsed yet (the start of a frame may be left over)
+	std::vector<uint32_t> m_rxBuffer;
+
+	/// Mutex for connection threads pushing to m_rpcTxFifo (the JTAG thread pops without locking)
 	std::mutex m_txMutex;
 
 	/// Buffer of data going to the DUT
-	std::list<RPCMessage> m_rpcTxFifo;
-	//TODO: DMA
+	SPSCQueue<RPCMessage> m_rpcTxFifo;
+
+	/// Mutex for connection threads pushing to m_dmaTxFifo
+	std::mutex m_dmaTxMutex;
+
+	/// DMA messages going to the DUT
+	SPSCQueue<DMAMessage> m_dmaTxFifo;
 
-	/// Mutex for data going to the host
-	std::mutex m_rxMutex;
+	/// Total packed length of everything in m_dmaTxFifo, for sizing the window
+	std::atomic<size_t> m_dmaTxWords;
+
+	/// True if RPC traffic crowded a DMA frame out of the last scan, so it goes first next time
+	bool m_dmaFirst;
 
 	/// Buffer of data going to the host
-	std::list<RPCMessage> m_rpcRxFifo;
+	SPSCQueue<RPCMessage> m_rpcRxFifo;
+
+	/// DMA messages going to the host
+	SPSCQueue<DMAMessage> m_dmaRxFifo;
+
+	/**
+		@brief One scan's worth of data, handed back and forth between Cycle() and the scan thread
+	 */
+	class ScanBuffer
+	{
+	public:
+		ScanBuffer()
+		: m_payloadWords(0)
+		{}
+
+		/// Data to shift in
+		std::vector<uint32_t> m_tx;
+
+		/// Data that was shifted out
+		std::vector<uint32_t> m_rx;
+
+		/// Set if the scan failed
+		std::exception_ptr m_error;
+
+		/// End offset in m_tx, and payload length, of each payload frame we sent (for credit tracking)
+		std::vector< std::pair<size_t, size_t> > m_payloadFrames;
+
+		/// Total payload words we sent
+		size_t m_payloadWords;
+	};
+
+	/// Enough buffers for a full pipeline, plus one for Cycle() to work on
+	ScanBuffer m_scanBuffers[SCAN_PIPELINE_DEPTH + 1];
+
+	/// Buffers that aren't in the pipeline (only touched by Cycle())
+	std::vector<ScanBuffer*> m_freeScans;
+
+	/// Number of scans queued or in progress
+	size_t m_scansInFlight;
+
+	/// Mutex for the scan queues and m_scanThreadQuit
+	std::mutex m_scanMutex;
+
+	/// Scans waiting for the adapter, and scans it's done with
+	std::deque<ScanBuffer*> m_pendingScans;
+	std::deque<ScanBuffer*> m_completedScans;
+
+	/// Signalled when a scan is queued, or we're shutting down
+	std::condition_variable m_scanReady;
+
+	/// Signalled when a scan completes
+	std::condition_variable m_scanDone;
+
+	/// Set to stop the scan thread
+	bool m_scanThreadQuit;
 
-	//TODO: DMA
+	/// Thread running the adapter
+	std::thread m_scanThread;
 };
 
 #endif
@@ -63,6 +63,26 @@ public:
 	 */
 	virtual bool RecvRPCMessage(RPCMessage& rx_msg) =0;
 
+	/**
+		@brief Sends a DMAMessage
+
+		@throw JtagException if the send fails
+
+		@param tx_msg	Message to send
+	 */
+	virtual void SendDMAMessage(const DMAMessage& tx_msg)=0;
+
+	/**
+		@brief Checks if any DMAMessage objects are ready to read and performs a read if so
+
+		@throw JtagException if the read fails
+
+		@param rx_msg	Message buffer to read into
+
+		@return true if a message was received, false if no data was ready
+	 */
+	virtual bool RecvDMAMessage(DMAMessage& rx_msg) =0;
+
 	//virtual bool RecvRPCMessageBlocking(RPCMessage& rx_msg) =0;
 	//virtual bool RecvRPCMessageBlockingWithTimeout(RPCMessage& rx_msg, double timeout) =0;
 
@@ -179,41 +179,95 @@ bool NOCSwitchInterface::RecvRPCMessageBlockingWithTimeout(RPCMessage& rx_msg, d
 	return false;
 }
 
-/*
 void NOCSwitchInterface::SendDMAMessage(const DMAMessage& tx_msg)
 {
-	uint16_t op = NOCSWITCH_OP_SENDDMA;
-	m_socket.SendLooped((unsigned char*)&op, 2);
-
-	uint32_t buf[515];
-	tx_msg.Pack(buf);
-	m_socket.SendLooped((unsigned char*)buf, 515*4);
+	if(tx_msg.len > DMAMessage::MAX_DATA_WORDS)
+		throw JtagExceptionWrapper("DMA message is too long", "");
+
+	//Opcode and message go out in one send, so a bulk transfer doesn't cost an extra packet per message
+	unsigned char buf[1 + (DMAMessage::HEADER_WORDS + DMAMessage::MAX_DATA_WORDS) * 4];
+	buf[0] = NOCSWITCH_OP_SENDDMA;
+	tx_msg.Pack(buf + 1);
+	m_socket.SendLooped(buf, 1 + tx_msg.GetPackedLength()*4);
 }
 
 bool NOCSwitchInterface::RecvDMAMessage(DMAMessage& rx_msg)
 {
-	uint16_t op = NOCSWITCH_OP_RECVDMA;
+	//Read from the FIFO, if there's stuff there don't even bother hitting the server
+	if(!m_dmaRxQueue.empty())
+	{
+		rx_msg = m_dmaRxQueue.front();
+		m_dmaRxQueue.pop_front();
+		return true;
+	}
 
-	m_socket.SendLooped((unsigned char*)&op, 2);
-	uint8_t found = 0;
-	m_socket.RecvLooped((unsigned char*)&found, 1);
-	if(found)
+	//Ping the server to flush anything in its transmit queue to us (see RecvRPCMessage)
+	uint8_t op = NOCSWITCH_OP_PING;
+	m_socket.SendLooped((unsigned char*)&op, 1);
+	ReadFramesUntil(op);
+
+	if(!m_dmaRxQueue.empty())
 	{
-		uint32_t buf[515];
-		m_socket.RecvLooped((unsigned char*)buf, 515*4);
-		rx_msg.Unpack(buf);
+		rx_msg = m_dmaRxQueue.front();
+		m_dmaRxQueue.pop_front();
 		return true;
 	}
+
 	return false;
 }
 
-bool NOCSwitchInterface::SendDMAMessageNonblocking(const DMAMessage& tx_msg)
+void NOCSwitchInterface::RecvDMAMessageBlocking(DMAMessage& rx_msg)
 {
-	//TCP buffer ensures this send is nonblocking, no buffering on our part required
-	SendDMAMessage(tx_msg);
-	return true;
+	//If there's anything in the RX FIFO, return it immediately
+	if(!m_dmaRxQueue.empty())
+	{
+		rx_msg = m_dmaRxQueue.front();
+		m_dmaRxQueue.pop_front();
+		return;
+	}
+
+	//Nothing there, wait until we get a DMA message
+	ReadFramesUntil(NOCSWITCH_OP_RECVDMA);
+	ReadDMAMessage(rx_msg);
+}
+
+bool NOCSwitchInterface::RecvDMAMessageBlockingWithTimeout(DMAMessage& rx_msg, double timeout)
+{
+	double tstart = GetTime();
+
+	//Same backoff as RecvRPCMessageBlockingWithTimeout
+	int delay_us = 5;
+	while(true)
+	{
+		if(RecvDMAMessage(rx_msg))
+			return true;
+
+		usleep(delay_us);
+		if(delay_us < 100000)
+			delay_us *= 5;
+
+		if( (GetTime() - tstart) > timeout)
+			break;
+	}
+
+	return false;
+}
+
+/**
+	@brief Reads the body of a DMA message from the server (the opcode has already been read)
+ */
+void NOCSwitchInterface::ReadDMAMessage(DMAMessage& rx_msg)
+{
+	unsigned char buf[(DMAMessage::HEADER_WORDS + DMAMessage::MAX_DATA_WORDS) * 4];
+	if(!m_socket.RecvLooped(buf, DMAMessage::HEADER_WORDS*4))
+		throw JtagExceptionWrapper("connection dropped", "");
+	if(!rx_msg.UnpackHeader(buf))
+		throw JtagExceptionWrapper("Bad DMA message length from server", "");
+	size_t len = rx_msg.GetDataLength();
+	if(len && !m_socket.RecvLooped(buf + DMAMessage::HEADER_WORDS*4, len*4))
+		throw JtagExceptionWrapper("connection dropped", "");
+	rx_msg.Unpack(buf);
 }
-*/
 
 bool NOCSwitchInterface::AllocateClientAddress(uint16_t& addr)
 {
@@ -270,6 +324,14 @@ void NOCSwitchInterface::ReadFramesUntil(uint8_t type)
 				}
 				break;
 
+			case NOCSWITCH_OP_RECVDMA:
+				{
+					DMAMessage rx_msg;
+					ReadDMAMessage(rx_msg);
+					m_dmaRxQueue.push_back(rx_msg);
+				}
+				break;
+
 			default:
 				LogWarning("Don't know what to do with message of type %x\n", op);
 		}
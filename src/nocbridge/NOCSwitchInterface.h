@@ -35,12 +35,10 @@
 #ifndef NOCSwitchInterface_h
 #define NOCSwitchInterface_h
 
-//class DMAMessage;
-
 /**
 	@brief A connection to a nocswitch instance
 
-	Allows sending and receiving of RPC messages. DMA support will be added in the future.
+	Allows sending and receiving of RPC and DMA messages.
 
 	\ingroup libjtaghal
  */
@@ -58,11 +56,10 @@ public:
 	virtual void RecvRPCMessageBlocking(RPCMessage& rx_msg);
 	virtual bool RecvRPCMessageBlockingWithTimeout(RPCMessage& rx_msg, double timeout);
 
-	/*
 	virtual void SendDMAMessage(const DMAMessage& tx_msg);
-	virtual bool SendDMAMessageNonblocking(const DMAMessage& tx_msg);
 	virtual bool RecvDMAMessage(DMAMessage& rx_msg);
-	*/
+	virtual void RecvDMAMessageBlocking(DMAMessage& rx_msg);
+	virtual bool RecvDMAMessageBlockingWithTimeout(DMAMessage& rx_msg, double timeout);
 
 	virtual bool AllocateClientAddress(uint16_t& addr);
 	virtual void FreeClientAddress(uint16_t addr);
@@ -77,6 +74,11 @@ protected:
 	///Queue of inbound messages waiting for the client to read them
 	//TODO: multiple queues for multiple clients?
 	std::list<RPCMessage> m_rxqueue;
+
+	///Queue of inbound DMA messages waiting for the client to read them
+	std::list<DMAMessage> m_dmaRxQueue;
+
+	void ReadDMAMessage(DMAMessage& rx_msg);
 };
 
 #endif
@@ -0,0 +1,149 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of SPSCQueue
+ */
+#ifndef SPSCQueue_h
+#define SPSCQueue_h
+
+#include <atomic>
+#include <vector>
+
+/**
+	@brief Fixed-capacity lock-free queue with one producer thread and one consumer thread
+
+	Storage is a contiguous ring allocated once, so pushing and popping never touch the heap. The producer owns
+	m_tail and the consumer owns m_head; each only reads the other's index, so no locks are needed as long as there is
+	exactly one thread on each end. Multiple producers must serialize among themselves.
+ */
+template<class T>
+class SPSCQueue
+{
+public:
+
+	/**
+		@brief Creates the queue
+
+		@param capacity		Number of elements the queue can hold (rounded up to a power of two)
+	 */
+	SPSCQueue(size_t capacity)
+		: m_head(0)
+		, m_tail(0)
+	{
+		size_t size = 1;
+		while(size < capacity)
+			size <<= 1;
+		m_buffer.resize(size);
+		m_mask = size - 1;
+	}
+
+	/**
+		@brief Appends an element to the queue (producer side)
+
+		@return false if the queue is full
+	 */
+	bool Push(const T& value)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if(tail - m_head.load(std::memory_order_acquire) > m_mask)
+			return false;
+
+		m_buffer[tail & m_mask] = value;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+		@brief Removes the oldest element from the queue (consumer side)
+
+		@return false if the queue is empty
+	 */
+	bool Pop(T& value)
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if(head == m_tail.load(std::memory_order_acquire))
+			return false;
+
+		value = m_buffer[head & m_mask];
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+		@brief Looks at the oldest element without removing it (consumer side)
+
+		@return nullptr if the queue is empty
+	 */
+	T* Front()
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if(head == m_tail.load(std::memory_order_acquire))
+			return nullptr;
+		return &m_buffer[head & m_mask];
+	}
+
+	/**
+		@brief Removes the oldest element, once the caller is done with the one returned by Front() (consumer side)
+	 */
+	void Discard()
+	{ m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+	///Number of elements in the queue (only a snapshot if the other end is active)
+	size_t size() const
+	{ return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire); }
+
+	bool empty() const
+	{ return size() == 0; }
+
+	size_t capacity() const
+	{ return m_mask + 1; }
+
+protected:
+
+	///The ring itself
+	std::vector<T> m_buffer;
+
+	///Capacity minus one (capacity is a power of two)
+	size_t m_mask;
+
+	///Index of the next element to pop (free-running, wrapped by m_mask). Owned by the consumer.
+	std::atomic<size_t> m_head;
+
+	///Keep the two indexes on separate cache lines so the threads don't fight over them.
+	///(Padding rather than alignas, since pre-C++17 operator new ignores extended alignment.)
+	char m_padding[64];
+
+	///Index of the next element to push. Owned by the producer.
+	std::atomic<size_t> m_tail;
+};
+
+#endif
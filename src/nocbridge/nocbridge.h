@@ -36,6 +36,10 @@
 #ifndef nocbridge_h
 #define nocbridge_h
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <thread>
 #include <vector>
 
 #include "../log/log.h"
@@ -43,6 +47,8 @@
 #include "../xptools/Socket.h"
 
 #include "RPCMessage.h"
+#include "DMAMessage.h"
+#include "SPSCQueue.h"
 
 #include "NOCBridgeInterface.h"
 #include "JTAGNOCBridgeInterface.h"
@@ -26,16 +26,38 @@
 * POSSIBILITY OF SUCH DAMAGE.                                                                                          *
 *                                                                                                                      *
 ***********************************************************************************************************************/
-
 /**
 	@file
 	@author Andrew D. Zonenberg
 	@brief Implementation of ConnectionContext
  */
 #include "nocswitch.h"
+#include "JtagDebugBridge_addresses_enum.h"
+
+using namespace std;
+
+bool IsInDebugSubnet(int addr)
+{
+	return (addr <= DEBUG_HIGH_ADDR) && (addr >= DEBUG_LOW_ADDR);
+}
+
+///Mutex for g_contextMap
+mutex g_contextMutex;
+
+///Map from node address to connection context
+map<uint16_t, ConnectionContext*> g_contextMap;
 
-ConnectionContext::ConnectionContext(unsigned int nsock)
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+const size_t ConnectionContext::MAX_TX_BUFFER;
+
+ConnectionContext::ConnectionContext(unsigned int nsock, int epoll)
 	: m_socket(nsock)
+	, m_closed(false)
+	, m_hungUp(false)
+	, m_epoll(epoll)
+	, m_txStalled(false)
 {
 
 }
@@ -44,3 +66,345 @@ ConnectionContext::~ConnectionContext()
 {
 
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sending
+
+/**
+	@brief Send data to the client, or buffer it if the socket is full. Safe to call from any thread.
+
+	@return false if the connection failed, or the client has stopped reading (it'll be closed shortly either way)
+ */
+bool ConnectionContext::Send(const unsigned char* buf, size_t len)
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	if(m_txBuffer.size() + len > MAX_TX_BUFFER)
+	{
+		LogWarning("Client isn't reading its messages, dropping connection\n");
+		shutdown(m_socket, SHUT_RDWR);
+		return false;
+	}
+
+	//If there's already data waiting, we're waiting for the socket to be writable. Get in line.
+	bool was_empty = m_txBuffer.empty();
+	m_txBuffer.insert(m_txBuffer.end(), buf, buf + len);
+	if(!was_empty)
+		return true;
+
+	if(!Flush())
+	{
+		shutdown(m_socket, SHUT_RDWR);
+		return false;
+	}
+
+	//Couldn't send it all, so find out when we can send the rest
+	if(!m_txBuffer.empty())
+		UpdateEvents();
+	return true;
+}
+
+/**
+	@brief Send as much of the TX buffer as the socket will take. Call with m_mutex held.
+
+	@return false if the connection failed
+ */
+bool ConnectionContext::Flush()
+{
+	size_t sent = 0;
+	while(sent < m_txBuffer.size())
+	{
+		ssize_t len = send(m_socket, &m_txBuffer[sent], m_txBuffer.size() - sent, MSG_NOSIGNAL);
+		if(len > 0)
+			sent += len;
+		else if( (len < 0) && (errno == EINTR) )
+			continue;
+		else if( (len < 0) && ( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) )
+			break;
+		else
+			return false;
+	}
+
+	m_txBuffer.erase(m_txBuffer.begin(), m_txBuffer.begin() + sent);
+	return true;
+}
+
+/**
+	@brief Send anything that's buffered, then ask epoll for the next event on this connection.
+
+	Called by the reactor when it's done servicing the connection.
+
+	@return false if the connection failed
+ */
+bool ConnectionContext::Rearm()
+{
+	lock_guard<mutex> lock(m_mutex);
+	if(!Flush())
+		return false;
+	UpdateEvents();
+	return true;
+}
+
+/**
+	@brief Re-arm our (one-shot) epoll registration, watching for writability too if we have data waiting.
+	Call with m_mutex held.
+
+	We don't watch for incoming data while we're stalled on the JTAG link, so the client's data waits in the kernel.
+ */
+void ConnectionContext::UpdateEvents()
+{
+	epoll_event ev;
+	ev.events = EPOLLONESHOT;
+	if(!m_txStalled)
+		ev.events |= EPOLLIN;
+	if(!m_txBuffer.empty())
+		ev.events |= EPOLLOUT;
+	ev.data.fd = m_socket;
+	if(0 != epoll_ctl(m_epoll, EPOLL_CTL_MOD, m_socket, &ev))
+		LogWarning("Failed to update epoll registration for client socket\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Receiving
+
+/**
+	@brief Read whatever the client has sent, without blocking.
+
+	Reads a bounded amount at a time so one busy client can't hog a reactor thread. If there's more, the socket is
+	still readable and we'll be back once everyone else has had a turn.
+
+	@return false if the connection was closed or failed
+ */
+bool ConnectionContext::Receive()
+{
+	const size_t chunk = 4096;
+	for(int i=0; i<16; i++)
+	{
+		size_t old_size = m_rxBuffer.size();
+		m_rxBuffer.resize(old_size + chunk);
+		ssize_t len = recv(m_socket, &m_rxBuffer[old_size], chunk, 0);
+		m_rxBuffer.resize(old_size + max(len, (ssize_t)0));
+
+		//Got some data. If it didn't fill the buffer, that's probably all there is for now.
+		if(len > 0)
+		{
+			if( (size_t)len < chunk)
+				break;
+		}
+
+		//Client closed the connection
+		else if(len == 0)
+			return false;
+
+		else if(errno == EINTR)
+			continue;
+		else if( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+			break;
+		else
+			return false;
+	}
+
+	return true;
+}
+
+/**
+	@brief Act on every complete message in the RX buffer, leaving any partial message for next time.
+
+	Stops early, leaving the rest in the buffer, if the JTAG link's TX queue is full (see IsTxStalled()).
+
+	@return false if the client asked to disconnect
+ */
+bool ConnectionContext::ProcessMessages(JTAGNOCBridgeInterface* iface)
+{
+	SetTxStalled(false);
+
+	size_t rpos = 0;
+	bool quit = false;
+	while(!quit && (rpos < m_rxBuffer.size()) )
+	{
+		uint8_t* buf = &m_rxBuffer[rpos];
+		size_t avail = m_rxBuffer.size() - rpos;
+
+		//Figure out how long the message is, and stop if we don't have all of it yet
+		size_t len = 1;
+		switch(buf[0])
+		{
+		case NOCSWITCH_OP_RPC:
+			len += 16;
+			break;
+
+		case NOCSWITCH_OP_SENDDMA:
+			{
+				len += DMAMessage::HEADER_WORDS * 4;
+				if(avail < len)
+					break;
+
+				DMAMessage msg;
+				if(!msg.UnpackHeader(buf + 1))
+					throw JtagExceptionWrapper("DMA message too long, dropping connection", "");
+				len += msg.GetDataLength() * 4;
+			}
+			break;
+
+		default:
+			break;
+		}
+		if(avail < len)
+			break;
+
+		quit = !ProcessMessage(buf, iface);
+		if(m_txStalled)
+			break;
+		rpos += len;
+	}
+
+	m_rxBuffer.erase(m_rxBuffer.begin(), m_rxBuffer.begin() + rpos);
+	return !quit;
+}
+
+/**
+	@brief Handle a single message from the client
+
+	@param buf		The message, starting with the opcode (must be complete)
+	@param iface	The JTAG link
+
+	@return false if the client asked to disconnect
+ */
+bool ConnectionContext::ProcessMessage(uint8_t* buf, JTAGNOCBridgeInterface* iface)
+{
+	uint8_t opcode = buf[0];
+	switch(opcode)
+	{
+	case NOCSWITCH_OP_ALLOC_ADDR:
+		{
+			LogNotice("Allocate-address request\n");
+
+			//Try to allocate the address.
+			//If it worked, record it so we know to check stuff destined to it in the future.
+			uint16_t addr;
+			uint8_t reply[4];
+			reply[0] = opcode;
+			reply[1] = iface->AllocateClientAddress(addr);
+			if(reply[1])
+			{
+				memcpy(reply + 2, &addr, 2);
+				m_addresses.emplace(addr);
+
+				lock_guard<mutex> lock(g_contextMutex);
+				g_contextMap[addr] = this;
+			}
+
+			//Send back the opcode and tell the client how it went, all in one go.
+			//(Note that we don't send the address field if the allocation failed!)
+			if(!Send(reply, reply[1] ? 4 : 2))
+				throw JtagExceptionWrapper("connection dropped", "");
+		}
+		break;
+
+	case NOCSWITCH_OP_FREE_ADDR:
+		{
+			//TODO: implement this
+			LogWarning("NOCSWITCH_OP_FREE_ADDR not implemented yet\n");
+		}
+		break;
+
+	case NOCSWITCH_OP_RPC:
+		{
+			RPCMessage msg;
+			msg.Unpack(buf + 1);
+
+			//Patch in source address
+			/*
+			if(msg.from == 0x0000)
+				msg.from = sender;
+			else*/ if(!IsInDebugSubnet(msg.from))
+			{
+				throw JtagExceptionWrapper(
+					"Spoofed source address received on inbound packet, dropping connection",
+					"");
+			}
+
+			//If the message is destined for the debug subnet send it here instead
+			if(IsInDebugSubnet(msg.to))
+			{
+				LogError("Loopback to debug addresses not yet implemented\n");
+				//MutexLock lock(g_recvmutex);
+				//g_recvqueue[msg.to].push_back(msg);
+			}
+
+			//Nope, put it on the queue for the JTAG link (or try again later if it's full)
+			else if(!iface->TrySendRPCMessage(msg))
+				SetTxStalled(true);
+		}
+		break;
+
+	case NOCSWITCH_OP_PING:
+		{
+			//Send back the opcode (that's all there is to it)
+			if(!Send(&opcode, 1))
+				throw JtagExceptionWrapper("connection dropped", "");
+		}
+		break;
+
+	case NOCSWITCH_OP_SENDDMA:
+		{
+			//ProcessMessages() already checked the length
+			DMAMessage msg;
+			msg.Unpack(buf + 1);
+
+			//Same address checks as RPC
+			if(!IsInDebugSubnet(msg.from))
+			{
+				throw JtagExceptionWrapper(
+					"Spoofed source address received on inbound packet, dropping connection",
+					"");
+			}
+
+			if(IsInDebugSubnet(msg.to))
+				LogError("Loopback to debug addresses not yet implemented\n");
+			else if(!iface->TrySendDMAMessage(msg))
+				SetTxStalled(true);
+		}
+		break;
+
+	case NOCSWITCH_OP_QUIT:
+		LogVerbose("Client disconnecting\n");
+		return false;
+
+	default:
+		{
+			throw JtagExceptionWrapper(
+				"Unrecognized opcode received from client",
+				"");
+		}
+	}
+
+	return true;
+}
+
+/**
+	@brief Note whether we're waiting for room in the JTAG link's TX queue. Call with m_ioMutex held.
+ */
+void ConnectionContext::SetTxStalled(bool stalled)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_txStalled = stalled;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cleanup
+
+/**
+	@brief Clean up the global context table so the JTAG thread doesn't try to send to our addresses any more, and
+	give the addresses back so new clients can have them.
+ */
+void ConnectionContext::RemoveAddresses(JTAGNOCBridgeInterface* iface)
+{
+	lock_guard<mutex> lock(g_contextMutex);
+	for(auto addr : m_addresses)
+	{
+		g_contextMap.erase(addr);
+		iface->FreeClientAddress(addr);
+	}
+	m_addresses.clear();
+}
@@ -26,7 +26,6 @@
 * POSSIBILITY OF SUCH DAMAGE.                                                                                          *
 *                                                                                                                      *
 ***********************************************************************************************************************/
-
 /**
 	@file
 	@author Andrew D. Zonenberg
@@ -37,16 +36,68 @@
 
 /**
 	@brief A single connection
+
+	Sockets are non-blocking. Incoming data is buffered until there's a whole message to act on, and outgoing data
+	that the kernel won't take yet is buffered until the socket is writable again (see ConnectionReactor).
+
+	If the JTAG link's TX queue is full, the message stays in the RX buffer and we stop reading from the client until
+	the JTAG thread has made room (the reactor retries us then).
  */
 class ConnectionContext
 {
 public:
-	ConnectionContext(unsigned int nsock);
+	ConnectionContext(unsigned int nsock, int epoll);
 	virtual ~ConnectionContext();
 
+	bool Send(const unsigned char* buf, size_t len);
+
+	bool Receive();
+	bool ProcessMessages(JTAGNOCBridgeInterface* iface);
+	bool Rearm();
+	void RemoveAddresses(JTAGNOCBridgeInterface* iface);
+
+	///True if we're waiting for room in the JTAG link's TX queue
+	bool IsTxStalled()
+	{ return m_txStalled; }
+
+	///Most data we'll buffer for a client that isn't reading before giving up on it
+	static const size_t MAX_TX_BUFFER = 16 * 1024 * 1024;
+
+	///Mutex for m_txBuffer and the epoll registration (held while sending)
 	std::mutex m_mutex;
+
+	///Held by the reactor thread servicing this connection, so only one thread reads from it at a time
+	std::mutex m_ioMutex;
+
 	Socket m_socket;
+
+	///Set once the connection has been closed, so a thread that was waiting on m_ioMutex knows to leave it alone
+	bool m_closed;
+
+	///Set once the client has closed its end. We still act on whatever it sent before closing the connection.
+	bool m_hungUp;
+
+protected:
+	bool ProcessMessage(uint8_t* buf, JTAGNOCBridgeInterface* iface);
+	bool Flush();
+	void UpdateEvents();
+	void SetTxStalled(bool stalled);
+
+	///The epoll instance we're registered with
+	int m_epoll;
+
+	///Data from the client that hasn't been processed yet (may end partway through a message)
+	std::vector<uint8_t> m_rxBuffer;
+
+	///Data for the client that the kernel hasn't taken yet
+	std::vector<uint8_t> m_txBuffer;
+
+	///The set of addresses assigned to this connection
+	std::set<uint16_t> m_addresses;
+
+	///Set if the message at the start of m_rxBuffer is waiting for room in the JTAG link's TX queue.
+	///Only changed with both m_ioMutex and m_mutex held, so either one is enough to read it.
+	bool m_txStalled;
 };
 
 #endif
-
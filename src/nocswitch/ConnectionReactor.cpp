@@ -0,0 +1,358 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Implementation of ConnectionReactor
+ */
+#include "nocswitch.h"
+
+using namespace std;
+
+const int ConnectionReactor::POLL_TIMEOUT;
+const int ConnectionReactor::MAX_EVENTS;
+
+static bool SetNonBlocking(int sock)
+{
+	int flags = fcntl(sock, F_GETFL, 0);
+	if(flags < 0)
+		return false;
+	return (0 == fcntl(sock, F_SETFL, flags | O_NONBLOCK));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Construction / destruction
+
+/**
+	@brief Sets up the reactor
+
+	@param listen_socket	Socket to accept connections on (must already be listening)
+	@param iface			The JTAG link
+ */
+ConnectionReactor::ConnectionReactor(int listen_socket, JTAGNOCBridgeInterface* iface)
+	: m_listenSocket(listen_socket)
+	, m_iface(iface)
+{
+	m_epoll = epoll_create1(0);
+	if(m_epoll < 0)
+	{
+		throw JtagExceptionWrapper(
+			"Failed to create epoll instance",
+			"");
+	}
+
+	if(!SetNonBlocking(m_listenSocket))
+	{
+		close(m_epoll);
+		throw JtagExceptionWrapper(
+			"Failed to make listening socket non-blocking",
+			"");
+	}
+
+	epoll_event ev;
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.fd = m_listenSocket;
+	if(0 != epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listenSocket, &ev))
+	{
+		close(m_epoll);
+		throw JtagExceptionWrapper(
+			"Failed to add listening socket to epoll",
+			"");
+	}
+
+	m_wakeup = eventfd(0, EFD_NONBLOCK);
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.fd = m_wakeup;
+	if( (m_wakeup < 0) || (0 != epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev)) )
+	{
+		if(m_wakeup >= 0)
+			close(m_wakeup);
+		close(m_epoll);
+		throw JtagExceptionWrapper(
+			"Failed to set up wakeup eventfd",
+			"");
+	}
+}
+
+ConnectionReactor::~ConnectionReactor()
+{
+	CloseAllConnections();
+	close(m_wakeup);
+	close(m_epoll);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Event loop
+
+/**
+	@brief Service clients until g_quitting is set, then close all of the connections
+
+	@param nthreads		Number of threads to use (including the calling thread)
+ */
+void ConnectionReactor::Run(unsigned int nthreads)
+{
+	vector<thread> threads;
+	for(unsigned int i=1; i<nthreads; i++)
+		threads.push_back(thread(&ConnectionReactor::WorkerThread, this));
+
+	WorkerThread();
+
+	for(auto& t : threads)
+		t.join();
+
+	CloseAllConnections();
+}
+
+/**
+	@brief Wait for sockets to become ready and deal with them
+ */
+void ConnectionReactor::WorkerThread()
+{
+	epoll_event events[MAX_EVENTS];
+	while(!g_quitting)
+	{
+		int nevents = epoll_wait(m_epoll, events, MAX_EVENTS, POLL_TIMEOUT);
+		if(nevents < 0)
+		{
+			if(errno == EINTR)
+				continue;
+
+			//Without epoll we can't talk to anybody, so shut down
+			LogError("epoll_wait failed (%s)\n", strerror(errno));
+			g_quitting = true;
+			break;
+		}
+
+		for(int i=0; i<nevents; i++)
+		{
+			if(events[i].data.fd == m_listenSocket)
+				AcceptConnections();
+			else if(events[i].data.fd == m_wakeup)
+				RetryStalledConnections();
+			else
+				ServiceConnection(events[i].data.fd);
+		}
+	}
+}
+
+/**
+	@brief Accept everyone waiting to connect
+ */
+void ConnectionReactor::AcceptConnections()
+{
+	while(true)
+	{
+		int sock = accept(m_listenSocket, NULL, NULL);
+		if(sock < 0)
+		{
+			if(errno == EINTR)
+				continue;
+
+			//EAGAIN means that's everyone for now.
+			//If the socket was closed we're shutting down, so don't complain about that either.
+			if( (errno != EAGAIN) && (errno != EWOULDBLOCK) && !g_quitting)
+				LogWarning("Failed to accept connection (%s)\n", strerror(errno));
+			break;
+		}
+
+		LogNotice("Got a connection\n");
+		auto ctx = make_shared<ConnectionContext>(sock, m_epoll);
+
+		//Set no-delay flag, and make sure we never block on it
+		if(!ctx->m_socket.DisableNagle() || !SetNonBlocking(sock))
+		{
+			LogError("Failed to set up client socket\n");
+			continue;
+		}
+
+		//Add it to the map before epoll can tell anyone about it
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_connections[sock] = ctx;
+		}
+
+		epoll_event ev;
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.fd = sock;
+		if(0 != epoll_ctl(m_epoll, EPOLL_CTL_ADD, sock, &ev))
+		{
+			LogError("Failed to add client socket to epoll\n");
+			lock_guard<mutex> lock(m_mutex);
+			m_connections.erase(sock);
+		}
+	}
+
+	//Ready for the next batch
+	epoll_event ev;
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.fd = m_listenSocket;
+	epoll_ctl(m_epoll, EPOLL_CTL_MOD, m_listenSocket, &ev);
+}
+
+/**
+	@brief Deal with a client socket that's readable (or writable, if we had data waiting for it)
+ */
+void ConnectionReactor::ServiceConnection(int sock)
+{
+	//Look up the connection. If it's not there, it was closed after the event was queued.
+	shared_ptr<ConnectionContext> ctx;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		auto it = m_connections.find(sock);
+		if(it == m_connections.end())
+			return;
+		ctx = it->second;
+	}
+
+	bool open = true;
+	{
+		lock_guard<mutex> lock(ctx->m_ioMutex);
+		if(ctx->m_closed)
+			return;
+
+		try
+		{
+			//Act on everything we've got, even if the client has gone away (it might have sent a quit first).
+			//If we're stalled on the JTAG link, deal with what's already buffered before reading any more.
+			if(!ctx->IsTxStalled() && !ctx->Receive())
+				ctx->m_hungUp = true;
+			if(!ctx->ProcessMessages(m_iface))
+				open = false;
+
+			//Once everything it sent before hanging up has gone to the JTAG link, we're done with the client
+			if(ctx->m_hungUp && !ctx->IsTxStalled())
+				open = false;
+
+			if(open && !ctx->Rearm())
+				open = false;
+		}
+		catch(const JtagException& ex)
+		{
+			LogError("%s\n", ex.GetDescription().c_str());
+			open = false;
+		}
+
+		//Wait for the JTAG thread to tell us there's room
+		if(open && ctx->IsTxStalled())
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stalled.insert(sock);
+		}
+	}
+
+	if(!open)
+		CloseConnection(ctx);
+}
+
+/**
+	@brief Wake a pool thread to retry the stalled clients, if there are any and the JTAG link has room for them now.
+
+	Called by the JTAG thread after each Cycle(). We check every time rather than on a change, so a client that
+	stalls just after a check is picked up by the next one.
+ */
+void ConnectionReactor::CheckStalledConnections()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		if(m_stalled.empty())
+			return;
+	}
+	if(!m_iface->HasTxSpace())
+		return;
+
+	uint64_t count = 1;
+	if(write(m_wakeup, &count, sizeof(count)) < 0)
+		LogWarning("Failed to wake reactor (%s)\n", strerror(errno));
+}
+
+/**
+	@brief Give every client that was waiting on the JTAG link another go
+ */
+void ConnectionReactor::RetryStalledConnections()
+{
+	//Clear the count (EAGAIN just means there was nothing to clear)
+	uint64_t count;
+	if( (read(m_wakeup, &count, sizeof(count)) < 0) && (errno != EAGAIN) )
+		LogWarning("Failed to read reactor wakeup (%s)\n", strerror(errno));
+
+	set<int> stalled;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		stalled.swap(m_stalled);
+	}
+
+	//Ready for the next wakeup. Anyone who stalls again goes back on the list.
+	epoll_event ev;
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.fd = m_wakeup;
+	epoll_ctl(m_epoll, EPOLL_CTL_MOD, m_wakeup, &ev);
+
+	for(auto sock : stalled)
+		ServiceConnection(sock);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cleanup
+
+/**
+	@brief Forget about a connection. The socket is closed once the last reference to the context goes away.
+ */
+void ConnectionReactor::CloseConnection(shared_ptr<ConnectionContext> ctx)
+{
+	lock_guard<mutex> lock(ctx->m_ioMutex);
+	if(ctx->m_closed)
+		return;
+	ctx->m_closed = true;
+
+	//Make sure the JTAG thread won't send it anything else
+	ctx->RemoveAddresses(m_iface);
+
+	//and that nobody else will go looking for it
+	int sock = ctx->m_socket;
+	epoll_ctl(m_epoll, EPOLL_CTL_DEL, sock, NULL);
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_connections.erase(sock);
+		m_stalled.erase(sock);
+	}
+
+	LogNotice("Client quit\n");
+}
+
+void ConnectionReactor::CloseAllConnections()
+{
+	map<int, shared_ptr<ConnectionContext> > connections;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		connections = m_connections;
+	}
+
+	for(auto it : connections)
+		CloseConnection(it.second);
+}
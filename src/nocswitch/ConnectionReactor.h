@@ -0,0 +1,93 @@
+/***********************************************************************************************************************
+*                                                                                                                      *
+* ANTIKERNEL v0.1                                                                                                      *
+*                                                                                                                      *
+* Copyright (c) 2012-2017 Andrew D. Zonenberg                                                                          *
+* All rights reserved.                                                                                                 *
+*                                                                                                                      *
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the     *
+* following conditions are met:                                                                                        *
+*                                                                                                                      *
+*    * Redistributions of source code must retain the above copyright notice, this list of conditions, and the         *
+*      following disclaimer.                                                                                           *
+*                                                                                                                      *
+*    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the       *
+*      following disclaimer in the documentation and/or other materials provided with the distribution.                *
+*                                                                                                                      *
+*    * Neither the name of the author nor the names of any contributors may be used to endorse or promote products     *
+*      derived from this software without specific prior written permission.                                           *
+*                                                                                                                      *
+* THIS SOFTWARE IS PROVIDED BY THE AUTHORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED   *
+* TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL *
+* THE AUTHORS BE HELD LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES        *
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR       *
+* BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT *
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE       *
+* POSSIBILITY OF SUCH DAMAGE.                                                                                          *
+*                                                                                                                      *
+***********************************************************************************************************************/
+/**
+	@file
+	@author Andrew D. Zonenberg
+	@brief Declaration of ConnectionReactor
+ */
+#ifndef ConnectionReactor_h
+#define ConnectionReactor_h
+
+/**
+	@brief Services every client connection from a small, fixed pool of threads
+
+	The listening socket and all client sockets are non-blocking and registered with one epoll instance, in one-shot
+	mode: each time a socket becomes ready, exactly one pool thread gets the event. It reads and acts on whatever's
+	there, flushes anything waiting to go out, then re-arms the socket.
+
+	A client whose messages don't fit in the JTAG link's TX queue isn't re-armed for reading. The JTAG thread calls
+	CheckStalledConnections() after each scan, and once there's room, it signals an eventfd registered with the same
+	epoll instance. Whichever pool thread gets that event retries the stalled clients.
+ */
+class ConnectionReactor
+{
+public:
+	ConnectionReactor(int listen_socket, JTAGNOCBridgeInterface* iface);
+	virtual ~ConnectionReactor();
+
+	void Run(unsigned int nthreads);
+	void CheckStalledConnections();
+
+	///How long epoll_wait() blocks before checking g_quitting (in ms)
+	static const int POLL_TIMEOUT = 100;
+
+	///Most events each thread picks up per epoll_wait() call
+	static const int MAX_EVENTS = 16;
+
+protected:
+	void WorkerThread();
+	void AcceptConnections();
+	void ServiceConnection(int sock);
+	void RetryStalledConnections();
+	void CloseConnection(std::shared_ptr<ConnectionContext> ctx);
+	void CloseAllConnections();
+
+	///The epoll instance
+	int m_epoll;
+
+	///Socket we're accepting connections on
+	int m_listenSocket;
+
+	///eventfd the JTAG thread signals when stalled clients can go again
+	int m_wakeup;
+
+	///The JTAG link
+	JTAGNOCBridgeInterface* m_iface;
+
+	///Mutex for m_connections and m_stalled
+	std::mutex m_mutex;
+
+	///Map from socket to connection context
+	std::map<int, std::shared_ptr<ConnectionContext> > m_connections;
+
+	///Sockets of connections waiting for room in the JTAG link's TX queue
+	std::set<int> m_stalled;
+};
+
+#endif
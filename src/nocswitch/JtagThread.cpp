@@ -41,8 +41,13 @@ using namespace std;
 /**
 	@brief Thread for handling JTAG operations
  */
-void JtagThread(JTAGNOCBridgeInterface* piface)
+void JtagThread(JTAGNOCBridgeInterface* piface, ConnectionReactor* preactor)
 {
+	//DMA messages are big, so keep one around rather than making a new one every time
+	DMAMessage dxm;
+	unsigned char dmabuf[1 + (DMAMessage::HEADER_WORDS + DMAMessage::MAX_DATA_WORDS) * 4];
+	unsigned char rpcbuf[17];
+
 	try
 	{
 		while(!g_quitting)
@@ -50,6 +55,9 @@ void JtagThread(JTAGNOCBridgeInterface* piface)
 			//Push pending messages, get whatever comes back
 			piface->Cycle();
 
+			//If clients are waiting for room in the TX queues, let them know when there is some
+			preactor->CheckStalledConnections();
+
 			//Dispatch returned data to the various clients
 			RPCMessage rxm;
 			while(piface->RecvRPCMessage(rxm))
@@ -64,19 +72,32 @@ void JtagThread(JTAGNOCBridgeInterface* piface)
 				}
 				ConnectionContext* pctx = g_contextMap[rxm.to];
 
-				//We found the context, map mutex is still locked (important, will prevent thread from terminating!)
-				//Now we have to lock the socket (wait for any pending sends to finish) before sending our data
-				lock_guard<mutex> sockmutex(pctx->m_mutex);
-
-				//and now we can finally send the message
-				uint8_t opcode = NOCSWITCH_OP_RPC;
-				pctx->m_socket.SendLooped(&opcode, 1);
-				unsigned char buf[16];
-				rxm.Pack(buf);
-				pctx->m_socket.SendLooped(buf, 16);
+				//We found the context, map mutex is still locked (important, will prevent the connection from being
+				//closed out from under us!) so we can send the message.
+				//This never blocks: if the client is slow, the data is buffered until it catches up.
+				rpcbuf[0] = NOCSWITCH_OP_RPC;
+				rxm.Pack(rpcbuf + 1);
+				pctx->Send(rpcbuf, sizeof(rpcbuf));
 			}
 
-			//TODO: Repeat for DMA
+			//Repeat for DMA
+			while(piface->RecvDMAMessage(dxm))
+			{
+				lock_guard<mutex> mapmutex(g_contextMutex);
+				if(g_contextMap.find(dxm.to) == g_contextMap.end())
+				{
+					LogWarning("Got a DMA message addressed to 0x%04x, but we don't have an active client there\n",
+						dxm.to);
+					LogWarning("Message was: %s\n", dxm.Format().c_str());
+					continue;
+				}
+				ConnectionContext* pctx = g_contextMap[dxm.to];
+
+				//Opcode and message go out in one send
+				dmabuf[0] = NOCSWITCH_OP_RECVDMA;
+				dxm.Pack(dmabuf + 1);
+				pctx->Send(dmabuf, 1 + dxm.GetPackedLength()*4);
+			}
 		}
 	}
 	catch(const JtagException& ex)
@@ -48,7 +48,7 @@ void sig_handler(int sig);
 
 Socket g_socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
 
-bool g_quitting = false;
+atomic<bool> g_quitting(false);
 
 int main(int argc, char* argv[])
 {
@@ -71,6 +71,14 @@ int main(int argc, char* argv[])
 		//Device index
 		int devnum = 0;
 
+		//Number of threads servicing client connections
+		unsigned int nthreads = 1;
+
+		//JTAG scan window (zero for the bridge's default), and limits if it's adaptive
+		unsigned int window = 0;
+		unsigned int window_min = 0;
+		unsigned int window_max = 0;
+
 		//Operations to do
 		enum
 		{
@@ -135,6 +143,50 @@ int main(int argc, char* argv[])
 				//TODO: sanity check
 				devnum = atoi(argv[++i]);
 			}
+			else if(s == "--window")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				window = atoi(argv[++i]);
+			}
+			else if(s == "--adaptive-window")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				if( (2 != sscanf(argv[++i], "%u:%u", &window_min, &window_max)) || (window_min > window_max) )
+				{
+					throw JtagExceptionWrapper(
+						"Adaptive window must be specified as min:max",
+						"");
+				}
+			}
+			else if(s == "--threads")
+			{
+				if(i+1 >= argc)
+				{
+					throw JtagExceptionWrapper(
+						"Not enough arguments",
+						"");
+				}
+
+				nthreads = atoi(argv[++i]);
+				if(nthreads == 0)
+				{
+					throw JtagExceptionWrapper(
+						"Need at least one thread",
+						"");
+				}
+			}
 			else if(s == "--version")
 				op = OP_VERSION;
 			else
@@ -278,42 +330,19 @@ int main(int argc, char* argv[])
 		//Start the JTAG thread AFTER creating and binding the socket so we don't have problems with the JTAG interface
 		//mysteriously disappearing on us if the port is already used.
 		JTAGNOCBridgeInterface nface(pfpga);
-		thread jtag(JtagThread, &nface);
+		if(window_max != 0)
+			nface.SetAdaptiveWindow(window_min, window_max);
+		else if(window != 0)
+			nface.SetWindowSize(window);
+		ConnectionReactor reactor(g_socket, &nface);
+		thread jtag(JtagThread, &nface, &reactor);
 
-		//Wait for connections
-		vector<thread*> threads;
-		vector<int> sockets;
-		while(true)
-		{
-			try
-			{
-				Socket client = g_socket.Accept();
-				if(!client.IsValid())		//disconnecting or something? Shut down cleanly
-					break;
-				threads.push_back(new thread(ConnectionThread, client.Detach(), &nface));
-
-				/*
-				#ifndef _WINDOWS
-				if(0 != setsockopt(data->client_socket, SOL_SOCKET, SO_LINGER, &sol, sizeof(sol)))
-					printf("[nocswitch] WARNING: Failed to set SOL_LINGER on client socket, connection reuse may not be possible\n");
-				#endif
-				*/
-			}
-			catch(const JtagException& ex)
-			{
-				break;
-			}
-		}
-
-		//We're terminating - wait for client threads to stop
-		for(auto t : threads)
-		{
-			t->join();
-			delete t;
-		}
+		//Service clients until we're told to quit
+		reactor.Run(nthreads);
 
 		//Wait for JTAG thread to stop
 		jtag.join();
+		nface.PrintStatistics();
 	}
 
 	catch(const JtagException& ex)
@@ -338,7 +367,11 @@ void ShowUsage()
 		"    --port PORT                                      Specifies the jtagd port number to connect to\n"
 		"    --server [hostname]                              Specifies the hostname of the jtagd server to connect to.\n"
 		"    --device [index]                                 Specifies the index of the device to use.\n"
+		"    --threads N                                      Number of threads serving clients (default 1).\n"
 		"    --version                                        Prints program version number and exits.\n"
+		"    --window WORDS                                   Number of 32-bit words per JTAG scan (default 32).\n"
+		"    --adaptive-window MIN:MAX                        Sizes each JTAG scan between MIN and MAX words, depending\n"
+		"                                                     on how much data is waiting.\n"
 		"\n"
 		);
 }
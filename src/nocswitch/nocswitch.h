@@ -40,29 +40,37 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <memory.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <string>
 #include <list>
 #include <map>
+#include <memory>
+#include <set>
+#include <vector>
 #include <atomic>
 #include <signal.h>
 #include <thread>
 #include <mutex>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
 #include "../log/log.h"
 #include "../xptools/Socket.h"
 #include "../jtaghal/jtaghal.h"
 #include "../nocbridge/nocbridge.h"
 
 #include "ConnectionContext.h"
+#include "ConnectionReactor.h"
 #include "nocswitch_opcodes_enum.h"
 
-void JtagThread(JTAGNOCBridgeInterface* piface);
-void ConnectionThread(int sock, JTAGNOCBridgeInterface* iface);
+void JtagThread(JTAGNOCBridgeInterface* piface, ConnectionReactor* preactor);
 bool IsInDebugSubnet(int addr);
 
 extern std::mutex g_contextMutex;
 extern std::map<uint16_t, ConnectionContext*> g_contextMap;
 
-extern bool g_quitting;
+extern std::atomic<bool> g_quitting;
 
 #endif